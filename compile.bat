@@ -3,9 +3,17 @@
 echo "Compiling the Windows version of the library"
 cl.exe /LD /DBUILD_LIB /std:c++17 /EHsc /Fo:build/windows/ /Fe:bin/windows/iso.dll ^
     thirdparty\popstationmdg\src\plugins\export.cpp ^
-    src\iso_reader.cpp src\iso_writer.cpp src\iso_common.cpp ^
+    src\iso_reader.cpp src\iso_writer.cpp src\iso_common.cpp src\iso_sectors.cpp src\iso_idscan.cpp src\iso_idcache.cpp ^
+    src\iso_threadpool.cpp src\iso_async.cpp src\iso_direct.cpp src\iso_hash.cpp src\iso_ecc.cpp src\iso_encoder.cpp ^
+    src\iso_stats.cpp src\iso_log.cpp src\iso_views.cpp src\iso_disks.cpp src\iso_compressed.cpp src\iso_sharedcache.cpp src\iso_library.cpp src\iso_batch.cpp src\iso_prefetch.cpp src\iso_native.cpp ^
+    zlib.lib ^
     /Iinclude ^
     /Ithirdparty/popstationmdg/thirdparty ^
     /Ithirdparty/popstationmdg/src/plugins/ ^
     /Ithirdparty/popstationmdg/include/ ^
-    /Ithirdparty/popstationmdg/include/plugins/
\ No newline at end of file
+    /Ithirdparty/popstationmdg/include/plugins/
+
+echo "Compiling the benchmark"
+cl.exe /std:c++17 /EHsc /O2 /Fo:build/windows/ /Fe:bin/windows/bench_iso.exe ^
+    src\bench_iso.cpp ^
+    /Ithirdparty/popstationmdg/thirdparty
@@ -10,19 +10,47 @@ mkdir -p bin/linux
 # Linux version #
 #################
 
+# Library build type. The release build removes the debug and trace messages at compile time, and it is the one
+# measured by the benchmark. Run "DEBUG=1 ./compile.sh" to build the library with debug info and messages.
+if [ "$DEBUG" = "1" ]; then
+    LIBRARY_FLAGS="-g -DDEBUG"
+else
+    LIBRARY_FLAGS="-O2"
+fi
+
 # Compile the library
 echo "Compiling the Linux version"
-# Compile the library
+# Compile the library. Add -DUSE_LZ4 and -llz4 to read and write the ZSO images.
 echo -e "\tCompiling the Library"
-g++ -g \
+g++ $LIBRARY_FLAGS \
     -Iinclude \
     -Ithirdparty \
     -Ithirdparty/popstationmdg/include/ \
     -Ithirdparty/popstationmdg/thirdparty/ \
-    -std=c++17 -ffunction-sections -fPIC -shared -static-libgcc -static-libstdc++ -g \
+    -std=c++17 -ffunction-sections -fPIC -shared -static-libgcc -static-libstdc++ -pthread \
     src/iso_common.cpp \
     src/iso_reader.cpp \
     src/iso_writer.cpp \
+    src/iso_sectors.cpp \
+    src/iso_idscan.cpp \
+    src/iso_idcache.cpp \
+    src/iso_threadpool.cpp \
+    src/iso_async.cpp \
+    src/iso_direct.cpp \
+    src/iso_hash.cpp \
+    src/iso_ecc.cpp \
+    src/iso_encoder.cpp \
+    src/iso_stats.cpp \
+    src/iso_log.cpp \
+    src/iso_views.cpp \
+    src/iso_disks.cpp \
+    src/iso_compressed.cpp \
+    src/iso_sharedcache.cpp \
+    src/iso_library.cpp \
+    src/iso_batch.cpp \
+    src/iso_prefetch.cpp \
+    src/iso_native.cpp \
+    -lz \
     -o bin/linux/iso.so
 
 echo -e "\tCompiling the Test Programs (Reader)"
@@ -50,6 +78,16 @@ g++ -g \
     src/test_writer.cpp \
     -o bin/linux/test_writer
 
+echo -e "\tCompiling the Benchmark"
+g++ -O2 \
+    -Iinclude \
+    -Ithirdparty \
+    -Ithirdparty/popstationmdg/include/ \
+    -Ithirdparty/popstationmdg/thirdparty/ \
+    src/bench_iso.cpp \
+    -ldl -static-libgcc -static-libstdc++ -std=c++17 \
+    -o bin/linux/bench_iso
+
 cp data/test.iso bin/linux/test.iso
 
 
@@ -71,6 +109,26 @@ x86_64-w64-mingw32-g++-posix -g \
     src/iso_common.cpp \
     src/iso_reader.cpp \
     src/iso_writer.cpp \
+    src/iso_sectors.cpp \
+    src/iso_idscan.cpp \
+    src/iso_idcache.cpp \
+    src/iso_threadpool.cpp \
+    src/iso_async.cpp \
+    src/iso_direct.cpp \
+    src/iso_hash.cpp \
+    src/iso_ecc.cpp \
+    src/iso_encoder.cpp \
+    src/iso_stats.cpp \
+    src/iso_log.cpp \
+    src/iso_views.cpp \
+    src/iso_disks.cpp \
+    src/iso_compressed.cpp \
+    src/iso_sharedcache.cpp \
+    src/iso_library.cpp \
+    src/iso_batch.cpp \
+    src/iso_prefetch.cpp \
+    src/iso_native.cpp \
+    -lz \
     -o bin/windows/iso.dll
 
 echo -e "\tCompiling the Test Programs (Reader)"
@@ -98,4 +156,14 @@ x86_64-w64-mingw32-g++-posix -g \
     -static-libgcc -static-libstdc++ -std=c++17 -O3 -s \
     -o bin/windows/test_writer.exe
 
+echo -e "\tCompiling the Benchmark"
+x86_64-w64-mingw32-g++-posix \
+    -Iinclude \
+    -Ithirdparty \
+    -Ithirdparty/popstationmdg/include/ \
+    -Ithirdparty/popstationmdg/thirdparty/ \
+    src/bench_iso.cpp \
+    -static-libgcc -static-libstdc++ -std=c++17 -O3 -s \
+    -o bin/windows/bench_iso.exe
+
 cp data/test.iso bin/windows/test.iso
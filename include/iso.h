@@ -10,19 +10,65 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <unordered_map>
 
 #include "plugins/export.h"
 #include "plugins/plugin_assistant.h"
 
 #include "nlohmann_json/json.hpp"
 
+// The log messages below this level are removed at compile time, so they have no cost in the release builds
+#ifndef SPDLOG_ACTIVE_LEVEL
+#ifdef DEBUG
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#else
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#endif
+#endif
+
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/basic_file_sink.h"
 
+#include "iso_idcache.h"
+#include "iso_async.h"
+#include "iso_direct.h"
+#include "iso_hash.h"
+#include "iso_ecc.h"
+#include "iso_stats.h"
+#include "iso_views.h"
+#include "iso_compressed.h"
+#include "iso_sharedcache.h"
+#include "iso_native.h"
+
 #define SETTINGS_MAX_BUFFER 23520000
 #define SETTINGS_MIN_BUFFER 23520
 #define SETTINGS_DEFAULT_BUFFER 235200
 
+// Raw CD sector size. Buffers are always aligned to this size
+#define RAW_SECTOR_SIZE 2352
+// User data sector sizes of the MODE1 and MODE2 images
+#define MODE1_SECTOR_SIZE 2048
+#define MODE2_SECTOR_SIZE 2336
+
+// Max number of disks of a multi-disk image. The disk numbers are stored in 8 bits.
+#define MAX_DISKS 255
+
+// Max number of images scanned at the same time by the library scan
+#define SETTINGS_MAX_SCAN_THREADS 64
+
+// Max number of buffers filled by a single scatter read
+#define BATCH_MAX_BUFFERS 1024
+
+// Limits of the read-ahead window of the sequential reads
+#define PREFETCH_MIN_WINDOW 262144
+#define PREFETCH_MAX_WINDOW 16777216
+
 using ordered_json = nlohmann::ordered_json;
 using json = nlohmann::json;
 
@@ -31,6 +77,19 @@ using json = nlohmann::json;
 
 namespace PopstationmdgPlugin
 {
+    // Game ID prefixes used by default in the disk scan
+    extern const std::vector<std::string> defaultIDPrefixes;
+
+    // Configure the log with the default settings. Only the first call does something.
+    void initDefaultLogging();
+
+    // Region of the image readed by the batch reads
+    struct ReadRange
+    {
+        unsigned long long position;
+        unsigned long long size;
+    };
+
     class IsoReader
     {
     public:
@@ -53,19 +112,38 @@ namespace PopstationmdgPlugin
         unsigned long long tell();
         unsigned long long tellCurrentDisk();
         bool setSettings(const char *settingsData, unsigned long settingsSize);
+        bool getHashes(char *hashes, unsigned long long buffersize);
+        bool getStats(char *output, unsigned long long buffersize);
+        void resetStats();
 
         // Reader
         unsigned long long readData(char *output, unsigned long long toRead);
+        unsigned long long readAt(unsigned long long position, char *output, unsigned long long toRead);
+        unsigned long long readBatch(const ReadRange *ranges, unsigned int count, char **outputs, unsigned long long *readed);
+        bool hintRanges(const ReadRange *ranges, unsigned int count);
+        bool submitRead(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag);
+        unsigned int pollCompletions(unsigned long long *tags, long long *results, unsigned int max);
+        unsigned int waitCompletions(unsigned long long *tags, long long *results, unsigned int max);
         unsigned int getTotalDisks();
         unsigned int getCurrentDisk();
         bool getID(char *id, unsigned long long buffersize);
         bool getDiskID(char *id, unsigned long long buffersize);
         bool changeCurrentDisk(unsigned int disk);
+        bool getReadCacheStats(unsigned long long &hits, unsigned long long &misses);
+        unsigned long long readSectors(unsigned long long lba, unsigned long long count, char *output);
+        bool getSectorLayout(unsigned int &size, unsigned int &mode);
+        bool verify(char *output, unsigned long long buffersize);
+        bool getBadSectors(char *output, unsigned long long buffersize);
+        bool acquireView(unsigned long long offset, unsigned long long size, const char *&data, unsigned long long &length);
+        bool releaseView(const char *data);
+        IsoReader *getDiskReader();
+        bool scanLibrary(const char *rootPath, unsigned int threads, const char *outputPath);
 
         // Writer
         unsigned long long writeData(char *output, unsigned long long toWrite);
         bool addNewDisk();
         bool closeCurrentDisk();
+        bool setExpectedSize(unsigned long long size);
 
     protected:
         // Error management
@@ -74,13 +152,113 @@ namespace PopstationmdgPlugin
         void freeReaderResources();
         void freeWriterResources();
         std::string getDiskFilename(uint8_t diskNumber);
+        std::string getOutputDiskFilename(unsigned int diskNumber);
+        bool isPlaylistOutput();
+        bool findDiskFiles(std::vector<std::string> &files, unsigned int &current);
+        bool openDisks(const std::vector<std::string> &files, unsigned int current, unsigned int compressionLevel, unsigned int threads);
+        void closeDisks();
+        void detectDiskIDs();
+        bool writePlaylist();
+        static ordered_json scanLibraryImage(IsoReader &scanner, const std::string &path, unsigned long long size);
+        bool openOutputFile(const char *filename);
+        bool closeOutputFile();
+        unsigned long long readDataFromFile(char *output, unsigned long long toRead);
+        unsigned long long writeDataToFile(char *input, unsigned long long toWrite);
+        unsigned long long writeOutputData(char *input, unsigned long long toWrite);
+        bool startRawEncoder();
+        bool stopRawEncoder();
+        unsigned long long writeRawSectors(char *input, unsigned long long toWrite);
+        bool startCompressedOutput(const char *filename);
+        bool finishCompressedOutput();
+        bool writeCompressedIndex();
+        bool encodeRawBatch(const char **sources, unsigned long long count);
+        bool fillReadBuffer(unsigned long long position);
+        unsigned long long readDataBuffered(char *output, unsigned long long toRead);
+        bool openNativeInput(const char *filename);
+        bool openCompressedImage();
+        unsigned long long readImageAt(unsigned long long position, char *output, unsigned long long toRead);
+        bool openSharedCache();
+        unsigned long long readAtShared(unsigned long long position, char *output, unsigned long long toRead);
+        unsigned long long readFileAt(unsigned long long position, char *output, unsigned long long toRead);
+        void updatePrefetch(unsigned long long position, unsigned long long size);
+        bool adviseWillNeed(unsigned long long position, unsigned long long size);
+        unsigned long long readScatter(unsigned long long position, char **outputs, const unsigned long long *sizes, unsigned int count);
+        bool detectSectorLayout();
+        bool readUserSector(unsigned long long lba, char *output);
+        void checkReadSectors(unsigned long long position, const char *data, unsigned long long size);
+        bool copyJsonOutput(const std::string &data, char *output, unsigned long long buffersize);
+        bool findSystemCnfID();
+        bool detectID();
+        uint64_t getContentHash();
+        bool lookupIDCache(const char *filename);
+        bool storeIDCache();
+        void stopAsyncEngine();
+        bool usesReadPosition();
+        static long long nativeRead(void *file, char *buffer, unsigned long long size, unsigned long long position, std::atomic<uint64_t> *syscalls = nullptr);
+        static long long nativeWrite(void *file, const char *buffer, unsigned long long size, unsigned long long position, std::atomic<uint64_t> *syscalls = nullptr);
+        static std::string nativeError();
+        bool openDirectInput(const char *filename);
+        unsigned long long readAtDirect(unsigned long long position, char *output, unsigned long long toRead);
+        bool openDirectOutput(const char *filename);
+        unsigned long long writeDataDirect(char *input, unsigned long long toWrite);
+        bool flushDirectOutput();
+        bool closeDirectOutput();
+        bool preallocateOutput();
+        bool releasePreallocation();
+        void closeNativeInput();
+        bool mapInputFile();
+        bool scanDiskGameID();
+        bool scanGameID(const char *data, size_t size);
+        bool checkGameID(const char *data);
+        void setIDPrefixes(const std::vector<std::string> &prefixes);
+        void unmapInputFile();
+        bool hasView(const char *data);
+        bool detachViewBlock(ViewBlock *&block);
+        void freeViewBlock(ViewBlock *block);
+        void freeViews();
+        bool startWriterThread();
+        bool stopWriterThread();
+        void writerThreadLoop();
+        void submitWriteBuffer();
+        bool flushWriteBuffers();
+        unsigned long long writeDataBuffered(char *input, unsigned long long toWrite);
         char *last_error = nullptr;
         bool isOk = true;
         PluginType pluginMode = PTNone;
+        unsigned int workerThreads = 1;
 
         // ID
         char *gameID = nullptr;
 
+        // Multi-disk images. The reader opens every disk in its own object, and the reader calls are served by
+        // the object of the current disk. The disk objects report their errors through the parent object.
+        // The writer creates a file for every disk, named after the base filename.
+        bool multiDiskEnabled = true;
+        std::string baseFilename;
+        std::vector<IsoReader *> diskReaders;
+        IsoReader *currentDiskReader = nullptr;
+        IsoReader *parentReader = nullptr;
+        unsigned int currentDisk = 0;
+        unsigned int totalDisks = 0;
+        bool diskIDsDetected = false;
+
+        // Settings received from the host, which are passed to the disk objects
+        json currentSettings = json::object();
+
+        // Persistent ID cache
+        bool idCacheEnabled = false;
+        unsigned long idCacheSize = SETTINGS_DEFAULT_ID_CACHE;
+        std::string idCachePath;
+        std::string idCacheKey;
+        // The disk was scanned without finding an ID, so it is not scanned again
+        bool idNotFound = false;
+
+        // Game ID prefixes used by the disk scan. The prefixes are stored as 32 bits values in an open
+        // addressing table, and the first chars of them are used to find the candidates.
+        uint32_t idPrefixTable[64] = {};
+        std::vector<char> idPrefixFirstChars;
+        bool idPrefixFirstCharsTable[256] = {};
+
         // Disk Size
         // Size in rest (compressed, optimized...)
         size_t diskSize = 0;
@@ -94,6 +272,124 @@ namespace PopstationmdgPlugin
         // Cache settings
         bool bufferEnabled = false;
         unsigned long bufferSize = 235200; // 200 sectors
+
+        // Read cache. When enabled the file position is tracked in readPosition instead of the stream
+        char *readBuffer = nullptr;
+        unsigned long long readBufferStart = 0;
+        unsigned long long readBufferLength = 0;
+        unsigned long long readPosition = 0;
+        unsigned long long readCacheHits = 0;
+        unsigned long long readCacheMisses = 0;
+
+        // Access pattern of the host reads. The read-ahead window grows with the sequential reads and shrinks with the random ones.
+        bool prefetchEnabled = true;
+        unsigned long long accessPosition = 0;
+        unsigned long long lastReadEnd = 0;
+        unsigned long long prefetchWindow = 0;
+        unsigned long long prefetchedUntil = 0;
+
+        // Sector layout detected when the file is opened. A size of 0 means that the layout is unknown
+        unsigned int sectorSize = 0;
+        unsigned int sectorMode = 0;
+
+        // Native input file used for positional reads and memory map (FILE * on POSIX, HANDLE on Windows)
+        void *nativeInputFile = nullptr;
+        // Status of the native input file, taken when it is opened. The disk size is taken from it.
+        FileIdentity inputIdentity;
+
+        // Memory mapped input file. When mapped, the position is tracked in readPosition like in the read cache
+        bool memoryMapEnabled = false;
+        bool randomAccess = false;
+        char *mappedData = nullptr;
+        void *mappedMapHandle = nullptr;
+
+        // Read-only views handed to the host. Every pointer is mapped to its memory block and the number of
+        // times that it was acquired. The views of the mapped file and the read buffer share one block each.
+        std::unordered_map<const char *, std::pair<ViewBlock *, unsigned int>> views;
+        ViewBlock *mappedView = nullptr;
+        ViewBlock *readBufferView = nullptr;
+        std::mutex viewsMutex;
+
+        // Compressed images (CSO/ZSO). The data is decompressed by blocks when it is readed, so the file size is
+        // stored in diskSize and the uncompressed size in diskRealSize.
+        CompressedImage *compressedImage = nullptr;
+
+        // Sector cache shared with the other objects of the process. The blocks are identified by the file
+        // identity, so the same image opened by several objects is readed from the disk only once.
+        bool sharedCacheEnabled = false;
+        unsigned long sharedCacheSize = SETTINGS_DEFAULT_SHARED_CACHE;
+        bool sharedCacheReady = false;
+        FileIdentity sharedCacheFile;
+
+        // Compressed output (CSO/ZSO). The format is selected in the settings or by the output extension. The blocks
+        // are compressed in the pool threads and writen in order, and the index is writen when the file is closed.
+        unsigned int compressedOutputFormat = CFNone;
+        unsigned int outputCompressionLevel = 9;
+        CompressedWriter *compressedWriter = nullptr;
+
+        // Direct I/O mode. The native files are opened bypassing the system cache and all the transfers are aligned.
+        bool directIOEnabled = false;
+        bool directInput = false;
+        AlignedBufferPool *directPool = nullptr;
+        void *directOutputFile = nullptr;
+        char *directWriteBuffer = nullptr;
+        unsigned long long directWriteStart = 0;
+        unsigned long long directWriteUsed = 0;
+        bool directWriteActive = false;
+        unsigned long long directOutputEnd = 0;
+
+        // Output preallocation. The expected size is reserved without changing the file size,
+        // and the unused space is released when the file is closed.
+        std::string outputFilename;
+        unsigned long long expectedSize = 0;
+        void *preallocFile = nullptr;
+
+        // EDC/ECC check of the raw sectors while they are readed. The damaged sectors are stored in badSectors.
+        // The sectors splitted between two sequential reads are completed in sectorCheckBuffer.
+        bool sectorCheckEnabled = false;
+        std::set<unsigned long long> badSectors;
+        char sectorCheckBuffer[RAW_SECTOR_SIZE];
+        unsigned long long sectorCheckPosition = 0;
+        unsigned long long sectorCheckUsed = 0;
+
+        // Raw sectors generation. The user data is wrapped into raw sectors of the selected mode (1 or 2 form 1),
+        // which are encoded in batches splitted between the pool threads. An incomplete sector is kept in
+        // rawPendingSector until the next write, and padded with zeroes when the file is closed.
+        bool rawEncodeEnabled = false;
+        unsigned int rawEncodeMode = 1;
+        ThreadPool *rawEncodePool = nullptr;
+        char *rawEncodeBuffer = nullptr;
+        char rawPendingSector[MODE1_SECTOR_SIZE];
+        unsigned long long rawPendingUsed = 0;
+        unsigned long long rawEncodeLba = 0;
+
+        // Hashes of the readed or writen data, calculated while the data flows through the plugin
+        bool hashingEnabled = false;
+        StreamHasher *streamHasher = nullptr;
+
+        // Async reads engine, created the first time that a read is submitted
+        AsyncReadEngine *asyncEngine = nullptr;
+        unsigned int asyncQueueDepth = SETTINGS_DEFAULT_QUEUE_DEPTH;
+        unsigned int asyncPending = 0;
+
+        // Write behind double buffer. The host fills one buffer while the writer thread flushes the other
+        char *writeBuffer[2] = {nullptr, nullptr};
+        unsigned long long writeBufferUsed[2] = {0, 0};
+        bool writeBufferFull[2] = {false, false};
+        unsigned int writeBufferCurrent = 0;
+        unsigned long long writePosition = 0;
+        std::thread writerThread;
+        std::mutex writerMutex;
+        std::condition_variable writerCondition;
+        bool writerStop = false;
+        std::string writerError;
+
+        // I/O statistics. The latencies and most counters are only collected when enabled.
+        bool statsEnabled = false;
+        IoStats stats;
+
+        // The error can be set from several threads when the positional reads are used
+        std::mutex errorMutex;
     };
 }
 
@@ -0,0 +1,113 @@
+/*
+
+  Asynchronous read engines used by the submitRead/pollCompletions API
+
+*/
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "iso_threadpool.h"
+
+#ifndef _ISO_ASYNC_H_
+#define _ISO_ASYNC_H_
+
+#define SETTINGS_MAX_QUEUE_DEPTH 1024
+#define SETTINGS_MIN_QUEUE_DEPTH 1
+#define SETTINGS_DEFAULT_QUEUE_DEPTH 32
+
+// Maximum workers of the thread pool engine. Every worker keeps one read in flight.
+#define ASYNC_MAX_THREADS 16
+
+namespace PopstationmdgPlugin
+{
+    class IsoReader;
+
+    // Base class of the engines. The engines must be used from a single thread.
+    class AsyncReadEngine
+    {
+    public:
+        virtual ~AsyncReadEngine() {}
+
+        // Queue a read. The buffer must be valid until its completion is returned.
+        virtual bool submit(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag) = 0;
+        // Get up to max completions. The result is the readed bytes or a negative error code.
+        virtual unsigned int getCompletions(unsigned long long *tags, long long *results, unsigned int max, bool wait) = 0;
+        virtual const char *getName() = 0;
+    };
+
+    // Portable engine which runs the positional reads in a thread pool
+    class ThreadPoolReadEngine : public AsyncReadEngine
+    {
+    public:
+        ThreadPoolReadEngine(IsoReader *reader, unsigned int threads);
+        ~ThreadPoolReadEngine();
+
+        bool submit(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag);
+        unsigned int getCompletions(unsigned long long *tags, long long *results, unsigned int max, bool wait);
+        const char *getName() { return "threads"; }
+
+    protected:
+        IsoReader *reader;
+        std::deque<std::pair<unsigned long long, long long>> completions;
+        std::mutex completionsMutex;
+        std::condition_variable completionsCondition;
+        // Declared the last, so it is destroyed first and the workers finish before the completion queue is destroyed
+        ThreadPool pool;
+    };
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ISO_HAVE_IO_URING 1
+
+    // Linux io_uring engine. The rings are managed directly through the syscalls.
+    class IoUringReadEngine : public AsyncReadEngine
+    {
+    public:
+        ~IoUringReadEngine();
+        static IoUringReadEngine *create(int fd, unsigned int queueDepth, unsigned long long diskSize);
+
+        bool submit(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag);
+        unsigned int getCompletions(unsigned long long *tags, long long *results, unsigned int max, bool wait);
+        const char *getName() { return "io_uring"; }
+
+    protected:
+        IoUringReadEngine() {}
+        unsigned int reapCompletions(unsigned long long *tags, long long *results, unsigned int max);
+
+        int fileFd = -1;
+        int ringFd = -1;
+        unsigned long long diskSize = 0;
+
+        // Reads in flight, to return their tags and check their results. The free slots are stored in freeReads.
+        struct AsyncRead
+        {
+            unsigned long long position;
+            unsigned long long size;
+            unsigned long long tag;
+        };
+        std::vector<AsyncRead> reads;
+        std::vector<unsigned int> freeReads;
+
+        // Mapped rings
+        void *sqRing = nullptr;
+        size_t sqRingSize = 0;
+        void *cqRing = nullptr;
+        size_t cqRingSize = 0;
+        void *sqEntries = nullptr;
+        size_t sqEntriesSize = 0;
+
+        // Ring fields
+        unsigned int *sqTail = nullptr;
+        unsigned int *sqMask = nullptr;
+        unsigned int *sqArray = nullptr;
+        unsigned int *cqHead = nullptr;
+        unsigned int *cqTail = nullptr;
+        unsigned int *cqMask = nullptr;
+        void *cqEntries = nullptr;
+    };
+#endif
+}
+
+#endif // _ISO_ASYNC_H_
@@ -0,0 +1,181 @@
+/*
+
+  Compressed images reader and writer (CSO and ZSO). The images are splitted in blocks compressed independently,
+  and an index table with the position of every block is stored after the header.
+
+*/
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+#include "iso_threadpool.h"
+
+#ifndef _ISO_COMPRESSED_H_
+#define _ISO_COMPRESSED_H_
+
+// Header of the CSO and ZSO images
+#define COMPRESSED_HEADER_SIZE 24
+// Memory used by the decompressed blocks cache
+#define COMPRESSED_CACHE_SIZE 4194304
+// Data decompressed in advance when the image is readed sequentially
+#define COMPRESSED_READAHEAD_SIZE 1048576
+// Data decompressed by every task. The compressed data of consecutive blocks is readed at once.
+#define COMPRESSED_RUN_SIZE 65536
+// Block size of the writen images. It is the size expected by most of the emulators.
+#define COMPRESSED_WRITER_BLOCK_SIZE 2048
+// Image size used to reserve the index when the expected size is unknown. It covers the biggest CD images (900MB).
+#define COMPRESSED_DEFAULT_EXPECTED_SIZE 943718400
+// Biggest image size used to reserve the index (DVD9). The index of the bigger images is made room at the end.
+#define COMPRESSED_MAX_RESERVED_SIZE 8547991552ull
+
+namespace PopstationmdgPlugin
+{
+    enum CompressedFormat
+    {
+        CFNone,
+        CFCso, // Deflate blocks. The version 2 can have LZ4 blocks too.
+        CFZso  // LZ4 blocks
+    };
+
+    class CompressedImage
+    {
+    public:
+        // Reads the compressed data from the file. Returns the readed bytes.
+        using RawReader = std::function<unsigned long long(unsigned long long position, char *output, unsigned long long size)>;
+
+        CompressedImage(RawReader rawReader, unsigned int threads);
+        ~CompressedImage();
+
+        // Detect the format using the file header
+        static CompressedFormat detectFormat(const char *header, unsigned long long size);
+
+        // Load the header and the index table. Returns false and the reason if the image is not valid.
+        bool open(unsigned long long fileSize, std::string &error);
+        // Size of the uncompressed data
+        unsigned long long getSize();
+        const char *getFormatName();
+
+        // Read the uncompressed data from the provided position. It can be called from several threads at once.
+        unsigned long long read(unsigned long long position, char *output, unsigned long long size);
+
+    protected:
+        struct CachedBlock
+        {
+            std::vector<char> data;
+            bool ready = false;
+            bool failed = false;
+        };
+
+        struct CacheEntry
+        {
+            std::shared_ptr<CachedBlock> block;
+            std::list<unsigned long long>::iterator lruPosition;
+        };
+
+        std::shared_ptr<CachedBlock> getBlock(unsigned long long block, bool sequential);
+        std::shared_ptr<CachedBlock> reserveBlock(unsigned long long block);
+        void prefetch(unsigned long long block);
+        void decompressRun(unsigned long long first, std::vector<std::shared_ptr<CachedBlock>> blocks);
+        bool decompressBlock(const char *input, unsigned long long inputSize, bool flagged, char *output);
+
+        RawReader rawReader;
+        CompressedFormat format = CFNone;
+        unsigned int version = 0;
+        unsigned long long totalBytes = 0;
+        unsigned int blockSize = 0;
+        unsigned int indexShift = 0;
+        unsigned long long totalBlocks = 0;
+        std::vector<uint32_t> index;
+
+        // Decompressed blocks. The blocks being decompressed are in the cache too, but not ready.
+        std::unordered_map<unsigned long long, CacheEntry> cache;
+        std::list<unsigned long long> lru;
+        size_t cacheCapacity = 0;
+        std::mutex cacheMutex;
+        std::condition_variable cacheCondition;
+
+        // Read-ahead. Only used with more than one thread.
+        ThreadPool *pool = nullptr;
+        unsigned long long runBlocks = 1;
+        unsigned long long readaheadBlocks = 0;
+        unsigned long long prefetchedUntil = 0;
+        std::atomic<unsigned long long> lastBlock{~0ull};
+    };
+
+    class CompressedWriter
+    {
+    public:
+        // Appends the compressed data to the file. Returns false on error.
+        using RawWriter = std::function<bool(const char *data, unsigned long long size)>;
+
+        CompressedWriter(RawWriter rawWriter, CompressedFormat format, unsigned int level, unsigned int threads);
+        ~CompressedWriter();
+
+        // Reserve the space of the index for the expected size and write it. The index is patched when the
+        // image is finished, and the data is moved if the reserved space was not enough.
+        bool start(unsigned long long expectedSize, std::string &error);
+        // Compress and write the data. The blocks are compressed in parallel and writen in order.
+        unsigned long long write(const char *input, unsigned long long size, std::string &error);
+        // Write the pending blocks. Must be called before build the header.
+        bool finish(std::string &error);
+
+        // Bytes that the data must be moved to make space for the index
+        unsigned long long getRelocation();
+        // Space reserved for the header and the index, and end of the compressed data
+        unsigned long long getDataStart();
+        unsigned long long getDataEnd();
+        // Header and index of the finished image, padded to the start of the relocated data
+        bool buildHeader(unsigned long long relocation, std::vector<char> &header, std::string &error);
+
+    protected:
+        struct CompressJob
+        {
+            std::vector<char> input;
+            std::vector<char> output;
+            std::vector<unsigned int> sizes;
+            std::vector<bool> plain;
+            bool done = false;
+        };
+
+        void submitPending();
+        bool writeJobs(bool all);
+        void compressJob(CompressJob &job);
+        bool compressBlock(const char *input, unsigned int inputSize, char *output, unsigned int &outputSize);
+
+        RawWriter rawWriter;
+        CompressedFormat format = CFNone;
+        unsigned int level = 9;
+        unsigned int blockSize = COMPRESSED_WRITER_BLOCK_SIZE;
+        unsigned int indexShift = 0;
+        unsigned long long totalBytes = 0;
+        unsigned long long dataStart = 0;
+        unsigned long long position = 0;
+        bool failed = false;
+        std::string writeError;
+
+        // Position of every block in the file. The uncompressed blocks are marked in the index.
+        std::vector<unsigned long long> blockPositions;
+        std::vector<bool> blockPlain;
+
+        // Data of the blocks that are not complete yet
+        std::vector<char> pending;
+        unsigned long long runBlocks = 1;
+
+        // Blocks being compressed in the pool, in the order that they must be writen
+        ThreadPool *pool = nullptr;
+        std::deque<std::shared_ptr<CompressJob>> jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobsCondition;
+    };
+}
+
+#endif // _ISO_COMPRESSED_H_
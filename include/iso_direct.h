@@ -0,0 +1,34 @@
+/*
+
+  Aligned buffers used by the direct I/O mode
+
+*/
+
+#include <vector>
+#include <mutex>
+
+#ifndef _ISO_DIRECT_H_
+#define _ISO_DIRECT_H_
+
+// Direct I/O requires the offsets, sizes and buffers aligned to the device block. 4096 covers the common devices.
+#define DIRECT_IO_ALIGNMENT 4096
+#define DIRECT_IO_CHUNK 1048576
+
+namespace PopstationmdgPlugin
+{
+    // Pool of aligned buffers of DIRECT_IO_CHUNK bytes. The buffers are reused to not allocate them in every read.
+    class AlignedBufferPool
+    {
+    public:
+        ~AlignedBufferPool();
+
+        char *acquire();
+        void release(char *buffer);
+
+    protected:
+        std::mutex poolMutex;
+        std::vector<char *> freeBuffers;
+    };
+}
+
+#endif // _ISO_DIRECT_H_
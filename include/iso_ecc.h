@@ -0,0 +1,30 @@
+/*
+
+  EDC and ECC (Reed-Solomon P and Q parities) of the raw CD sectors
+
+*/
+
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _ISO_ECC_H_
+#define _ISO_ECC_H_
+
+namespace PopstationmdgPlugin
+{
+    // Calculate the EDC of the data, starting from a previous EDC value
+    uint32_t computeEdc(const uint8_t *data, size_t size, uint32_t edc = 0);
+
+    // Calculate the P and Q parities of a raw sector and store them in the sector. The parities are
+    // calculated over the header and the data, so the MODE2 address must be zeroed before.
+    void computeEcc(uint8_t *sector);
+
+    // Check the EDC and ECC of a raw sector. The sectors without error detection (MODE0, or MODE2 form 2
+    // without EDC) are always valid.
+    bool checkRawSector(const uint8_t *sector);
+
+    // Build a raw sector from 2048 bytes of user data. The supported modes are the MODE1 and the MODE2 form 1.
+    void encodeRawSector(uint8_t *sector, const uint8_t *userData, unsigned long long lba, unsigned int mode);
+}
+
+#endif // _ISO_ECC_H_
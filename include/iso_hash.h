@@ -0,0 +1,101 @@
+/*
+
+  CRC32, MD5 and SHA-1 digests calculated on the fly over the readed and writen data
+
+*/
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#ifndef _ISO_HASH_H_
+#define _ISO_HASH_H_
+
+// Maximum amount of data waiting to be hashed. The reads and writes are blocked while the limit is reached.
+#define HASH_QUEUE_LIMIT 67108864
+
+namespace PopstationmdgPlugin
+{
+    class Crc32
+    {
+    public:
+        void update(const uint8_t *data, size_t size);
+        std::string getDigest();
+
+    protected:
+        uint32_t crc = 0xFFFFFFFF;
+    };
+
+    class Md5
+    {
+    public:
+        Md5();
+        void update(const uint8_t *data, size_t size);
+        std::string getDigest();
+
+    protected:
+        void transform(const uint8_t *block);
+
+        uint32_t state[4];
+        uint64_t length = 0;
+        uint8_t pending[64];
+    };
+
+    class Sha1
+    {
+    public:
+        Sha1();
+        void update(const uint8_t *data, size_t size);
+        std::string getDigest();
+
+    protected:
+        void transform(const uint8_t *block);
+
+        uint32_t state[5];
+        uint64_t length = 0;
+        uint8_t pending[64];
+    };
+
+    // Hash a data stream which is received by chunks. Every digest is calculated in order by its own worker
+    // when more than one thread is available, and in the caller thread otherwise. The stream must be
+    // received sequentially: if there is a gap or a writen area is overwriten, the hashes are marked as
+    // incomplete because they don't match the file anymore.
+    class StreamHasher
+    {
+    public:
+        StreamHasher(unsigned int threads, bool overwriteInvalidates);
+        ~StreamHasher();
+
+        void update(unsigned long long position, const char *data, unsigned long long size);
+        std::string getResults();
+
+    protected:
+        void hashData(unsigned int algorithm, const uint8_t *data, size_t size);
+        void workerLoop(unsigned int worker);
+
+        Crc32 crc32;
+        Md5 md5;
+        Sha1 sha1;
+
+        bool overwriteInvalidates;
+        unsigned long long hashedSize = 0;
+        bool complete = true;
+
+        // Every worker has its own queue with the chunks pending to be hashed by its algorithms
+        unsigned int workersCount = 0;
+        std::vector<std::thread> workers;
+        std::vector<std::deque<std::shared_ptr<std::vector<char>>>> queues;
+        unsigned long long queuedBytes = 0;
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::condition_variable doneCondition;
+        bool stopping = false;
+    };
+}
+
+#endif // _ISO_HASH_H_
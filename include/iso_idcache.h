@@ -0,0 +1,76 @@
+/*
+
+  Persistent game ID cache shared by all the plugin instances and processes
+
+*/
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+#include "iso_sharedcache.h"
+
+#ifndef _ISO_IDCACHE_H_
+#define _ISO_IDCACHE_H_
+
+#define SETTINGS_MAX_ID_CACHE 1000000
+#define SETTINGS_MIN_ID_CACHE 100
+#define SETTINGS_DEFAULT_ID_CACHE 10000
+
+// The stored entries are writen to the cache file when there are this number of them pending, or when the
+// oldest one was stored this number of seconds ago. The rest are writen when the process finishes.
+#define ID_CACHE_FLUSH_ENTRIES 1000
+#define ID_CACHE_FLUSH_TIME 30
+// The cache file is checked for changes of other processes at most once in this number of seconds
+#define ID_CACHE_RELOAD_TIME 1
+
+namespace PopstationmdgPlugin
+{
+    struct GameIDCacheEntry
+    {
+        std::string gameID;
+        unsigned int sectorSize = 0;
+        unsigned int sectorMode = 0;
+        unsigned long long diskSize = 0;
+        unsigned long long lastUsed = 0;
+    };
+
+    class GameIDCache
+    {
+    public:
+        ~GameIDCache();
+
+        static GameIDCache &getInstance();
+        static std::string getDefaultPath();
+        static std::string getFileKey(const char *filename, const FileIdentity &identity, uint64_t contentHash);
+
+        bool lookup(const std::string &cachePath, const std::string &key, GameIDCacheEntry &entry);
+        bool store(const std::string &cachePath, unsigned long maxEntries, const std::string &key, GameIDCacheEntry entry);
+        // Write the pending entries to the cache file
+        bool flush();
+
+    protected:
+        bool flushPending();
+        bool reload(const std::string &cachePath, bool force);
+        void restorePending();
+        bool save(const std::string &cachePath, unsigned long maxEntries);
+
+        std::mutex cacheMutex;
+        std::map<std::string, GameIDCacheEntry> entries;
+
+        // Stored entries which are not in the cache file yet
+        std::map<std::string, GameIDCacheEntry> pendingEntries;
+        std::string pendingPath;
+        unsigned long pendingMaxEntries = 0;
+        unsigned long long pendingSince = 0;
+
+        // Loaded cache file and its state, to reload it only when was modified by other process
+        std::string loadedPath;
+        long long loadedTime = 0;
+        unsigned long long loadedSize = 0;
+        unsigned long long loadedCheck = 0;
+    };
+}
+
+#endif // _ISO_IDCACHE_H_
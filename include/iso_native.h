@@ -0,0 +1,30 @@
+/*
+
+  Native file functions used instead of the libc open/close
+
+*/
+
+#ifndef _WIN32
+#include <cstdio>
+#endif
+
+#ifndef _ISO_NATIVE_H_
+#define _ISO_NATIVE_H_
+
+namespace PopstationmdgPlugin
+{
+#ifndef _WIN32
+    // The plugin API exports functions called open and close, and inside the library they replace the libc
+    // ones with the same names. The native files are opened with openat and closed with the close syscall,
+    // which are not affected. The FILE objects can be closed with fclose, which doesn't call the close symbol.
+
+    // Open a file with the provided open flags. Returns -1 on error, with errno set.
+    int nativeOpenFd(const char *filename, int flags);
+    void nativeCloseFd(int fd);
+
+    // Open a file with the provided open flags as a FILE object. Returns nullptr on error, with errno set.
+    FILE *nativeOpenFile(const char *filename, int flags);
+#endif
+}
+
+#endif // _ISO_NATIVE_H_
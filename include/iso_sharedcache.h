@@ -0,0 +1,108 @@
+/*
+
+  Sector cache shared by all the plugin objects of the process
+
+*/
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "nlohmann_json/json.hpp"
+
+#ifndef _ISO_SHAREDCACHE_H_
+#define _ISO_SHAREDCACHE_H_
+
+// Memory used by the shared cache, in MB
+#define SETTINGS_MAX_SHARED_CACHE 4096
+#define SETTINGS_MIN_SHARED_CACHE 16
+#define SETTINGS_DEFAULT_SHARED_CACHE 256
+
+// Size of the cached blocks (32 raw sectors)
+#define SHARED_CACHE_BLOCK_SIZE 75264
+// The cache is splitted in shards with their own lock, so the readers of different blocks don't block each other
+#define SHARED_CACHE_SHARDS 16
+
+namespace PopstationmdgPlugin
+{
+    // Identity of a file, which doesn't depend on the path used to open it. The size and the
+    // modification time are included, so the blocks of a modified file are not used.
+    struct FileIdentity
+    {
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t modified = 0;
+
+        bool operator==(const FileIdentity &other) const
+        {
+            return device == other.device && inode == other.inode && size == other.size && modified == other.modified;
+        }
+    };
+
+    // Blocks of the images readed by any plugin object. The blocks are evicted using the CLOCK algorithm:
+    // the reads only mark the block as referenced, so they can be done at the same time with a shared lock.
+    class SharedSectorCache
+    {
+    public:
+        static SharedSectorCache &getInstance();
+        static bool getFileIdentity(void *nativeFile, FileIdentity &identity);
+
+        // Maximum memory used by the cache. The blocks over the new size are freed.
+        void setCapacity(unsigned long long bytes);
+
+        // Copy a part of a cached block. Returns false if the block is not in the cache.
+        bool read(const FileIdentity &file, unsigned long long block, unsigned long long offset, char *output, unsigned long long size);
+        // Check if the block is in the cache without copying it. The missing blocks are counted as misses too.
+        bool contains(const FileIdentity &file, unsigned long long block);
+        void store(const FileIdentity &file, unsigned long long block, const char *data, unsigned long long size);
+
+        nlohmann::ordered_json toJson();
+
+    protected:
+        struct BlockKey
+        {
+            FileIdentity file;
+            unsigned long long block = 0;
+
+            bool operator==(const BlockKey &other) const
+            {
+                return block == other.block && file == other.file;
+            }
+        };
+
+        struct BlockKeyHash
+        {
+            size_t operator()(const BlockKey &key) const;
+        };
+
+        struct Slot
+        {
+            BlockKey key;
+            std::vector<char> data;
+            std::atomic<bool> referenced{false};
+        };
+
+        struct Shard
+        {
+            std::shared_mutex mutex;
+            std::unordered_map<BlockKey, size_t, BlockKeyHash> blocks;
+            std::vector<std::unique_ptr<Slot>> slots;
+            size_t capacity = 0;
+            size_t hand = 0;
+        };
+
+        Shard &getShard(const BlockKey &key);
+
+        Shard shards[SHARED_CACHE_SHARDS];
+        std::atomic<unsigned long long> capacityBytes{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> evictions{0};
+    };
+}
+
+#endif // _ISO_SHAREDCACHE_H_
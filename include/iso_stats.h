@@ -0,0 +1,90 @@
+/*
+
+  I/O statistics of every plugin object: operation counters and latency histograms
+
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "nlohmann_json/json.hpp"
+
+#ifndef _ISO_STATS_H_
+#define _ISO_STATS_H_
+
+// The bucket N of the histograms counts the latencies between 2^(N-1) and 2^N nanoseconds. 2^40 ns are about 18 minutes.
+#define STATS_HISTOGRAM_BUCKETS 41
+
+namespace PopstationmdgPlugin
+{
+    // Latency histogram with log2 buckets. The values can be added from several threads.
+    class LatencyHistogram
+    {
+    public:
+        void add(uint64_t nanoseconds);
+        void reset();
+        nlohmann::ordered_json toJson();
+
+    protected:
+        uint64_t getPercentile(uint64_t total, double percentile);
+
+        std::atomic<uint64_t> buckets[STATS_HISTOGRAM_BUCKETS] = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> totalTime{0};
+        std::atomic<uint64_t> maxTime{0};
+    };
+
+    // Counters of a plugin object. All of them, including the syscalls and the errors, are only counted when
+    // the statistics are enabled.
+    class IoStats
+    {
+    public:
+        void reset();
+        nlohmann::ordered_json toJson();
+
+        std::atomic<uint64_t> bytesRead{0};
+        std::atomic<uint64_t> bytesWritten{0};
+        std::atomic<uint64_t> readCalls{0};
+        std::atomic<uint64_t> writeCalls{0};
+        std::atomic<uint64_t> seekCalls{0};
+        std::atomic<uint64_t> getIDCalls{0};
+        std::atomic<uint64_t> syscalls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> sharedCacheHits{0};
+        std::atomic<uint64_t> sharedCacheMisses{0};
+        std::atomic<uint64_t> prefetchHints{0};
+
+        LatencyHistogram readLatency;
+        LatencyHistogram writeLatency;
+        LatencyHistogram seekLatency;
+        LatencyHistogram getIDLatency;
+    };
+
+    // Add the time spent in the scope to the histogram. Nothing is measured without histogram.
+    class LatencyTimer
+    {
+    public:
+        LatencyTimer(LatencyHistogram *histogram) : histogram(histogram)
+        {
+            if (histogram != nullptr)
+            {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~LatencyTimer()
+        {
+            if (histogram != nullptr)
+            {
+                histogram->add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+
+    protected:
+        LatencyHistogram *histogram;
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+#endif // _ISO_STATS_H_
@@ -0,0 +1,42 @@
+/*
+
+  Simple fixed size thread pool used by the parallel tasks of the plugin
+
+*/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#ifndef _ISO_THREADPOOL_H_
+#define _ISO_THREADPOOL_H_
+
+namespace PopstationmdgPlugin
+{
+    class ThreadPool
+    {
+    public:
+        ThreadPool(unsigned int threads);
+        ~ThreadPool();
+
+        void submit(std::function<void()> task);
+        void wait();
+        unsigned int getThreads();
+
+    protected:
+        void workerLoop();
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex tasksMutex;
+        std::condition_variable tasksCondition;
+        std::condition_variable doneCondition;
+        unsigned int activeTasks = 0;
+        bool stopping = false;
+    };
+}
+
+#endif // _ISO_THREADPOOL_H_
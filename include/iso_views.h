@@ -0,0 +1,38 @@
+/*
+
+  Read-only views into the data stored in the plugin memory (memory map or read buffer)
+
+*/
+
+#include <cstdint>
+
+#ifndef _ISO_VIEWS_H_
+#define _ISO_VIEWS_H_
+
+// Max size of the views served from a private buffer when the file is not mapped or cached
+#define VIEW_MAX_PRIVATE_SIZE 23520000
+
+namespace PopstationmdgPlugin
+{
+    enum ViewMemoryType
+    {
+        VMMapped,      // The memory mapped file
+        VMReadBuffer,  // A read buffer of the plugin
+        VMPrivate      // A buffer reserved only for the view
+    };
+
+    // Memory block referenced by one or more views. The block is not freed or refilled while it has
+    // references. When the plugin needs the memory for something else (buffer refill or file close),
+    // the block is detached and freed when its last view is released.
+    struct ViewBlock
+    {
+        ViewMemoryType type;
+        char *data = nullptr;
+        unsigned long long size = 0;
+        void *mapHandle = nullptr;
+        unsigned int references = 0;
+        bool detached = false;
+    };
+}
+
+#endif // _ISO_VIEWS_H_
@@ -0,0 +1,666 @@
+/*
+ *
+ * Benchmark of the plugin I/O paths. It creates a synthetic image and measures the write throughput, the
+ * sequential read throughput, the random read latency and the game ID latency. The results are stored in
+ * JSON format to compare them between plugin versions.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <fstream>
+
+#include "nlohmann_json/json.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define EXT ".dll"
+#else
+#include <dlfcn.h>
+#define EXT ".so"
+#endif
+
+using ordered_json = nlohmann::ordered_json;
+using benchClock = std::chrono::steady_clock;
+
+// Plugin exports used by the benchmark
+typedef void (*getPluginInfoFunc)(char *output, unsigned long long &buffersize);
+typedef void *(*loadFunc)();
+typedef void (*unloadFunc)(void *handler);
+typedef bool (*openFunc)(void *handler, char *filename, unsigned int mode, unsigned int compression, unsigned int threads);
+typedef bool (*closeFunc)(void *handler);
+typedef bool (*getErrorFunc)(void *handler, char *error, unsigned long long buffersize);
+typedef bool (*setSettingsFunc)(void *handler, const char *settingsData, unsigned long settingsSize);
+typedef bool (*seekFunc)(void *handler, unsigned long long position, unsigned int mode);
+typedef unsigned long long (*readDataFunc)(void *handler, char *output, unsigned long long toRead);
+typedef unsigned long long (*writeDataFunc)(void *handler, char *input, unsigned long long inputSize);
+typedef bool (*getGameIDFunc)(void *handler, char *id, unsigned long long buffersize);
+
+struct Plugin
+{
+    void *library = nullptr;
+    getPluginInfoFunc getPluginInfo = nullptr;
+    loadFunc load = nullptr;
+    unloadFunc unload = nullptr;
+    openFunc open = nullptr;
+    closeFunc close = nullptr;
+    getErrorFunc getError = nullptr;
+    setSettingsFunc setSettings = nullptr;
+    seekFunc seek = nullptr;
+    readDataFunc readData = nullptr;
+    writeDataFunc writeData = nullptr;
+    getGameIDFunc getGameID = nullptr;
+};
+
+struct Options
+{
+    std::string plugin = "./iso" EXT;
+    std::string image = "bench_iso.iso";
+    std::string output = "bench_iso.json";
+    std::string settings = "{}";
+    std::string gameID = "SLUS_012.34";
+    unsigned long long size = 64;
+    unsigned int threads = 1;
+    unsigned int iterations = 1000;
+    unsigned int seed = 1;
+    bool raw = false;
+    bool keep = false;
+};
+
+// Plugin modes and seek modes, as defined by the main program
+static const unsigned int modeReader = 1;
+static const unsigned int modeWriter = 2;
+static const unsigned int seekBegin = 0;
+
+static void *loadSymbol(void *library, const char *name)
+{
+#ifdef _WIN32
+    return (void *)GetProcAddress((HMODULE)library, name);
+#else
+    return dlsym(library, name);
+#endif
+}
+
+static bool loadPlugin(const std::string &path, Plugin &plugin)
+{
+#ifdef _WIN32
+    void *library = (void *)LoadLibraryA(path.c_str());
+#else
+    void *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (library == nullptr)
+    {
+        fprintf(stderr, "The plugin %s can't be loaded\n", path.c_str());
+        return false;
+    }
+
+    plugin.library = library;
+    plugin.getPluginInfo = (getPluginInfoFunc)loadSymbol(library, "getPluginInfo");
+    plugin.load = (loadFunc)loadSymbol(library, "load");
+    plugin.unload = (unloadFunc)loadSymbol(library, "unload");
+    plugin.open = (openFunc)loadSymbol(library, "open");
+    plugin.close = (closeFunc)loadSymbol(library, "close");
+    plugin.getError = (getErrorFunc)loadSymbol(library, "getError");
+    plugin.setSettings = (setSettingsFunc)loadSymbol(library, "setSettings");
+    plugin.seek = (seekFunc)loadSymbol(library, "seek");
+    plugin.readData = (readDataFunc)loadSymbol(library, "readData");
+    plugin.writeData = (writeDataFunc)loadSymbol(library, "writeData");
+    plugin.getGameID = (getGameIDFunc)loadSymbol(library, "getGameID");
+
+    if (!plugin.getPluginInfo || !plugin.load || !plugin.unload || !plugin.open || !plugin.close || !plugin.getError ||
+        !plugin.setSettings || !plugin.seek || !plugin.readData || !plugin.writeData || !plugin.getGameID)
+    {
+        fprintf(stderr, "The plugin %s doesn't have all the required functions\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Unload the plugin library, which writes the caches of the plugin
+static void unloadPlugin(Plugin &plugin)
+{
+    if (plugin.library == nullptr)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    FreeLibrary((HMODULE)plugin.library);
+#else
+    dlclose(plugin.library);
+#endif
+    plugin.library = nullptr;
+}
+
+static std::string getPluginError(Plugin &plugin, void *handler)
+{
+    char error[1024];
+    plugin.getError(handler, error, sizeof(error));
+    return std::string(error);
+}
+
+// Open a new plugin object applying the settings of the benchmark and the extra settings
+static void *openHandler(Plugin &plugin, const Options &options, const std::string &file, unsigned int mode, const std::string &extraSettings = "")
+{
+    void *handler = plugin.load();
+    plugin.setSettings(handler, options.settings.c_str(), options.settings.size());
+    if (!extraSettings.empty())
+    {
+        plugin.setSettings(handler, extraSettings.c_str(), extraSettings.size());
+    }
+
+    if (!plugin.open(handler, (char *)file.c_str(), mode, 9, options.threads))
+    {
+        fprintf(stderr, "Error opening %s: %s\n", file.c_str(), getPluginError(plugin, handler).c_str());
+        plugin.unload(handler);
+        return nullptr;
+    }
+
+    return handler;
+}
+
+static void closeHandler(Plugin &plugin, void *handler)
+{
+    plugin.close(handler);
+    plugin.unload(handler);
+}
+
+static double elapsedSeconds(benchClock::time_point start)
+{
+    return std::chrono::duration<double>(benchClock::now() - start).count();
+}
+
+// Latency percentiles in microseconds
+static ordered_json getPercentiles(std::vector<double> &samples)
+{
+    ordered_json results;
+    if (samples.empty())
+    {
+        return results;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double value)
+    {
+        return samples[std::min(samples.size() - 1, (size_t)(value * samples.size()))];
+    };
+
+    results["samples"] = samples.size();
+    results["p50_us"] = percentile(0.5);
+    results["p90_us"] = percentile(0.9);
+    results["p99_us"] = percentile(0.99);
+    results["p999_us"] = percentile(0.999);
+    results["max_us"] = samples.back();
+
+    return results;
+}
+
+//
+// Synthetic image
+//
+static void setDirectoryRecord(unsigned char *record, const char *name, uint32_t lba, uint32_t size, bool directory)
+{
+    size_t nameLength = strlen(name) == 0 ? 1 : strlen(name);
+    size_t length = 33 + nameLength + ((33 + nameLength) % 2);
+
+    memset(record, 0, length);
+    record[0] = (unsigned char)length;
+    for (int i = 0; i < 4; i++)
+    {
+        // Both endian values
+        record[2 + i] = (unsigned char)(lba >> (8 * i));
+        record[9 - i] = (unsigned char)(lba >> (8 * i));
+        record[10 + i] = (unsigned char)(size >> (8 * i));
+        record[17 - i] = (unsigned char)(size >> (8 * i));
+    }
+    record[25] = directory ? 2 : 0;
+    record[32] = (unsigned char)nameLength;
+    memcpy(record + 33, name, strlen(name));
+}
+
+// Fill a 2048 bytes sector of the synthetic image. The first sectors contains a minimal ISO9660 file system
+// with the SYSTEM.CNF file, and the rest are filled with pseudo random data.
+static void fillImageSector(unsigned char *sector, unsigned long long lba, const Options &options)
+{
+    static const uint32_t rootLba = 18;
+    static const uint32_t systemCnfLba = 19;
+    std::string systemCnf = "BOOT = cdrom:\\" + options.gameID + ";1\r\nTCB = 4\r\nEVENT = 10\r\nSTACK = 801FFFF0\r\n";
+
+    memset(sector, 0, 2048);
+
+    if (lba == 16)
+    {
+        // Primary volume descriptor
+        sector[0] = 1;
+        memcpy(sector + 1, "CD001", 5);
+        sector[6] = 1;
+        setDirectoryRecord(sector + 156, "", rootLba, 2048, true);
+    }
+    else if (lba == 17)
+    {
+        // Volume descriptor set terminator
+        sector[0] = 255;
+        memcpy(sector + 1, "CD001", 5);
+        sector[6] = 1;
+    }
+    else if (lba == rootLba)
+    {
+        unsigned char *record = sector;
+        setDirectoryRecord(record, "", rootLba, 2048, true);
+        record += record[0];
+        setDirectoryRecord(record, "\x01", rootLba, 2048, true);
+        record += record[0];
+        setDirectoryRecord(record, "SYSTEM.CNF;1", systemCnfLba, systemCnf.size(), false);
+    }
+    else if (lba == systemCnfLba)
+    {
+        memcpy(sector, systemCnf.c_str(), systemCnf.size());
+    }
+    else if (lba > systemCnfLba)
+    {
+        uint64_t state = (lba + 1) * 0x9E3779B97F4A7C15ull;
+        for (int i = 0; i < 2048; i += 8)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            memcpy(sector + i, &state, 8);
+        }
+    }
+}
+
+// Create the synthetic image. The raw images are generated by the plugin writer from the user data.
+static bool createImage(Plugin &plugin, const Options &options)
+{
+    unsigned long long sectors = options.size * 1024 * 1024 / 2048;
+    std::vector<unsigned char> chunk(2048 * 256);
+
+    void *handler = nullptr;
+    FILE *output = nullptr;
+    if (options.raw)
+    {
+        handler = openHandler(plugin, options, options.image, modeWriter, "{\"raw_sectors\":true,\"raw_sectors_mode\":2}");
+        if (handler == nullptr)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        output = fopen(options.image.c_str(), "wb");
+        if (output == nullptr)
+        {
+            fprintf(stderr, "The image %s can't be created\n", options.image.c_str());
+            return false;
+        }
+    }
+
+    bool created = true;
+    for (unsigned long long lba = 0; lba < sectors && created; lba += 256)
+    {
+        unsigned long long count = std::min(sectors - lba, 256ull);
+        for (unsigned long long i = 0; i < count; i++)
+        {
+            fillImageSector(chunk.data() + i * 2048, lba + i, options);
+        }
+
+        if (options.raw)
+        {
+            created = plugin.writeData(handler, (char *)chunk.data(), count * 2048) == count * 2048;
+        }
+        else
+        {
+            created = fwrite(chunk.data(), 1, count * 2048, output) == count * 2048;
+        }
+    }
+
+    if (options.raw)
+    {
+        created = plugin.close(handler) && created;
+        plugin.unload(handler);
+    }
+    else
+    {
+        created = fclose(output) == 0 && created;
+    }
+
+    if (!created)
+    {
+        fprintf(stderr, "There was an error creating the image %s\n", options.image.c_str());
+    }
+
+    return created;
+}
+
+//
+// Benchmarks
+//
+static ordered_json benchWrite(Plugin &plugin, const Options &options)
+{
+    ordered_json results = ordered_json::array();
+    std::string file = options.image + ".write";
+    unsigned long long total = options.size * 1024 * 1024;
+    std::vector<char> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (char)(i * 2654435761u >> 13);
+    }
+
+    for (unsigned long long chunkSize : {2048ull, 2352ull, 65536ull, 1048576ull})
+    {
+        void *handler = openHandler(plugin, options, file, modeWriter);
+        if (handler == nullptr)
+        {
+            break;
+        }
+
+        auto start = benchClock::now();
+        unsigned long long writen = 0;
+        while (writen < total)
+        {
+            unsigned long long toWrite = std::min(chunkSize, total - writen);
+            if (plugin.writeData(handler, data.data(), toWrite) != toWrite)
+            {
+                fprintf(stderr, "Write error: %s\n", getPluginError(plugin, handler).c_str());
+                break;
+            }
+            writen += toWrite;
+        }
+        // The close writes the buffered data, so it is part of the measure
+        plugin.close(handler);
+        double seconds = elapsedSeconds(start);
+        plugin.unload(handler);
+
+        ordered_json result;
+        result["chunk_size"] = chunkSize;
+        result["bytes"] = writen;
+        result["seconds"] = seconds;
+        result["mb_per_second"] = writen / seconds / 1048576.0;
+        results.push_back(result);
+
+        fprintf(stderr, "Write %8llu bytes chunks: %9.2f MB/s\n", chunkSize, writen / seconds / 1048576.0);
+    }
+
+    remove(file.c_str());
+    return results;
+}
+
+static ordered_json benchSequentialRead(Plugin &plugin, const Options &options)
+{
+    ordered_json results = ordered_json::array();
+    std::vector<char> buffer(1048576);
+
+    for (unsigned long long chunkSize : {2048ull, 2352ull, 16384ull, 65536ull, 1048576ull})
+    {
+        void *handler = openHandler(plugin, options, options.image, modeReader);
+        if (handler == nullptr)
+        {
+            break;
+        }
+
+        auto start = benchClock::now();
+        unsigned long long readed = 0;
+        unsigned long long chunkReaded = 0;
+        while ((chunkReaded = plugin.readData(handler, buffer.data(), chunkSize)) > 0)
+        {
+            readed += chunkReaded;
+        }
+        double seconds = elapsedSeconds(start);
+        closeHandler(plugin, handler);
+
+        ordered_json result;
+        result["chunk_size"] = chunkSize;
+        result["bytes"] = readed;
+        result["seconds"] = seconds;
+        result["mb_per_second"] = readed / seconds / 1048576.0;
+        results.push_back(result);
+
+        fprintf(stderr, "Sequential read %8llu bytes chunks: %9.2f MB/s\n", chunkSize, readed / seconds / 1048576.0);
+    }
+
+    return results;
+}
+
+static ordered_json benchRandomRead(Plugin &plugin, const Options &options)
+{
+    ordered_json results;
+    void *handler = openHandler(plugin, options, options.image, modeReader);
+    if (handler == nullptr)
+    {
+        return results;
+    }
+
+    // Sector aligned reads, using the raw sector size if the image is raw
+    unsigned long long sectorSize = options.raw ? 2352 : 2048;
+    unsigned long long sectors = options.size * 1024 * 1024 / 2048;
+    std::mt19937_64 random(options.seed);
+    std::vector<char> buffer(sectorSize);
+    std::vector<double> samples;
+    samples.reserve(options.iterations);
+
+    for (unsigned int i = 0; i < options.iterations; i++)
+    {
+        unsigned long long position = (random() % sectors) * sectorSize;
+
+        auto start = benchClock::now();
+        bool readed = plugin.seek(handler, position, seekBegin) && plugin.readData(handler, buffer.data(), sectorSize) == sectorSize;
+        samples.push_back(elapsedSeconds(start) * 1000000.0);
+
+        if (!readed)
+        {
+            fprintf(stderr, "Random read error: %s\n", getPluginError(plugin, handler).c_str());
+            break;
+        }
+    }
+    closeHandler(plugin, handler);
+
+    results["read_size"] = sectorSize;
+    results["latency"] = getPercentiles(samples);
+    fprintf(stderr, "Random seek + read: p50 %.2f us, p99 %.2f us\n", results["latency"].value("p50_us", 0.0), results["latency"].value("p99_us", 0.0));
+
+    return results;
+}
+
+// ID cache file used by the game ID benchmark. The plugin writes the pending entries again when it is unloaded, or
+// when the process finishes if the library stays loaded, so the file is removed at exit by a handler registered
+// before the plugin is loaded, which runs after both.
+static std::string idCachePath;
+
+static void removeIDCache()
+{
+    remove(idCachePath.c_str());
+    remove((idCachePath + ".lock").c_str());
+}
+
+// Latency of opening an image and getting its ID, without and with the persistent ID cache. Without the cache
+// the ID is searched every time, and with it the ID is taken from the cache, which was filled by a first search.
+// The image is in the system cache in both cases, because it was readed by the previous benchmarks.
+static ordered_json benchGameID(Plugin &plugin, const Options &options)
+{
+    ordered_json results;
+    ordered_json cacheSettings;
+    cacheSettings["id_cache"] = true;
+    cacheSettings["id_cache_path"] = idCachePath;
+
+    unsigned int iterations = std::max(1u, options.iterations / 10);
+    for (int cached = 0; cached < 2; cached++)
+    {
+        std::vector<double> samples;
+        std::string id;
+
+        for (unsigned int i = 0; i < iterations + (unsigned int)cached; i++)
+        {
+            // The layout detection and the ID cache lookup are done when the file is opened, so it is measured too
+            auto start = benchClock::now();
+            void *handler = openHandler(plugin, options, options.image, modeReader, cached ? cacheSettings.dump() : "");
+            if (handler == nullptr)
+            {
+                break;
+            }
+
+            char gameID[64] = {0};
+            plugin.getGameID(handler, gameID, sizeof(gameID));
+            double microseconds = elapsedSeconds(start) * 1000000.0;
+            closeHandler(plugin, handler);
+
+            // The first search with the cache fills it
+            if (!cached || i > 0)
+            {
+                samples.push_back(microseconds);
+            }
+            id = gameID;
+        }
+
+        const char *name = cached ? "id_cache" : "no_id_cache";
+        results[name] = getPercentiles(samples);
+        results["id"] = id;
+        fprintf(stderr, "Game ID %s (%s): p50 %.2f us\n", id.c_str(), name, results[name].value("p50_us", 0.0));
+    }
+
+    return results;
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --plugin <file>      Plugin library (default ./iso%s)\n", EXT);
+    fprintf(stderr, "  --image <file>       Synthetic image path (default bench_iso.iso)\n");
+    fprintf(stderr, "  --output <file>      JSON results file (default bench_iso.json)\n");
+    fprintf(stderr, "  --size <MB>          Image size in megabytes (default 64)\n");
+    fprintf(stderr, "  --raw                Create a raw 2352 bytes sectors image\n");
+    fprintf(stderr, "  --id <id>            Boot file embedded in the image (default SLUS_012.34)\n");
+    fprintf(stderr, "  --threads <n>        Threads passed to the plugin (default 1)\n");
+    fprintf(stderr, "  --iterations <n>     Random reads measured (default 1000)\n");
+    fprintf(stderr, "  --seed <n>           Random reads seed (default 1)\n");
+    fprintf(stderr, "  --settings <json>    Plugin settings used in all the tests\n");
+    fprintf(stderr, "  --keep               Don't remove the image at the end\n");
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--raw")
+        {
+            options.raw = true;
+        }
+        else if (arg == "--keep")
+        {
+            options.keep = true;
+        }
+        else if (arg == "--plugin" && hasValue)
+        {
+            options.plugin = argv[++i];
+        }
+        else if (arg == "--image" && hasValue)
+        {
+            options.image = argv[++i];
+        }
+        else if (arg == "--output" && hasValue)
+        {
+            options.output = argv[++i];
+        }
+        else if (arg == "--size" && hasValue)
+        {
+            options.size = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--id" && hasValue)
+        {
+            options.gameID = argv[++i];
+        }
+        else if (arg == "--threads" && hasValue)
+        {
+            options.threads = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--iterations" && hasValue)
+        {
+            options.iterations = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--seed" && hasValue)
+        {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--settings" && hasValue)
+        {
+            options.settings = argv[++i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    idCachePath = options.image + ".idcache.json";
+    atexit(removeIDCache);
+
+    Plugin plugin;
+    if (!loadPlugin(options.plugin, plugin))
+    {
+        return 1;
+    }
+
+    ordered_json results;
+
+    // Plugin info, to know which version was measured
+    std::vector<char> info(65536);
+    unsigned long long infoSize = info.size();
+    plugin.getPluginInfo(info.data(), infoSize);
+    ordered_json pluginInfo = ordered_json::parse(std::string(info.data(), infoSize), nullptr, false);
+    if (!pluginInfo.is_discarded() && pluginInfo.contains("info"))
+    {
+        results["plugin"]["name"] = pluginInfo["info"].value("name", "");
+        results["plugin"]["version"] = pluginInfo["info"].value("version", "");
+    }
+
+    results["options"]["image_size"] = options.size * 1024 * 1024;
+    results["options"]["raw"] = options.raw;
+    results["options"]["threads"] = options.threads;
+    results["options"]["iterations"] = options.iterations;
+    results["options"]["seed"] = options.seed;
+    results["options"]["settings"] = ordered_json::parse(options.settings, nullptr, false);
+
+    fprintf(stderr, "Creating a %llu MB %s image\n", options.size, options.raw ? "raw" : "cooked");
+    if (!createImage(plugin, options))
+    {
+        return 1;
+    }
+
+    results["write"] = benchWrite(plugin, options);
+    results["sequential_read"] = benchSequentialRead(plugin, options);
+    results["random_read"] = benchRandomRead(plugin, options);
+    results["game_id"] = benchGameID(plugin, options);
+    unloadPlugin(plugin);
+
+    if (!options.keep)
+    {
+        remove(options.image.c_str());
+    }
+
+    std::ofstream output(options.output);
+    output << results.dump(4) << std::endl;
+    if (!output.good())
+    {
+        fprintf(stderr, "The results can't be writen to %s\n", options.output.c_str());
+        return 1;
+    }
+
+    fprintf(stderr, "Results writen to %s\n", options.output.c_str());
+    return 0;
+}
@@ -0,0 +1,433 @@
+#include "iso.h"
+
+#include <cerrno>
+
+#ifdef ISO_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace PopstationmdgPlugin
+{
+    // Only the end of the disk can end a read before the requested size, so a shorter read is a failed read.
+    // Both engines return it as -EIO, and the errors are returned as a negative error code.
+    static long long checkReadResult(long long result, unsigned long long position, unsigned long long size, unsigned long long diskSize)
+    {
+        if (result >= 0 && (unsigned long long)result < size && position + result < diskSize)
+        {
+            return -EIO;
+        }
+
+        return result;
+    }
+
+    //
+    // Thread pool engine
+    //
+    ThreadPoolReadEngine::ThreadPoolReadEngine(IsoReader *reader, unsigned int threads) : reader(reader), pool(threads)
+    {
+    }
+
+    // Wait for the pending reads, which add their completions to the queue
+    ThreadPoolReadEngine::~ThreadPoolReadEngine()
+    {
+        pool.wait();
+    }
+
+    bool ThreadPoolReadEngine::submit(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag)
+    {
+        pool.submit([this, position, buffer, size, tag]
+                    {
+                        long long readed = reader->readAt(position, buffer, size);
+
+                        readed = checkReadResult(readed, position, size, reader->getDiskRealSize());
+
+                        {
+                            std::lock_guard<std::mutex> lock(completionsMutex);
+                            completions.emplace_back(tag, readed);
+                        }
+                        completionsCondition.notify_one(); });
+
+        return true;
+    }
+
+    unsigned int ThreadPoolReadEngine::getCompletions(unsigned long long *tags, long long *results, unsigned int max, bool wait)
+    {
+        std::unique_lock<std::mutex> lock(completionsMutex);
+        if (wait)
+        {
+            completionsCondition.wait(lock, [this]
+                                      { return !completions.empty(); });
+        }
+
+        unsigned int count = 0;
+        while (count < max && !completions.empty())
+        {
+            tags[count] = completions.front().first;
+            if (results != nullptr)
+            {
+                results[count] = completions.front().second;
+            }
+            completions.pop_front();
+            count++;
+        }
+
+        return count;
+    }
+
+#ifdef ISO_HAVE_IO_URING
+    //
+    // io_uring engine
+    //
+    static int ioUringSetup(unsigned int entries, io_uring_params *params)
+    {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    static int ioUringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+    {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    // Check if the kernel supports an operation. The probe is available since the same version as IORING_OP_READ (5.6),
+    // so the older kernels fail the register call.
+    static bool ioUringSupports(int ringFd, unsigned int operation)
+    {
+        std::vector<char> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = (io_uring_probe *)buffer.data();
+
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) < 0)
+        {
+            return false;
+        }
+
+        return operation <= probe->last_op && (probe->ops[operation].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    // Create the rings. Returns nullptr if io_uring is not available, so the thread pool engine can be used instead.
+    IoUringReadEngine *IoUringReadEngine::create(int fd, unsigned int queueDepth, unsigned long long diskSize)
+    {
+        io_uring_params params = {};
+        int ringFd = ioUringSetup(queueDepth, &params);
+        if (ringFd < 0)
+        {
+            SPDLOG_DEBUG("ISO: io_uring is not available: {}", std::strerror(errno));
+            return nullptr;
+        }
+
+        if (!ioUringSupports(ringFd, IORING_OP_READ))
+        {
+            SPDLOG_DEBUG("ISO: The io_uring version doesn't support IORING_OP_READ");
+            nativeCloseFd(ringFd);
+            return nullptr;
+        }
+
+        IoUringReadEngine *engine = new IoUringReadEngine();
+        engine->fileFd = fd;
+        engine->ringFd = ringFd;
+        engine->diskSize = diskSize;
+
+        // One slot for every read in flight. The slot number is sent as the entry user data.
+        engine->reads.resize(queueDepth);
+        for (unsigned int i = queueDepth; i > 0; i--)
+        {
+            engine->freeReads.push_back(i - 1);
+        }
+
+        engine->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        engine->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+        {
+            engine->sqRingSize = engine->cqRingSize = std::max(engine->sqRingSize, engine->cqRingSize);
+        }
+
+        engine->sqRing = mmap(nullptr, engine->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (engine->sqRing == MAP_FAILED)
+        {
+            engine->sqRing = nullptr;
+            delete engine;
+            return nullptr;
+        }
+
+        if (singleMap)
+        {
+            engine->cqRing = engine->sqRing;
+        }
+        else
+        {
+            engine->cqRing = mmap(nullptr, engine->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            if (engine->cqRing == MAP_FAILED)
+            {
+                engine->cqRing = nullptr;
+                delete engine;
+                return nullptr;
+            }
+        }
+
+        engine->sqEntriesSize = params.sq_entries * sizeof(io_uring_sqe);
+        engine->sqEntries = mmap(nullptr, engine->sqEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (engine->sqEntries == MAP_FAILED)
+        {
+            engine->sqEntries = nullptr;
+            delete engine;
+            return nullptr;
+        }
+
+        char *sq = (char *)engine->sqRing;
+        engine->sqTail = (unsigned int *)(sq + params.sq_off.tail);
+        engine->sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+        engine->sqArray = (unsigned int *)(sq + params.sq_off.array);
+
+        char *cq = (char *)engine->cqRing;
+        engine->cqHead = (unsigned int *)(cq + params.cq_off.head);
+        engine->cqTail = (unsigned int *)(cq + params.cq_off.tail);
+        engine->cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+        engine->cqEntries = cq + params.cq_off.cqes;
+
+        return engine;
+    }
+
+    IoUringReadEngine::~IoUringReadEngine()
+    {
+        if (sqEntries != nullptr)
+        {
+            munmap(sqEntries, sqEntriesSize);
+        }
+        if (cqRing != nullptr && cqRing != sqRing)
+        {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != nullptr)
+        {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0)
+        {
+            nativeCloseFd(ringFd);
+        }
+    }
+
+    bool IoUringReadEngine::submit(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag)
+    {
+        if (freeReads.empty())
+        {
+            return false;
+        }
+
+        // The read is kept to check its result when it finishes
+        unsigned int slot = freeReads.back();
+        reads[slot] = {position, size, tag};
+
+        // Only this thread writes the tail, so it can be readed without barriers
+        unsigned int tail = *sqTail;
+        unsigned int index = tail & *sqMask;
+
+        io_uring_sqe *entry = (io_uring_sqe *)sqEntries + index;
+        memset(entry, 0, sizeof(io_uring_sqe));
+        entry->opcode = IORING_OP_READ;
+        entry->fd = fileFd;
+        entry->addr = (unsigned long long)buffer;
+        entry->len = (unsigned int)size;
+        entry->off = position;
+        entry->user_data = slot;
+        sqArray[index] = index;
+
+        // The entry must be visible to the kernel before the new tail
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        int submitted;
+        do
+        {
+            submitted = ioUringEnter(ringFd, 1, 0, 0);
+        } while (submitted < 0 && errno == EINTR);
+
+        if (submitted < 1)
+        {
+            // Take back the entry, so it is not sent with the next submit
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            return false;
+        }
+        freeReads.pop_back();
+
+        return true;
+    }
+
+    unsigned int IoUringReadEngine::reapCompletions(unsigned long long *tags, long long *results, unsigned int max)
+    {
+        unsigned int head = *cqHead;
+        unsigned int tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned int count = 0;
+
+        while (head != tail && count < max)
+        {
+            io_uring_cqe *entry = (io_uring_cqe *)cqEntries + (head & *cqMask);
+            AsyncRead &read = reads[entry->user_data];
+            tags[count] = read.tag;
+            if (results != nullptr)
+            {
+                results[count] = checkReadResult(entry->res, read.position, read.size, diskSize);
+            }
+            freeReads.push_back((unsigned int)entry->user_data);
+            head++;
+            count++;
+        }
+
+        // Release the entries to the kernel
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+        return count;
+    }
+
+    unsigned int IoUringReadEngine::getCompletions(unsigned long long *tags, long long *results, unsigned int max, bool wait)
+    {
+        unsigned int count = reapCompletions(tags, results, max);
+
+        while (count == 0 && wait)
+        {
+            if (ioUringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            {
+                return 0;
+            }
+            count = reapCompletions(tags, results, max);
+        }
+
+        return count;
+    }
+#endif
+
+    //
+    // Plugin async API
+    //
+
+    // Queue a read of the provided region. The buffer must be kept until the read tag is returned by
+    // pollCompletions/waitCompletions. Returns false if the queue is full or on error.
+    bool IsoReader::submitRead(unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag)
+    {
+        if (nativeInputFile == nullptr)
+        {
+            setLastError(std::string("There is no input file opened"));
+            return false;
+        }
+
+        // Linux can't read more than 2GB in a single call
+        if (size > 0x7FFFF000)
+        {
+            setLastError(std::string("The async read size is too big"));
+            return false;
+        }
+
+        // The queue is full. This is not an error, the host must get some completions before submit more reads.
+        if (asyncPending >= asyncQueueDepth)
+        {
+            return false;
+        }
+
+        // Create the engine the first time it is used
+        if (asyncEngine == nullptr)
+        {
+#ifdef ISO_HAVE_IO_URING
+            // The mapped files are just copied by the workers, and the compressed images are decompressed by them.
+            // The direct I/O files require aligned reads, and the shared cache is checked by readAt, so both use the workers too.
+            if (mappedData == nullptr && compressedImage == nullptr && !directInput && !sharedCacheReady)
+            {
+                asyncEngine = IoUringReadEngine::create(fileno((FILE *)nativeInputFile), asyncQueueDepth, diskRealSize);
+            }
+#endif
+            if (asyncEngine == nullptr)
+            {
+                // The workers are sized from the queue depth, so the reads in flight don't depend on the threads setting
+                asyncEngine = new ThreadPoolReadEngine(this, std::min(asyncQueueDepth, (unsigned int)ASYNC_MAX_THREADS));
+            }
+            SPDLOG_DEBUG("ISO: Using the {} async read engine", asyncEngine->getName());
+        }
+
+        if (!asyncEngine->submit(position, buffer, size, tag))
+        {
+            setLastError(std::string("There was an error submitting the async read"));
+            return false;
+        }
+        asyncPending++;
+
+        return true;
+    }
+
+    // Get the finished reads without blocking. Returns the number of completions stored into the tags and results arrays.
+    unsigned int IsoReader::pollCompletions(unsigned long long *tags, long long *results, unsigned int max)
+    {
+        if (asyncEngine == nullptr || asyncPending == 0)
+        {
+            return 0;
+        }
+
+        unsigned int count = asyncEngine->getCompletions(tags, results, max, false);
+        asyncPending -= count;
+
+        return count;
+    }
+
+    // Wait until at least one read has finished. Returns 0 if there are no reads in flight.
+    unsigned int IsoReader::waitCompletions(unsigned long long *tags, long long *results, unsigned int max)
+    {
+        if (asyncEngine == nullptr || asyncPending == 0 || max == 0)
+        {
+            return 0;
+        }
+
+        unsigned int count = asyncEngine->getCompletions(tags, results, max, true);
+        asyncPending -= count;
+
+        return count;
+    }
+
+    // Wait for the reads in flight and destroy the engine. Must be called before close the file.
+    void IsoReader::stopAsyncEngine()
+    {
+        if (asyncEngine == nullptr)
+        {
+            return;
+        }
+
+        unsigned long long tags[32];
+        while (asyncPending > 0)
+        {
+            unsigned int count = asyncEngine->getCompletions(tags, nullptr, 32, true);
+            if (count == 0)
+            {
+                // The engine has failed, so nothing more will be returned
+                break;
+            }
+            asyncPending -= count;
+        }
+        asyncPending = 0;
+
+        delete asyncEngine;
+        asyncEngine = nullptr;
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT submitRead(void *handler, unsigned long long position, char *buffer, unsigned long long size, unsigned long long tag)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->submitRead(position, buffer, size, tag);
+        }
+
+        unsigned int SHARED_EXPORT pollCompletions(void *handler, unsigned long long *tags, long long *results, unsigned int max)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->pollCompletions(tags, results, max);
+        }
+
+        unsigned int SHARED_EXPORT waitCompletions(void *handler, unsigned long long *tags, long long *results, unsigned int max)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->waitCompletions(tags, results, max);
+        }
+    }
+}
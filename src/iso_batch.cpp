@@ -0,0 +1,185 @@
+#include "iso.h"
+
+#include <numeric>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Batch reads
+//
+// The hosts which gather scattered regions of the image (the sectors of the PBP tables, for example) can
+// read all of them in a single call. The regions are sorted, and the adjacent ones are readed together
+// with a single scatter read which fills all their buffers.
+//
+namespace PopstationmdgPlugin
+{
+    // Read all the provided ranges. The readed bytes of every range are stored in readed, and the total is returned.
+    // Like readAt, the file position is not modified.
+    unsigned long long IsoReader::readBatch(const ReadRange *ranges, unsigned int count, char **outputs, unsigned long long *readed)
+    {
+        LatencyTimer timer(statsEnabled ? &stats.readLatency : nullptr);
+
+        if (nativeInputFile == nullptr)
+        {
+            // There is no opened file
+            setLastError(std::string("There is no input file opened"));
+            return 0;
+        }
+
+        // Ranges inside the image
+        std::vector<unsigned long long> sizes(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            readed[i] = 0;
+            sizes[i] = ranges[i].position < diskRealSize ? std::min(ranges[i].size, (unsigned long long)(diskRealSize - ranges[i].position)) : 0;
+        }
+
+        unsigned long long total = 0;
+
+        // The scatter reads are only used with the native file. The rest of the modes are served from
+        // memory or need their own processing, so the ranges are readed one by one. The scatter reads of
+        // Windows require unbuffered files and page sized buffers, so they are not used there.
+#ifdef _WIN32
+        bool scatter = false;
+#else
+        bool scatter = mappedData == nullptr && !directInput && compressedImage == nullptr && !sharedCacheReady;
+#endif
+
+        if (!scatter)
+        {
+            for (unsigned int i = 0; i < count; i++)
+            {
+                if (sizes[i] > 0)
+                {
+                    readed[i] = readAt(ranges[i].position, outputs[i], sizes[i]);
+                    total += readed[i];
+                }
+            }
+        }
+#ifndef _WIN32
+        else
+        {
+            std::vector<unsigned int> order(count);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [ranges](unsigned int a, unsigned int b)
+                             { return ranges[a].position < ranges[b].position; });
+
+            std::vector<char *> groupOutputs;
+            std::vector<unsigned long long> groupSizes;
+            size_t next = 0;
+            while (next < order.size())
+            {
+                if (sizes[order[next]] == 0)
+                {
+                    next++;
+                    continue;
+                }
+
+                // Join the ranges which start where the previous one ends
+                unsigned long long groupStart = ranges[order[next]].position;
+                unsigned long long groupEnd = groupStart;
+                size_t first = next;
+                groupOutputs.clear();
+                groupSizes.clear();
+                while (next < order.size() && groupOutputs.size() < BATCH_MAX_BUFFERS &&
+                       (sizes[order[next]] == 0 || ranges[order[next]].position == groupEnd))
+                {
+                    if (sizes[order[next]] > 0)
+                    {
+                        groupOutputs.push_back(outputs[order[next]]);
+                        groupSizes.push_back(sizes[order[next]]);
+                        groupEnd += sizes[order[next]];
+                    }
+                    next++;
+                }
+
+                // Split the readed bytes between the ranges of the group
+                unsigned long long groupReaded = readScatter(groupStart, groupOutputs.data(), groupSizes.data(), (unsigned int)groupOutputs.size());
+                total += groupReaded;
+                for (size_t i = first; i < next && groupReaded > 0; i++)
+                {
+                    readed[order[i]] = std::min(groupReaded, sizes[order[i]]);
+                    groupReaded -= readed[order[i]];
+                }
+            }
+        }
+#endif
+
+        if (statsEnabled)
+        {
+            stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+            stats.bytesRead.fetch_add(total, std::memory_order_relaxed);
+        }
+
+        return total;
+    }
+
+#ifndef _WIN32
+    // Fill the buffers with the consecutive data starting at the provided position. Returns the readed bytes.
+    unsigned long long IsoReader::readScatter(unsigned long long position, char **outputs, const unsigned long long *sizes, unsigned int count)
+    {
+        std::vector<struct iovec> buffers(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            buffers[i].iov_base = outputs[i];
+            buffers[i].iov_len = sizes[i];
+        }
+
+        int fd = fileno((FILE *)nativeInputFile);
+        unsigned long long readed = 0;
+        size_t current = 0;
+        while (current < buffers.size())
+        {
+            ssize_t chunkReaded;
+            do
+            {
+                if (statsEnabled)
+                {
+                    stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+                }
+                chunkReaded = preadv(fd, buffers.data() + current, (int)(buffers.size() - current), position + readed);
+            } while (chunkReaded < 0 && errno == EINTR);
+
+            if (chunkReaded < 0)
+            {
+                setLastError(std::string("There was an error reading from the file: ").append(nativeError()));
+                break;
+            }
+
+            // EOF
+            if (chunkReaded == 0)
+            {
+                break;
+            }
+            readed += chunkReaded;
+
+            // Continue with the buffers which were not filled
+            while (current < buffers.size() && (size_t)chunkReaded >= buffers[current].iov_len)
+            {
+                chunkReaded -= buffers[current].iov_len;
+                current++;
+            }
+            if (current < buffers.size())
+            {
+                buffers[current].iov_base = (char *)buffers[current].iov_base + chunkReaded;
+                buffers[current].iov_len -= chunkReaded;
+            }
+        }
+
+        return readed;
+    }
+#endif
+
+    extern "C"
+    {
+        unsigned long long SHARED_EXPORT readBatch(void *handler, const ReadRange *ranges, unsigned int count, char **outputs, unsigned long long *readed)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->readBatch(ranges, count, outputs, readed);
+        }
+    }
+}
@@ -1,20 +1,22 @@
 #include "iso.h"
-#define DEBUG 1
+
+// The ZSO images are only listed in the compatible extensions when the LZ4 support is built
+#ifdef USE_LZ4
+#define ZSO_EXTENSION "\"zso\","
+#else
+#define ZSO_EXTENSION ""
+#endif
 
 namespace PopstationmdgPlugin
 {
     // Reader constructor
     IsoReader::IsoReader()
     {
-        // Initialize log system
-        spdlog::set_pattern("[%Y-%m-%d %H:%M:%S] [%l] [thread %t] %v");
-        spdlog::flush_every(std::chrono::seconds(1));
-
-#ifdef DEBUG
-        spdlog::set_level(spdlog::level::debug);
-#endif
+        // Initialize log system if the host didn't do it
+        initDefaultLogging();
 
-        spdlog::info("Starting the ISO plugin");
+        // Default game ID prefixes
+        setIDPrefixes(defaultIDPrefixes);
 
         // Set the input stream to throw an exception is failbit or badbit was set
         std::ios_base::iostate inputExceptionMask = input_file.exceptions() | std::ifstream::failbit | std::ifstream::badbit;
@@ -28,6 +30,9 @@ namespace PopstationmdgPlugin
     // Reader destructor
     IsoReader::~IsoReader()
     {
+        // Close the file first, so the pending data and the compressed image index are writen if the host didn't close it
+        close();
+
         // Free the resources
         if (pluginMode & PTWriter)
         {
@@ -37,9 +42,13 @@ namespace PopstationmdgPlugin
         {
             freeReaderResources();
         }
+        freeViews();
 
-        // Close the file
-        close();
+        if (streamHasher != nullptr)
+        {
+            delete streamHasher;
+            streamHasher = nullptr;
+        }
 
         // Clear the last error data
         clearError();
@@ -48,32 +57,61 @@ namespace PopstationmdgPlugin
     // Open the ISO file
     bool IsoReader::open(char *filename, unsigned int mode, unsigned int compressionLevel, unsigned int threads)
     {
-        // This plugin is very simple and non CPU intensive, so threads are not required and will be ignored
-
         // Set the plugin mode
         pluginMode = (PluginType)mode;
 
+        // Threads used by the parallel tasks
+        workerThreads = threads > 0 ? threads : 1;
+
+        // Level used by the compressed output
+        outputCompressionLevel = compressionLevel;
+
+        // Start the hashes of the new file. The results of the previous file are discarded.
+        if (streamHasher != nullptr)
+        {
+            delete streamHasher;
+            streamHasher = nullptr;
+        }
+        if (hashingEnabled)
+        {
+            streamHasher = new StreamHasher(workerThreads, pluginMode & PTWriter);
+        }
+
         if (pluginMode & PTWriter)
         {
-            // New file, new life. Reset all past errors.
-            output_file.clear();
+            // The disks of a multi-disk image are writen to separated files
+            baseFilename = filename;
+            currentDisk = 1;
+            totalDisks = 1;
 
-            // Open the destination file
-            try
-            {
-                spdlog::debug("ISO: Openning the output file: {}", filename);
-                output_file.open(filename, std::ifstream::binary);
-                spdlog::debug("ISO: File opened correctly");
-                return true;
-            }
-            catch (std::ios_base::failure &e)
+            if (!openOutputFile(getOutputDiskFilename(currentDisk).c_str()))
             {
-                setLastError(std::string("There was an error opening the file: ") + std::string(e.what()));
+                baseFilename.clear();
+                currentDisk = 0;
+                totalDisks = 0;
                 return false;
             }
+
+            return true;
         }
         else if (pluginMode & PTReader)
         {
+            // Open all the disks of the multi-disk images
+            baseFilename = filename;
+            std::vector<std::string> disks;
+            unsigned int current;
+            if (!findDiskFiles(disks, current))
+            {
+                return false;
+            }
+
+            if (disks.size() > 1 || disks[0] != baseFilename)
+            {
+                return openDisks(disks, current, compressionLevel, threads);
+            }
+            currentDisk = 1;
+            totalDisks = 1;
+
             // New file, new life. Reset all past errors.
             input_file.clear();
 
@@ -81,13 +119,72 @@ namespace PopstationmdgPlugin
             try
             {
                 input_file.open(filename, std::ifstream::binary);
-                // Seek to the end to get the size
-                seek(0, PluginSeekMode_End);
-                // Get the disk size
-                diskSize = tell();
+
+                readPosition = 0;
+                accessPosition = 0;
+                lastReadEnd = 0;
+                prefetchWindow = 0;
+                prefetchedUntil = 0;
+                readBufferStart = 0;
+                readBufferLength = 0;
+                readCacheHits = 0;
+                readCacheMisses = 0;
+
+                // Open the native file used by the positional reads. In direct I/O mode it bypasses the system cache.
+                if (!(directIOEnabled && openDirectInput(filename)) && !openNativeInput(filename))
+                {
+                    setLastError(std::string("There was an error opening the file for positional reads."));
+                    input_file.close();
+                    return false;
+                }
+
+                // Get the disk size from the file status, without seeking to the end of the file
+                if (!SharedSectorCache::getFileIdentity(nativeInputFile, inputIdentity))
+                {
+                    setLastError(std::string("There was an error getting the file size."));
+                    closeNativeInput();
+                    input_file.close();
+                    return false;
+                }
+                diskSize = inputIdentity.size;
                 diskRealSize = diskSize;
-                // Return to the begin
-                seek(0, PluginSeekMode_Begin);
+
+                // Load the index of the compressed images
+                if (!openCompressedImage())
+                {
+                    closeNativeInput();
+                    input_file.close();
+                    return false;
+                }
+
+                // Check the shared cache before reading the image if enabled
+                openSharedCache();
+
+                // Detect the sector layout of the image, unless it was found in the ID cache
+                if (!lookupIDCache(filename))
+                {
+                    detectSectorLayout();
+                }
+
+                // Map the file into memory if enabled. The stream is used as fallback if the file can't be mapped.
+                if (memoryMapEnabled && !directInput && compressedImage == nullptr && mapInputFile())
+                {
+                    return true;
+                }
+
+                // Reserve the read buffer if enabled
+                if (bufferEnabled)
+                {
+                    SPDLOG_DEBUG("ISO: Reserving {} bytes for the read buffer", bufferSize);
+                    readBuffer = new (std::nothrow) char[bufferSize];
+                    if (readBuffer == nullptr)
+                    {
+                        setLastError(std::string("There was an error allocating the read buffer memory."));
+                        closeNativeInput();
+                        input_file.close();
+                        return false;
+                    }
+                }
 
                 return true;
             }
@@ -104,21 +201,60 @@ namespace PopstationmdgPlugin
     // Close the ISO file (if was opened)
     bool IsoReader::close()
     {
+        // Close the disks of a multi-disk image
+        closeDisks();
+
         // Delete the ID which is not usefull anymore
         if (gameID != nullptr)
         {
-            spdlog::debug("Clearing the gameID object");
+            SPDLOG_DEBUG("Clearing the gameID object");
             delete[] gameID;
             gameID = nullptr;
         }
 
+        // Forget the sector layout of the closed file
+        sectorSize = 0;
+        sectorMode = 0;
+        badSectors.clear();
+        sectorCheckUsed = 0;
+        idCacheKey.clear();
+        idNotFound = false;
+        sharedCacheReady = false;
+
+        // Wait for the async reads before close the file
+        stopAsyncEngine();
+
+        // The compressed image threads use the native input file
+        if (compressedImage != nullptr)
+        {
+            delete compressedImage;
+            compressedImage = nullptr;
+        }
+
+        // Unmap and close the native input file
+        unmapInputFile();
+        closeNativeInput();
+
+        // Free the read buffer
+        if (readBuffer != nullptr)
+        {
+            SPDLOG_DEBUG("ISO: Read buffer stats: {} hits, {} misses", readCacheHits, readCacheMisses);
+            if (!detachViewBlock(readBufferView))
+            {
+                delete[] readBuffer;
+            }
+            readBuffer = nullptr;
+            readBufferStart = 0;
+            readBufferLength = 0;
+        }
+
         // Try to close the input and output files
         if (input_file.is_open())
         {
             try
             {
 
-                spdlog::debug("Closing the input file");
+                SPDLOG_DEBUG("Closing the input file");
                 input_file.close();
                 input_file.clear();
             }
@@ -128,23 +264,27 @@ namespace PopstationmdgPlugin
             }
         }
 
-        if (output_file.is_open())
+        // Write all the pending data and close the output file of the current disk
+        bool flushed = closeOutputFile();
+
+        // Write the playlist of the multi-disk images
+        if ((pluginMode & PTWriter) && totalDisks > 0 && isPlaylistOutput() && !writePlaylist())
         {
-            try
-            {
+            flushed = false;
+        }
+        baseFilename.clear();
+        currentDisk = 0;
+        totalDisks = 0;
 
-                spdlog::debug("Closing the output file");
-                output_file.close();
-                output_file.clear();
-            }
-            catch (std::ios_base::failure &e)
-            {
-                setLastError(std::string("There was an error closing the output file: ") + std::string(e.what()));
-            }
+        if (directPool != nullptr)
+        {
+            delete directPool;
+            directPool = nullptr;
         }
-        spdlog::debug("Everything was closed correctly");
 
-        return true;
+        SPDLOG_DEBUG("Everything was closed correctly");
+
+        return flushed;
     }
 
     unsigned long long IsoReader::getDiskSize()
@@ -160,6 +300,12 @@ namespace PopstationmdgPlugin
     // Seek into the file
     bool IsoReader::seek(unsigned long long position, unsigned int mode)
     {
+        LatencyTimer timer(statsEnabled ? &stats.seekLatency : nullptr);
+        if (statsEnabled)
+        {
+            stats.seekCalls.fetch_add(1, std::memory_order_relaxed);
+        }
+
         if (pluginMode & PTWriter)
         {
             if (!output_file.is_open())
@@ -177,6 +323,76 @@ namespace PopstationmdgPlugin
             }
         }
 
+        // The raw sectors are generated sequentially, so the output position can't be changed
+        if ((pluginMode & PTWriter) && rawEncodeBuffer != nullptr)
+        {
+            setLastError(std::string("The output position can't be changed when the raw sectors are generated"));
+            return false;
+        }
+
+        // Same for the compressed output, which is writen by blocks
+        if ((pluginMode & PTWriter) && compressedWriter != nullptr)
+        {
+            setLastError(std::string("The output position can't be changed when the output is compressed"));
+            return false;
+        }
+
+        // The direct I/O output position is managed internally
+        if ((pluginMode & PTWriter) && directOutputFile != nullptr)
+        {
+            if (!flushDirectOutput())
+            {
+                return false;
+            }
+
+            if (mode == PluginSeekMode_End)
+            {
+                position += directOutputEnd;
+            }
+            else if (mode == PluginSeekMode_Forward)
+            {
+                position += writePosition;
+            }
+            else if (mode == PluginSeekMode_Backward)
+            {
+                if (writePosition < position)
+                {
+                    setLastError(std::string("Error seeking into the file: Tried to backward below the 0 position."));
+                    return false;
+                }
+                position = writePosition - position;
+            }
+
+            writePosition = position;
+            return true;
+        }
+
+        // When the read buffer, the memory map or the direct I/O are enabled the position is managed internally
+        if (!(pluginMode & PTWriter) && usesReadPosition())
+        {
+            if (mode == PluginSeekMode_End)
+            {
+                position += diskRealSize;
+            }
+            else if (mode == PluginSeekMode_Forward)
+            {
+                position += readPosition;
+            }
+            else if (mode == PluginSeekMode_Backward)
+            {
+                if (readPosition < position)
+                {
+                    setLastError(std::string("Error seeking into the file: Tried to backward below the 0 position."));
+                    return false;
+                }
+                position = readPosition - position;
+            }
+
+            readPosition = position;
+            accessPosition = position;
+            return true;
+        }
+
         auto seek_mode = std::ios::beg;
 
         if (mode == PluginSeekMode_End)
@@ -203,6 +419,12 @@ namespace PopstationmdgPlugin
 
         if (pluginMode & PTWriter)
         {
+            // The buffered data must be on disk before moving the file position
+            if (writeBuffer[0] != nullptr && !flushWriteBuffers())
+            {
+                return false;
+            }
+
             try
             {
                 if (!output_file.seekp(position, seek_mode))
@@ -210,6 +432,7 @@ namespace PopstationmdgPlugin
                     setLastError(std::string("There was an error seeking into the output file"));
                     return false;
                 }
+                writePosition = output_file.tellp();
             }
             catch (std::ios_base::failure &e)
             {
@@ -226,6 +449,7 @@ namespace PopstationmdgPlugin
                     setLastError(std::string("There was an error seeking into the input file"));
                     return false;
                 }
+                accessPosition = seek_mode == std::ios::end ? diskRealSize + position : position;
             }
             catch (std::ios_base::failure &e)
             {
@@ -237,6 +461,12 @@ namespace PopstationmdgPlugin
         return true;
     }
 
+    // Check if the reader position is managed internally instead of by the stream
+    bool IsoReader::usesReadPosition()
+    {
+        return readBuffer != nullptr || mappedData != nullptr || directInput || compressedImage != nullptr || sharedCacheReady;
+    }
+
     // Same as above because ISO is just single disk format
     bool IsoReader::seekCurrentDisk(unsigned long long position, unsigned int mode)
     {
@@ -250,6 +480,13 @@ namespace PopstationmdgPlugin
         {
             if (output_file.is_open())
             {
+                // The writer thread can be using the stream, so return the position tracked by the buffer.
+                // The direct I/O mode doesn't use the stream, and the compressed output position is the uncompressed one.
+                if (writeBuffer[0] != nullptr || directOutputFile != nullptr || compressedWriter != nullptr)
+                {
+                    return writePosition;
+                }
+
                 try
                 {
                     return output_file.tellp();
@@ -270,6 +507,12 @@ namespace PopstationmdgPlugin
         {
             if (input_file.is_open())
             {
+                // The read buffer, the memory map and the direct I/O keep their own position
+                if (usesReadPosition())
+                {
+                    return readPosition;
+                }
+
                 try
                 {
                     return input_file.tellg();
@@ -303,6 +546,8 @@ namespace PopstationmdgPlugin
     // Get the last error
     bool IsoReader::getError(char *error, unsigned long long buffersize)
     {
+        std::lock_guard<std::mutex> lock(errorMutex);
+
         // Fill the error buffer with zeroes
         memset(error, 0, buffersize);
         if (last_error != nullptr)
@@ -325,6 +570,8 @@ namespace PopstationmdgPlugin
     // Clear the last error and isOK status
     void IsoReader::clearError()
     {
+        std::lock_guard<std::mutex> lock(errorMutex);
+
         if (last_error != nullptr)
         {
             delete[] last_error;
@@ -336,11 +583,25 @@ namespace PopstationmdgPlugin
 
     void IsoReader::setLastError(std::string error)
     {
+        if (statsEnabled)
+        {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // The errors of the disk objects are reported by the main object
+        if (parentReader != nullptr)
+        {
+            parentReader->setLastError(error);
+            return;
+        }
+
         spdlog::error("ISO: {}", error);
         size_t value_length = error.length() + 1;
         // If string is not empty
         if (value_length > 1)
         {
+            std::lock_guard<std::mutex> lock(errorMutex);
+
             if (last_error != nullptr)
             {
                 delete[] last_error;
@@ -357,8 +618,16 @@ namespace PopstationmdgPlugin
     // Set the last error text and isOK to false
     void IsoReader::setLastError(char *error)
     {
+        if (parentReader != nullptr)
+        {
+            parentReader->setLastError(error);
+            return;
+        }
+
         if (error != nullptr)
         {
+            std::lock_guard<std::mutex> lock(errorMutex);
+
             if (last_error != nullptr)
             {
                 delete[] last_error;
@@ -369,66 +638,70 @@ namespace PopstationmdgPlugin
         }
     }
 
-    unsigned int IsoReader::getCurrentDisk()
+    // Copy the hashes of the readed or writen data in JSON format. The hashes are kept after the file is closed.
+    bool IsoReader::getHashes(char *hashes, unsigned long long buffersize)
     {
-        if (pluginMode & PTWriter)
+        if (streamHasher == nullptr)
         {
-            if (output_file.is_open())
-            {
-                return 1;
-            }
-            else
-            {
-                setLastError(std::string("There is no output file opened."));
-                return 0;
-            }
+            setLastError(std::string("The hashes are not enabled."));
+            return false;
         }
-        else
+
+        return copyJsonOutput(streamHasher->getResults(), hashes, buffersize);
+    }
+
+    // Copy a JSON output to the host buffer, which must have space for the ending null char
+    bool IsoReader::copyJsonOutput(const std::string &data, char *output, unsigned long long buffersize)
+    {
+        // Fill the output buffer with zeroes
+        memset(output, 0, buffersize);
+        if (data.size() >= buffersize)
         {
-            if (input_file.is_open())
-            {
-                return 1;
-            }
-            else
-            {
-                setLastError(std::string("There is no input file opened."));
-                return 0;
-            }
+            setLastError(std::string("The output buffer is not enough."));
+            return false;
         }
+
+        strncpy_s(output, buffersize, data.c_str(), data.size());
+        return true;
     }
 
-    unsigned int IsoReader::getTotalDisks()
+    unsigned int IsoReader::getCurrentDisk()
     {
-        if (pluginMode & PTWriter)
+        bool opened = (pluginMode & PTWriter) ? !baseFilename.empty() : (!diskReaders.empty() || input_file.is_open());
+        if (!opened)
         {
-            if (output_file.is_open())
-            {
-                return 1;
-            }
-            else
-            {
-                setLastError(std::string("There is no output file opened."));
-                return 0;
-            }
+            setLastError(std::string("There is no file opened."));
+            return 0;
         }
-        else
+
+        return currentDisk;
+    }
+
+    unsigned int IsoReader::getTotalDisks()
+    {
+        bool opened = (pluginMode & PTWriter) ? !baseFilename.empty() : (!diskReaders.empty() || input_file.is_open());
+        if (!opened)
         {
-            if (input_file.is_open())
-            {
-                return 1;
-            }
-            else
-            {
-                setLastError(std::string("There is no input file opened."));
-                return 0;
-            }
+            setLastError(std::string("There is no file opened."));
+            return 0;
         }
+
+        return totalDisks;
     }
 
+    // Buffer settings are applied the next time that a file is opened
     bool IsoReader::setSettings(const char *settingsData, unsigned long settingsSize)
     {
         json settings = json::parse(settingsData);
 
+        // Keep the settings for the disk objects, which also receive the settings changes
+        currentSettings.update(settings);
+        for (auto disk : diskReaders)
+        {
+            disk->setSettings(settingsData, settingsSize);
+            disk->multiDiskEnabled = false;
+        }
+
         if (settings.contains("enable_buffer"))
         {
             bufferEnabled = settings["enable_buffer"];
@@ -437,6 +710,120 @@ namespace PopstationmdgPlugin
         if (settings.contains("buffer_size"))
         {
             bufferSize = settings["buffer_size"];
+
+            // Keep the buffer size between the limits and aligned to the sector size
+            if (bufferSize < SETTINGS_MIN_BUFFER)
+            {
+                bufferSize = SETTINGS_MIN_BUFFER;
+            }
+            else if (bufferSize > SETTINGS_MAX_BUFFER)
+            {
+                bufferSize = SETTINGS_MAX_BUFFER;
+            }
+            bufferSize -= bufferSize % RAW_SECTOR_SIZE;
+        }
+
+        if (settings.contains("id_prefixes"))
+        {
+            setIDPrefixes(settings["id_prefixes"].get<std::vector<std::string>>());
+        }
+
+        if (settings.contains("id_cache"))
+        {
+            idCacheEnabled = settings["id_cache"];
+        }
+
+        if (settings.contains("id_cache_size"))
+        {
+            idCacheSize = settings["id_cache_size"];
+            idCacheSize = std::clamp(idCacheSize, (unsigned long)SETTINGS_MIN_ID_CACHE, (unsigned long)SETTINGS_MAX_ID_CACHE);
+        }
+
+        // Not available in the settings dialog. By default the cache is stored in the user cache folder.
+        if (settings.contains("id_cache_path"))
+        {
+            idCachePath = settings["id_cache_path"];
+        }
+
+        if (settings.contains("shared_cache"))
+        {
+            sharedCacheEnabled = settings["shared_cache"];
+        }
+
+        if (settings.contains("shared_cache_size"))
+        {
+            sharedCacheSize = settings["shared_cache_size"];
+            sharedCacheSize = std::clamp(sharedCacheSize, (unsigned long)SETTINGS_MIN_SHARED_CACHE, (unsigned long)SETTINGS_MAX_SHARED_CACHE);
+        }
+
+        if (settings.contains("async_queue_depth"))
+        {
+            asyncQueueDepth = settings["async_queue_depth"];
+            asyncQueueDepth = std::clamp(asyncQueueDepth, (unsigned int)SETTINGS_MIN_QUEUE_DEPTH, (unsigned int)SETTINGS_MAX_QUEUE_DEPTH);
+        }
+
+        // Not available in the settings dialog. Used by the host to set the output size before open the file.
+        // Hint for the next output file only, like setExpectedSize
+        if (settings.contains("expected_size"))
+        {
+            expectedSize = settings["expected_size"];
+        }
+
+        if (settings.contains("verify_sectors"))
+        {
+            sectorCheckEnabled = settings["verify_sectors"];
+        }
+
+        if (settings.contains("raw_sectors"))
+        {
+            rawEncodeEnabled = settings["raw_sectors"];
+        }
+
+        if (settings.contains("raw_sectors_mode"))
+        {
+            rawEncodeMode = settings["raw_sectors_mode"];
+            rawEncodeMode = std::clamp(rawEncodeMode, 1u, 2u);
+        }
+
+        if (settings.contains("compression_format"))
+        {
+            compressedOutputFormat = settings["compression_format"];
+            compressedOutputFormat = std::clamp(compressedOutputFormat, (unsigned int)CFNone, (unsigned int)CFZso);
+        }
+
+        if (settings.contains("stats"))
+        {
+            statsEnabled = settings["stats"];
+        }
+
+        if (settings.contains("hashes"))
+        {
+            hashingEnabled = settings["hashes"];
+        }
+
+        if (settings.contains("direct_io"))
+        {
+            directIOEnabled = settings["direct_io"];
+        }
+
+        if (settings.contains("memory_map"))
+        {
+            memoryMapEnabled = settings["memory_map"];
+        }
+
+        if (settings.contains("prefetch"))
+        {
+            prefetchEnabled = settings["prefetch"];
+        }
+
+        if (settings.contains("random_access"))
+        {
+            randomAccess = settings["random_access"];
+        }
+
+        if (settings.contains("multi_disk"))
+        {
+            multiDiskEnabled = settings["multi_disk"];
         }
 
         return true;
@@ -453,13 +840,24 @@ namespace PopstationmdgPlugin
                 "info" : {
                     "name" : "ISO Image",
                     "version" : "0.5.0",
-                    "description" : "This plugin will write the data into ISO format. ISO is a raw format, so it doesn't have any kind of compression, multidisk or personalization support.",
-                    "multidisk" : false,
-                    "maxdisks" : 1,
+                    "description" : "This plugin will write the data into ISO format. ISO is a raw format, so it doesn't have any kind of personalization support, but the images can be compressed in CSO or ZSO format. The multi-disk images are stored in a file per disk, listed in a M3U playlist.",
+                    "multidisk" : true,
+                    "maxdisks" : )""" + std::to_string(MAX_DISKS) +
+                                                          R"""(,
                     "compatibleExtensions" : [
-                        "iso"
+                        "iso",
+                        "cso",)""" ZSO_EXTENSION R"""(
+                        "m3u"
                     ],
                     "customAppearance" : false,
+                    "sectorLayouts" : [
+                        )""" + std::to_string(MODE1_SECTOR_SIZE) +
+                                                          R"""(,
+                        )""" + std::to_string(MODE2_SECTOR_SIZE) +
+                                                          R"""(,
+                        )""" + std::to_string(RAW_SECTOR_SIZE) +
+                                                          R"""(
+                    ],
                     "type" : )""" + std::to_string(PTReader | PTWriter) +
                                                           R"""(
                 },
@@ -481,6 +879,99 @@ namespace PopstationmdgPlugin
                                                           R"""(,
                             "default" : )""" + std::to_string(SETTINGS_DEFAULT_BUFFER) +
                                                           R"""(
+                        },
+                        "memory_map" : {
+                            "type" : "checkbox",
+                            "description" : "Map the image into memory",
+                            "tooltip" : "Read the image through a memory map instead of the file stream. The read buffer is not used in this mode",
+                            "default" : false
+                        },
+                        "random_access" : {
+                            "type" : "checkbox",
+                            "description" : "Random access hint",
+                            "tooltip" : "Tell the system that the mapped image will be read in random order instead of sequentially",
+                            "default" : false
+                        },
+                        "prefetch" : {
+                            "type" : "checkbox",
+                            "description" : "Read ahead",
+                            "tooltip" : "Request the next data to the system in advance when the image is readed sequentially. The window grows with the sequential reads and shrinks with the random ones. On Windows only the mapped images are requested in advance, and the same applies to the regions announced with hintRanges",
+                            "default" : true
+                        },
+                        "multi_disk" : {
+                            "type" : "checkbox",
+                            "description" : "Open the multi-disk sets",
+                            "tooltip" : "Open all the disks of a numbered set, like \"Game (Disc 1).iso\", when one of them is opened",
+                            "default" : true
+                        },
+                        "async_queue_depth" : {
+                            "type" : "spin",
+                            "description" : "Async reads queue depth",
+                            "tooltip" : "Maximum number of async reads in flight",
+                            "minvalue" : )""" + std::to_string(SETTINGS_MIN_QUEUE_DEPTH) +
+                                                          R"""(,
+                            "maxvalue" : )""" + std::to_string(SETTINGS_MAX_QUEUE_DEPTH) +
+                                                          R"""(,
+                            "default" : )""" + std::to_string(SETTINGS_DEFAULT_QUEUE_DEPTH) +
+                                                          R"""(
+                        },
+                        "direct_io" : {
+                            "type" : "checkbox",
+                            "description" : "Direct I/O",
+                            "tooltip" : "Read the image bypassing the system cache. Useful for big batch conversions which don't read the images again",
+                            "default" : false
+                        },
+                        "hashes" : {
+                            "type" : "checkbox",
+                            "description" : "Calculate the hashes",
+                            "tooltip" : "Calculate the CRC32, MD5 and SHA-1 hashes of the image while it is readed",
+                            "default" : false
+                        },
+                        "stats" : {
+                            "type" : "checkbox",
+                            "description" : "Collect I/O statistics",
+                            "tooltip" : "Count the I/O operations and measure their latencies. The statistics are available through getStats",
+                            "default" : false
+                        },
+                        "verify_sectors" : {
+                            "type" : "checkbox",
+                            "description" : "Verify the sectors",
+                            "tooltip" : "Check the EDC and ECC of the raw sectors while they are readed",
+                            "default" : false
+                        },
+                        "id_cache" : {
+                            "type" : "checkbox",
+                            "description" : "Enable the ID cache",
+                            "tooltip" : "Remember the ID of the opened images to not search it again the next time",
+                            "default" : false
+                        },
+                        "id_cache_size" : {
+                            "type" : "spin",
+                            "description" : "ID cache size",
+                            "tooltip" : "Maximum number of images stored in the ID cache. The least recently used are removed first",
+                            "minvalue" : )""" + std::to_string(SETTINGS_MIN_ID_CACHE) +
+                                                          R"""(,
+                            "maxvalue" : )""" + std::to_string(SETTINGS_MAX_ID_CACHE) +
+                                                          R"""(,
+                            "default" : )""" + std::to_string(SETTINGS_DEFAULT_ID_CACHE) +
+                                                          R"""(
+                        },
+                        "shared_cache" : {
+                            "type" : "checkbox",
+                            "description" : "Enable the shared cache",
+                            "tooltip" : "Share the readed sectors between all the images opened by the program, so an image opened several times is readed from the disk only once",
+                            "default" : false
+                        },
+                        "shared_cache_size" : {
+                            "type" : "spin",
+                            "description" : "Shared cache size (MB)",
+                            "tooltip" : "Memory used by the shared cache. The cache is the same for the whole program, so the size of the last opened image is used",
+                            "minvalue" : )""" + std::to_string(SETTINGS_MIN_SHARED_CACHE) +
+                                                          R"""(,
+                            "maxvalue" : )""" + std::to_string(SETTINGS_MAX_SHARED_CACHE) +
+                                                          R"""(,
+                            "default" : )""" + std::to_string(SETTINGS_DEFAULT_SHARED_CACHE) +
+                                                          R"""(
                         }
                     },
                     "Writer" : {
@@ -500,6 +991,46 @@ namespace PopstationmdgPlugin
                                                           R"""(,
                             "default" : )""" + std::to_string(SETTINGS_DEFAULT_BUFFER) +
                                                           R"""(
+                        },
+                        "direct_io" : {
+                            "type" : "checkbox",
+                            "description" : "Direct I/O",
+                            "tooltip" : "Write the image bypassing the system cache. The write buffer is not used in this mode",
+                            "default" : false
+                        },
+                        "hashes" : {
+                            "type" : "checkbox",
+                            "description" : "Calculate the hashes",
+                            "tooltip" : "Calculate the CRC32, MD5 and SHA-1 hashes of the image while it is writen",
+                            "default" : false
+                        },
+                        "stats" : {
+                            "type" : "checkbox",
+                            "description" : "Collect I/O statistics",
+                            "tooltip" : "Count the I/O operations and measure their latencies. The statistics are available through getStats",
+                            "default" : false
+                        },
+                        "raw_sectors" : {
+                            "type" : "checkbox",
+                            "description" : "Generate raw sectors",
+                            "tooltip" : "Wrap the 2048 bytes user data into raw 2352 bytes sectors, generating the header, the EDC and the ECC",
+                            "default" : false
+                        },
+                        "raw_sectors_mode" : {
+                            "type" : "spin",
+                            "description" : "Raw sectors mode",
+                            "tooltip" : "Mode of the generated sectors: 1 for MODE1 or 2 for MODE2 form 1",
+                            "minvalue" : 1,
+                            "maxvalue" : 2,
+                            "default" : 1
+                        },
+                        "compression_format" : {
+                            "type" : "spin",
+                            "description" : "Compressed output format",
+                            "tooltip" : "0 to select the format by the output extension, 1 for CSO (deflate) or 2 for ZSO (LZ4). The write buffer and the direct I/O are not used with the compressed output",
+                            "minvalue" : 0,
+                            "maxvalue" : 2,
+                            "default" : 0
                         }
                     }
                 }
@@ -543,7 +1074,7 @@ namespace PopstationmdgPlugin
         {
             IsoReader *object = (IsoReader *)handler;
 
-            return object->open(filename, mode, threads);
+            return object->open(filename, mode, compression, threads);
         }
 
         bool SHARED_EXPORT close(void *handler)
@@ -590,42 +1121,42 @@ namespace PopstationmdgPlugin
 
         unsigned long long SHARED_EXPORT getDiskSize(void *handler)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->getDiskSize();
         }
 
         unsigned long long SHARED_EXPORT getDiskRealSize(void *handler)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->getDiskRealSize();
         }
 
         bool SHARED_EXPORT seek(void *handler, unsigned long long position, unsigned int mode)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->seek(position, mode);
         }
 
         bool SHARED_EXPORT seekCurrentDisk(void *handler, unsigned long long position, unsigned int mode)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->seekCurrentDisk(position, mode);
         }
 
         unsigned long long SHARED_EXPORT tell(void *handler)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->tell();
         }
 
         unsigned long long SHARED_EXPORT tellCurrentDisk(void *handler)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->tellCurrentDisk();
         }
@@ -636,5 +1167,12 @@ namespace PopstationmdgPlugin
 
             return object->setSettings(settingsData, settingsSize);
         }
+
+        bool SHARED_EXPORT getHashes(void *handler, char *hashes, unsigned long long buffersize)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->getHashes(hashes, buffersize);
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,764 @@
+#include "iso_compressed.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <zlib.h>
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+namespace PopstationmdgPlugin
+{
+    // Little endian values of the header
+    static uint32_t readLE32(const char *data)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    }
+
+    static uint64_t readLE64(const char *data)
+    {
+        return readLE32(data) | ((uint64_t)readLE32(data + 4) << 32);
+    }
+
+    static void writeLE32(char *data, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            data[i] = (char)(value >> (i * 8));
+        }
+    }
+
+    static void writeLE64(char *data, uint64_t value)
+    {
+        writeLE32(data, (uint32_t)value);
+        writeLE32(data + 4, (uint32_t)(value >> 32));
+    }
+
+    // Raw deflate stream of every thread. It is reset between the blocks instead of being created every time.
+    struct InflateStream
+    {
+        z_stream stream = {};
+        bool ready = false;
+
+        ~InflateStream()
+        {
+            if (ready)
+            {
+                inflateEnd(&stream);
+            }
+        }
+    };
+    static thread_local InflateStream inflateStream;
+
+    // Same for the compression. The stream is created again if the level changes.
+    struct DeflateStream
+    {
+        z_stream stream = {};
+        bool ready = false;
+        int level = 0;
+
+        ~DeflateStream()
+        {
+            if (ready)
+            {
+                deflateEnd(&stream);
+            }
+        }
+    };
+    static thread_local DeflateStream deflateStream;
+
+    CompressedImage::CompressedImage(RawReader rawReader, unsigned int threads) : rawReader(rawReader)
+    {
+        // With only one thread the blocks are decompressed when they are readed
+        if (threads > 1)
+        {
+            pool = new ThreadPool(threads);
+        }
+    }
+
+    CompressedImage::~CompressedImage()
+    {
+        // The pool runs the pending tasks before stop, so it must be deleted before the cache
+        if (pool != nullptr)
+        {
+            delete pool;
+            pool = nullptr;
+        }
+    }
+
+    CompressedFormat CompressedImage::detectFormat(const char *header, unsigned long long size)
+    {
+        if (size < COMPRESSED_HEADER_SIZE)
+        {
+            return CFNone;
+        }
+
+        if (memcmp(header, "CISO", 4) == 0)
+        {
+            return CFCso;
+        }
+
+        if (memcmp(header, "ZISO", 4) == 0)
+        {
+            return CFZso;
+        }
+
+        return CFNone;
+    }
+
+    bool CompressedImage::open(unsigned long long fileSize, std::string &error)
+    {
+        char header[COMPRESSED_HEADER_SIZE];
+        if (rawReader(0, header, COMPRESSED_HEADER_SIZE) != COMPRESSED_HEADER_SIZE)
+        {
+            error = "The compressed image header can't be readed";
+            return false;
+        }
+
+        format = detectFormat(header, COMPRESSED_HEADER_SIZE);
+        totalBytes = readLE64(header + 8);
+        blockSize = readLE32(header + 16);
+        version = (unsigned char)header[20];
+        indexShift = (unsigned char)header[21];
+
+        if (format == CFNone || blockSize < 512 || blockSize > 0x1000000 || indexShift > 31 || version > 2)
+        {
+            error = "The compressed image header is not valid";
+            return false;
+        }
+
+#ifndef USE_LZ4
+        if (format == CFZso)
+        {
+            error = "The ZSO images are not supported by this build";
+            return false;
+        }
+#endif
+
+        // The index has an extra entry with the end of the last block. Some old images store 0 as header size,
+        // so the index is always readed just after the header.
+        totalBlocks = (totalBytes + blockSize - 1) / blockSize;
+        if ((totalBlocks + 1) * 4 + COMPRESSED_HEADER_SIZE > fileSize)
+        {
+            error = "The compressed image index is truncated";
+            return false;
+        }
+
+        std::vector<char> indexData((totalBlocks + 1) * 4);
+        if (rawReader(COMPRESSED_HEADER_SIZE, indexData.data(), indexData.size()) != indexData.size())
+        {
+            error = "The compressed image index can't be readed";
+            return false;
+        }
+
+        index.resize(totalBlocks + 1);
+        for (unsigned long long i = 0; i <= totalBlocks; i++)
+        {
+            index[i] = readLE32(indexData.data() + i * 4);
+
+            // The blocks are stored in order, so the positions can't go backwards or outside of the file
+            unsigned long long position = (unsigned long long)(index[i] & 0x7FFFFFFF) << indexShift;
+            if (position > fileSize || (i > 0 && position < ((unsigned long long)(index[i - 1] & 0x7FFFFFFF) << indexShift)))
+            {
+                error = "The compressed image index is not valid";
+                return false;
+            }
+        }
+
+        // The cache keeps at least the read-ahead window and a run for every thread
+        runBlocks = std::max(1ull, (unsigned long long)COMPRESSED_RUN_SIZE / blockSize);
+        readaheadBlocks = pool != nullptr ? std::max(runBlocks * pool->getThreads(), (unsigned long long)COMPRESSED_READAHEAD_SIZE / blockSize) : 0;
+        cacheCapacity = std::max((unsigned long long)COMPRESSED_CACHE_SIZE / blockSize, readaheadBlocks * 2 + runBlocks * 4);
+
+        return true;
+    }
+
+    unsigned long long CompressedImage::getSize()
+    {
+        return totalBytes;
+    }
+
+    const char *CompressedImage::getFormatName()
+    {
+        return format == CFZso ? "ZSO" : "CSO";
+    }
+
+    unsigned long long CompressedImage::read(unsigned long long position, char *output, unsigned long long size)
+    {
+        if (position >= totalBytes)
+        {
+            return 0;
+        }
+        size = std::min(size, totalBytes - position);
+
+        unsigned long long readed = 0;
+        while (readed < size)
+        {
+            unsigned long long block = (position + readed) / blockSize;
+            unsigned long long offset = (position + readed) % blockSize;
+
+            // The reads in the same block or the next one are considered sequential
+            unsigned long long previousBlock = lastBlock.exchange(block, std::memory_order_relaxed);
+            bool sequential = previousBlock == block || previousBlock + 1 == block;
+
+            if (sequential && pool != nullptr)
+            {
+                prefetch(block);
+            }
+
+            std::shared_ptr<CachedBlock> cached = getBlock(block, sequential);
+            if (cached->failed)
+            {
+                break;
+            }
+
+            unsigned long long toCopy = std::min((unsigned long long)blockSize - offset, size - readed);
+            memcpy(output + readed, cached->data.data() + offset, toCopy);
+            readed += toCopy;
+        }
+
+        return readed;
+    }
+
+    // Get a decompressed block from the cache, or decompress it if it is not there. The sequential reads
+    // decompress the following blocks too, because the compressed data of all of them is readed at once.
+    std::shared_ptr<CompressedImage::CachedBlock> CompressedImage::getBlock(unsigned long long block, bool sequential)
+    {
+        std::vector<std::shared_ptr<CachedBlock>> run;
+        {
+            std::unique_lock<std::mutex> lock(cacheMutex);
+
+            auto found = cache.find(block);
+            if (found != cache.end())
+            {
+                lru.splice(lru.begin(), lru, found->second.lruPosition);
+
+                // The block can be still in process by other thread
+                std::shared_ptr<CachedBlock> cached = found->second.block;
+                cacheCondition.wait(lock, [&cached]
+                                    { return cached->ready; });
+                return cached;
+            }
+
+            unsigned long long last = sequential ? std::min(block + runBlocks, totalBlocks) : block + 1;
+            run.push_back(reserveBlock(block));
+            for (unsigned long long next = block + 1; next < last && cache.find(next) == cache.end(); next++)
+            {
+                run.push_back(reserveBlock(next));
+            }
+        }
+
+        decompressRun(block, run);
+        return run[0];
+    }
+
+    // Add an empty block to the cache, removing the least recently used blocks if the cache is full.
+    // The cache mutex must be locked.
+    std::shared_ptr<CompressedImage::CachedBlock> CompressedImage::reserveBlock(unsigned long long block)
+    {
+        std::shared_ptr<CachedBlock> cached = std::make_shared<CachedBlock>();
+
+        lru.push_front(block);
+        cache[block] = {cached, lru.begin()};
+
+        // The removed blocks are still valid for the threads which are using them
+        while (cache.size() > cacheCapacity)
+        {
+            cache.erase(lru.back());
+            lru.pop_back();
+        }
+
+        return cached;
+    }
+
+    // Decompress the blocks following the current one in the pool threads
+    void CompressedImage::prefetch(unsigned long long block)
+    {
+        std::vector<std::pair<unsigned long long, std::vector<std::shared_ptr<CachedBlock>>>> runs;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+
+            // Start again after a jump, and wait until the half of the window was consumed otherwise
+            if (prefetchedUntil <= block || prefetchedUntil > block + 1 + readaheadBlocks)
+            {
+                prefetchedUntil = block + 1;
+            }
+            else if (prefetchedUntil - block - 1 >= readaheadBlocks / 2)
+            {
+                return;
+            }
+
+            unsigned long long until = std::min(block + 1 + readaheadBlocks, totalBlocks);
+            unsigned long long next = prefetchedUntil;
+            while (next < until)
+            {
+                // The cached blocks split the runs
+                if (cache.find(next) != cache.end())
+                {
+                    next++;
+                    continue;
+                }
+
+                runs.emplace_back(next, std::vector<std::shared_ptr<CachedBlock>>());
+                while (next < until && runs.back().second.size() < runBlocks && cache.find(next) == cache.end())
+                {
+                    runs.back().second.push_back(reserveBlock(next));
+                    next++;
+                }
+            }
+
+            prefetchedUntil = std::max(prefetchedUntil, until);
+        }
+
+        for (auto &run : runs)
+        {
+            unsigned long long first = run.first;
+            std::vector<std::shared_ptr<CachedBlock>> blocks = std::move(run.second);
+            pool->submit([this, first, blocks]
+                         { decompressRun(first, blocks); });
+        }
+    }
+
+    // Read the compressed data of consecutive blocks at once and decompress them
+    void CompressedImage::decompressRun(unsigned long long first, std::vector<std::shared_ptr<CachedBlock>> blocks)
+    {
+        unsigned long long start = (unsigned long long)(index[first] & 0x7FFFFFFF) << indexShift;
+        unsigned long long end = (unsigned long long)(index[first + blocks.size()] & 0x7FFFFFFF) << indexShift;
+
+        std::vector<char> input(end - start);
+        unsigned long long readed = rawReader(start, input.data(), input.size());
+
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            unsigned long long blockStart = ((unsigned long long)(index[first + i] & 0x7FFFFFFF) << indexShift) - start;
+            unsigned long long blockEnd = ((unsigned long long)(index[first + i + 1] & 0x7FFFFFFF) << indexShift) - start;
+
+            blocks[i]->data.resize(blockSize);
+            blocks[i]->failed = blockEnd > readed ||
+                                !decompressBlock(input.data() + blockStart, blockEnd - blockStart, index[first + i] & 0x80000000, blocks[i]->data.data());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                blocks[i]->ready = true;
+
+                // The failed blocks are not kept, so they will be readed again the next time
+                auto found = cache.find(first + i);
+                if (blocks[i]->failed && found != cache.end() && found->second.block == blocks[i])
+                {
+                    lru.erase(found->second.lruPosition);
+                    cache.erase(found);
+                }
+            }
+        }
+        cacheCondition.notify_all();
+    }
+
+    // Decompress a block. The meaning of the index flag depends on the format: In CSO v1 and ZSO it marks
+    // the uncompressed blocks, and in CSO v2 the LZ4 blocks, being uncompressed the blocks of full size.
+    bool CompressedImage::decompressBlock(const char *input, unsigned long long inputSize, bool flagged, char *output)
+    {
+        bool plain = format == CFCso && version >= 2 ? inputSize >= blockSize : flagged;
+        bool lz4 = format == CFZso || (version >= 2 && flagged);
+
+        // The last block can be shorter than the block size
+        if (plain)
+        {
+            unsigned long long toCopy = std::min(inputSize, (unsigned long long)blockSize);
+            memcpy(output, input, toCopy);
+            memset(output + toCopy, 0, blockSize - toCopy);
+            return true;
+        }
+
+        if (lz4)
+        {
+#ifdef USE_LZ4
+            return LZ4_decompress_safe(input, output, (int)inputSize, blockSize) > 0;
+#else
+            return false;
+#endif
+        }
+
+        z_stream &stream = inflateStream.stream;
+        if (!inflateStream.ready)
+        {
+            if (inflateInit2(&stream, -15) != Z_OK)
+            {
+                return false;
+            }
+            inflateStream.ready = true;
+        }
+        else if (inflateReset(&stream) != Z_OK)
+        {
+            return false;
+        }
+
+        stream.next_in = (Bytef *)input;
+        stream.avail_in = (uInt)inputSize;
+        stream.next_out = (Bytef *)output;
+        stream.avail_out = blockSize;
+
+        int result = inflate(&stream, Z_FINISH);
+        return result == Z_STREAM_END || stream.avail_out == 0;
+    }
+
+    CompressedWriter::CompressedWriter(RawWriter rawWriter, CompressedFormat format, unsigned int level, unsigned int threads) : rawWriter(rawWriter), format(format), level(level)
+    {
+        // With only one thread the blocks are compressed when they are writen
+        if (threads > 1)
+        {
+            pool = new ThreadPool(threads);
+        }
+
+        runBlocks = std::max(1ull, (unsigned long long)COMPRESSED_RUN_SIZE / blockSize);
+    }
+
+    CompressedWriter::~CompressedWriter()
+    {
+        // The pending tasks use the jobs, so the pool is stopped first
+        if (pool != nullptr)
+        {
+            delete pool;
+            pool = nullptr;
+        }
+    }
+
+    bool CompressedWriter::start(unsigned long long expectedSize, std::string &error)
+    {
+        // Without a size hint the index is reserved for the biggest CD image, so the data only has to be moved
+        // to write the index of the bigger images
+        if (expectedSize == 0)
+        {
+            expectedSize = COMPRESSED_DEFAULT_EXPECTED_SIZE;
+        }
+
+        unsigned long long expectedBlocks = (expectedSize + blockSize - 1) / blockSize;
+        unsigned long long expectedStart = COMPRESSED_HEADER_SIZE + (expectedBlocks + 1) * 4;
+
+        // The positions are stored in 31 bits, so the big images store them shifted. The blocks are aligned
+        // to the shift size, which is taken into account too.
+        indexShift = 0;
+        while (indexShift < 31 && ((expectedStart + expectedSize + (expectedBlocks << indexShift)) >> indexShift) > 0x7FFFFFFF)
+        {
+            indexShift++;
+        }
+
+        // The index space reserved for the huge size hints is limited, and it is enlarged when the image is finished
+        unsigned long long reservedBlocks = (std::min(expectedSize, COMPRESSED_MAX_RESERVED_SIZE) + blockSize - 1) / blockSize;
+        dataStart = COMPRESSED_HEADER_SIZE + (reservedBlocks + 1) * 4;
+        dataStart = (dataStart + (1ull << indexShift) - 1) & ~((1ull << indexShift) - 1);
+
+        totalBytes = 0;
+        position = dataStart;
+        blockPositions.clear();
+        blockPlain.clear();
+        pending.clear();
+        pending.reserve(runBlocks * blockSize);
+
+        // The reserved space is filled with zeroes until the index is writen
+        std::vector<char> reserved(dataStart, 0);
+        if (!rawWriter(reserved.data(), reserved.size()))
+        {
+            error = "There was an error writing the compressed image header";
+            return false;
+        }
+
+        return true;
+    }
+
+    unsigned long long CompressedWriter::write(const char *input, unsigned long long size, std::string &error)
+    {
+        unsigned long long writen = 0;
+
+        while (writen < size && !failed)
+        {
+            unsigned long long toCopy = std::min(size - writen, runBlocks * blockSize - pending.size());
+            pending.insert(pending.end(), input + writen, input + writen + toCopy);
+            writen += toCopy;
+
+            if (pending.size() == runBlocks * blockSize)
+            {
+                submitPending();
+            }
+        }
+
+        totalBytes += writen;
+
+        if (failed)
+        {
+            error = writeError;
+            return 0;
+        }
+
+        return writen;
+    }
+
+    bool CompressedWriter::finish(std::string &error)
+    {
+        if (!pending.empty())
+        {
+            submitPending();
+        }
+
+        // The end of the last block is aligned too, because it is stored in the index
+        writeJobs(true);
+        unsigned long long padding = ((position + (1ull << indexShift) - 1) & ~((1ull << indexShift) - 1)) - position;
+        if (!failed && padding > 0)
+        {
+            std::vector<char> zeroes(padding, 0);
+            if (!rawWriter(zeroes.data(), padding))
+            {
+                failed = true;
+                writeError = "There was an error writing the compressed data";
+            }
+            position += padding;
+        }
+
+        if (failed)
+        {
+            error = writeError;
+            return false;
+        }
+
+        return true;
+    }
+
+    // Compress the pending blocks in the pool, and write the blocks which were already compressed.
+    // The number of jobs in process is limited to not keep the whole image in memory.
+    void CompressedWriter::submitPending()
+    {
+        std::shared_ptr<CompressJob> job = std::make_shared<CompressJob>();
+        job->input.swap(pending);
+        pending.reserve(runBlocks * blockSize);
+
+        if (pool == nullptr)
+        {
+            compressJob(*job);
+            job->done = true;
+            jobs.push_back(job);
+            writeJobs(true);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back(job);
+        }
+
+        pool->submit([this, job]
+                     {
+            compressJob(*job);
+            {
+                std::lock_guard<std::mutex> lock(jobsMutex);
+                job->done = true;
+            }
+            jobsCondition.notify_all(); });
+
+        writeJobs(false);
+    }
+
+    // Write the compressed jobs in order. If all is false, it only waits when there are too many jobs in process.
+    bool CompressedWriter::writeJobs(bool all)
+    {
+        size_t maxJobs = pool != nullptr ? pool->getThreads() * 2 : 0;
+
+        while (true)
+        {
+            std::shared_ptr<CompressJob> job;
+            {
+                std::unique_lock<std::mutex> lock(jobsMutex);
+                if (jobs.empty())
+                {
+                    break;
+                }
+
+                if (!jobs.front()->done)
+                {
+                    if (!all && jobs.size() <= maxJobs)
+                    {
+                        break;
+                    }
+
+                    jobsCondition.wait(lock, [this]
+                                       { return jobs.front()->done; });
+                }
+
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            // After an error the remaining jobs are just discarded
+            unsigned long long offset = 0;
+            for (size_t i = 0; i < job->sizes.size() && !failed; i++)
+            {
+                // Pad the block to the index alignment
+                unsigned long long padding = ((position + (1ull << indexShift) - 1) & ~((1ull << indexShift) - 1)) - position;
+                if (padding > 0)
+                {
+                    std::vector<char> zeroes(padding, 0);
+                    if (!rawWriter(zeroes.data(), padding))
+                    {
+                        failed = true;
+                        writeError = "There was an error writing the compressed data";
+                        break;
+                    }
+                    position += padding;
+                }
+
+                if (((position + job->sizes[i]) >> indexShift) > 0x7FFFFFFF)
+                {
+                    failed = true;
+                    writeError = "The compressed image is too big for its index. Set the expected size before open the file";
+                    break;
+                }
+
+                if (!rawWriter(job->output.data() + offset, job->sizes[i]))
+                {
+                    failed = true;
+                    writeError = "There was an error writing the compressed data";
+                    break;
+                }
+
+                blockPositions.push_back(position);
+                blockPlain.push_back(job->plain[i]);
+                position += job->sizes[i];
+                offset += job->sizes[i];
+            }
+        }
+
+        return !failed;
+    }
+
+    // Compress every block of the job. The blocks which are not reduced are stored uncompressed.
+    void CompressedWriter::compressJob(CompressJob &job)
+    {
+        job.output.resize(job.input.size());
+
+        unsigned long long offset = 0;
+        for (unsigned long long start = 0; start < job.input.size(); start += blockSize)
+        {
+            unsigned int inputSize = (unsigned int)std::min((unsigned long long)blockSize, job.input.size() - start);
+            unsigned int outputSize = 0;
+
+            bool compressed = compressBlock(job.input.data() + start, inputSize, job.output.data() + offset, outputSize);
+            if (!compressed)
+            {
+                memcpy(job.output.data() + offset, job.input.data() + start, inputSize);
+                outputSize = inputSize;
+            }
+
+            job.sizes.push_back(outputSize);
+            job.plain.push_back(!compressed);
+            offset += outputSize;
+        }
+    }
+
+    // Compress a block into an output of the same size. Returns false if the compressed block doesn't fit.
+    bool CompressedWriter::compressBlock(const char *input, unsigned int inputSize, char *output, unsigned int &outputSize)
+    {
+        if (format == CFZso)
+        {
+#ifdef USE_LZ4
+            // The low levels use the fast compressor, and the rest the high compression one
+            int result = level < LZ4HC_CLEVEL_MIN ? LZ4_compress_default(input, output, (int)inputSize, (int)inputSize - 1)
+                                                  : LZ4_compress_HC(input, output, (int)inputSize, (int)inputSize - 1, std::min((int)level, LZ4HC_CLEVEL_MAX));
+            outputSize = result > 0 ? (unsigned int)result : 0;
+            return result > 0;
+#else
+            return false;
+#endif
+        }
+
+        int deflateLevel = (int)std::min(level, 9u);
+        z_stream &stream = deflateStream.stream;
+        if (deflateStream.ready && deflateStream.level != deflateLevel)
+        {
+            deflateEnd(&stream);
+            deflateStream.ready = false;
+        }
+
+        if (!deflateStream.ready)
+        {
+            stream = {};
+            if (deflateInit2(&stream, deflateLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                return false;
+            }
+            deflateStream.ready = true;
+            deflateStream.level = deflateLevel;
+        }
+        else if (deflateReset(&stream) != Z_OK)
+        {
+            return false;
+        }
+
+        stream.next_in = (Bytef *)input;
+        stream.avail_in = inputSize;
+        stream.next_out = (Bytef *)output;
+        stream.avail_out = inputSize - 1;
+
+        // The output is full before the end of the stream if the block can't be reduced
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        {
+            return false;
+        }
+
+        outputSize = inputSize - 1 - stream.avail_out;
+        return true;
+    }
+
+    unsigned long long CompressedWriter::getRelocation()
+    {
+        unsigned long long headerSize = COMPRESSED_HEADER_SIZE + (blockPositions.size() + 1) * 4;
+        if (headerSize <= dataStart)
+        {
+            return 0;
+        }
+
+        return (headerSize - dataStart + (1ull << indexShift) - 1) & ~((1ull << indexShift) - 1);
+    }
+
+    unsigned long long CompressedWriter::getDataStart()
+    {
+        return dataStart;
+    }
+
+    unsigned long long CompressedWriter::getDataEnd()
+    {
+        return position;
+    }
+
+    bool CompressedWriter::buildHeader(unsigned long long relocation, std::vector<char> &header, std::string &error)
+    {
+        if (((position + relocation) >> indexShift) > 0x7FFFFFFF)
+        {
+            error = "The compressed image is too big for its index. Set the expected size before open the file";
+            return false;
+        }
+
+        header.assign(dataStart + relocation, 0);
+
+        memcpy(header.data(), format == CFZso ? "ZISO" : "CISO", 4);
+        writeLE32(header.data() + 4, COMPRESSED_HEADER_SIZE);
+        writeLE64(header.data() + 8, totalBytes);
+        writeLE32(header.data() + 16, blockSize);
+        header[20] = 1;
+        header[21] = (char)indexShift;
+
+        // The last entry is the end of the last block. The uncompressed blocks are marked with the high bit.
+        char *index = header.data() + COMPRESSED_HEADER_SIZE;
+        for (size_t i = 0; i < blockPositions.size(); i++)
+        {
+            writeLE32(index + i * 4, (uint32_t)((blockPositions[i] + relocation) >> indexShift) | (blockPlain[i] ? 0x80000000 : 0));
+        }
+        writeLE32(index + blockPositions.size() * 4, (uint32_t)((position + relocation) >> indexShift));
+
+        return true;
+    }
+}
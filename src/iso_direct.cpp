@@ -0,0 +1,388 @@
+#include "iso.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Direct I/O mode
+//
+// The files are opened bypassing the system cache (O_DIRECT / FILE_FLAG_NO_BUFFERING), so the big
+// conversions don't evict the data of other processes. The transfers must be aligned, so the unaligned
+// parts of the requests are done through aligned buffers taken from a pool.
+//
+namespace PopstationmdgPlugin
+{
+    static inline unsigned long long alignDown(unsigned long long value)
+    {
+        return value - (value % DIRECT_IO_ALIGNMENT);
+    }
+
+    static inline unsigned long long alignUp(unsigned long long value)
+    {
+        return alignDown(value + DIRECT_IO_ALIGNMENT - 1);
+    }
+
+    AlignedBufferPool::~AlignedBufferPool()
+    {
+        for (char *buffer : freeBuffers)
+        {
+#ifdef _WIN32
+            _aligned_free(buffer);
+#else
+            free(buffer);
+#endif
+        }
+    }
+
+    // Get a free buffer or allocate a new one. Returns nullptr if there is no memory.
+    char *AlignedBufferPool::acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (!freeBuffers.empty())
+            {
+                char *buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+                return buffer;
+            }
+        }
+
+#ifdef _WIN32
+        return (char *)_aligned_malloc(DIRECT_IO_CHUNK, DIRECT_IO_ALIGNMENT);
+#else
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, DIRECT_IO_CHUNK) != 0)
+        {
+            return nullptr;
+        }
+        return (char *)buffer;
+#endif
+    }
+
+    void AlignedBufferPool::release(char *buffer)
+    {
+        if (buffer != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            freeBuffers.push_back(buffer);
+        }
+    }
+
+    // Open a file for direct I/O. Returns nullptr if the file or the filesystem doesn't support it.
+    static void *openDirectFile(const char *filename, bool write)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename, write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_FLAG_NO_BUFFERING | (write ? FILE_FLAG_WRITE_THROUGH : FILE_FLAG_SEQUENTIAL_SCAN), NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+
+        return (void *)file;
+#else
+        return (void *)nativeOpenFile(filename, (write ? O_RDWR : O_RDONLY) | O_DIRECT);
+#endif
+    }
+
+    static void closeDirectFile(void *file)
+    {
+#ifdef _WIN32
+        CloseHandle((HANDLE)file);
+#else
+        fclose((FILE *)file);
+#endif
+    }
+
+    //
+    // Reader
+    //
+
+    // Open the native input file in direct mode. The normal native file is used if it is not supported.
+    bool IsoReader::openDirectInput(const char *filename)
+    {
+        nativeInputFile = openDirectFile(filename, false);
+        if (nativeInputFile == nullptr)
+        {
+            SPDLOG_DEBUG("ISO: Direct I/O is not supported for the input file. Using the system cache");
+            return false;
+        }
+
+        if (directPool == nullptr)
+        {
+            directPool = new AlignedBufferPool();
+        }
+        directInput = true;
+
+        SPDLOG_DEBUG("ISO: The input file was opened in direct I/O mode");
+        return true;
+    }
+
+    // Positional read in direct mode. The aligned parts are readed directly into the output buffer, and
+    // the unaligned head and tail through a pool buffer. It can be called from several threads at once.
+    unsigned long long IsoReader::readAtDirect(unsigned long long position, char *output, unsigned long long outputSize)
+    {
+        unsigned long long readed = 0;
+        char *bounce = nullptr;
+
+        while (readed < outputSize)
+        {
+            unsigned long long current = position + readed;
+            unsigned long long pending = outputSize - readed;
+
+            // Everything is aligned, so read directly into the output buffer
+            if (current % DIRECT_IO_ALIGNMENT == 0 && (uintptr_t)(output + readed) % DIRECT_IO_ALIGNMENT == 0 && pending >= DIRECT_IO_ALIGNMENT)
+            {
+                unsigned long long toRead = alignDown(std::min(pending, (unsigned long long)0x40000000));
+                long long chunkReaded = nativeRead(nativeInputFile, output + readed, toRead, current, statsEnabled ? &stats.syscalls : nullptr);
+                if (chunkReaded < 0)
+                {
+                    setLastError(std::string("There was an error reading from the file: ").append(nativeError()));
+                    break;
+                }
+
+                readed += chunkReaded;
+                if ((unsigned long long)chunkReaded < toRead)
+                {
+                    // EOF
+                    break;
+                }
+                continue;
+            }
+
+            if (bounce == nullptr)
+            {
+                bounce = directPool->acquire();
+                if (bounce == nullptr)
+                {
+                    setLastError(std::string("There was an error allocating the direct I/O buffer memory."));
+                    break;
+                }
+            }
+
+            // Read the aligned blocks which contains the requested data
+            unsigned long long blockStart = alignDown(current);
+            unsigned long long head = current - blockStart;
+            unsigned long long toRead = std::min((unsigned long long)DIRECT_IO_CHUNK, alignUp(head + pending));
+
+            long long chunkReaded = nativeRead(nativeInputFile, bounce, toRead, blockStart, statsEnabled ? &stats.syscalls : nullptr);
+            if (chunkReaded < 0)
+            {
+                setLastError(std::string("There was an error reading from the file: ").append(nativeError()));
+                break;
+            }
+            if ((unsigned long long)chunkReaded <= head)
+            {
+                // EOF
+                break;
+            }
+
+            unsigned long long toCopy = std::min(pending, (unsigned long long)chunkReaded - head);
+            memcpy(output + readed, bounce + head, toCopy);
+            readed += toCopy;
+
+            if ((unsigned long long)chunkReaded < toRead)
+            {
+                // EOF
+                break;
+            }
+        }
+
+        directPool->release(bounce);
+        return readed;
+    }
+
+    //
+    // Writer
+    //
+
+    // Open the output file in direct mode. The file must be already created.
+    bool IsoReader::openDirectOutput(const char *filename)
+    {
+        directOutputFile = openDirectFile(filename, true);
+        if (directOutputFile == nullptr)
+        {
+            SPDLOG_DEBUG("ISO: Direct I/O is not supported for the output file. Using the system cache");
+            return false;
+        }
+
+        if (directPool == nullptr)
+        {
+            directPool = new AlignedBufferPool();
+        }
+
+        directWriteBuffer = directPool->acquire();
+        if (directWriteBuffer == nullptr)
+        {
+            closeDirectFile(directOutputFile);
+            directOutputFile = nullptr;
+            return false;
+        }
+
+        directWriteStart = 0;
+        directWriteUsed = 0;
+        directWriteActive = false;
+        directOutputEnd = 0;
+
+        SPDLOG_DEBUG("ISO: The output file was opened in direct I/O mode");
+        return true;
+    }
+
+    // Store the data in the aligned buffer, which is written to disk every time that it is full
+    unsigned long long IsoReader::writeDataDirect(char *input, unsigned long long inputSize)
+    {
+        unsigned long long writen = 0;
+
+        // Start a new aligned block at the current position. If the position is not aligned,
+        // the previous data of the block is loaded to not overwrite it.
+        if (!directWriteActive)
+        {
+            directWriteStart = alignDown(writePosition);
+            directWriteUsed = writePosition - directWriteStart;
+
+            if (directWriteUsed > 0)
+            {
+                long long blockReaded = 0;
+                if (directWriteStart < directOutputEnd)
+                {
+                    blockReaded = nativeRead(directOutputFile, directWriteBuffer, DIRECT_IO_ALIGNMENT, directWriteStart, statsEnabled ? &stats.syscalls : nullptr);
+                    if (blockReaded < 0)
+                    {
+                        setLastError(std::string("There was an error reading the output file block: ").append(nativeError()));
+                        return 0;
+                    }
+                }
+                memset(directWriteBuffer + blockReaded, 0, DIRECT_IO_ALIGNMENT - blockReaded);
+            }
+            directWriteActive = true;
+        }
+
+        while (writen < inputSize)
+        {
+            unsigned long long toCopy = std::min(inputSize - writen, DIRECT_IO_CHUNK - directWriteUsed);
+            memcpy(directWriteBuffer + directWriteUsed, input + writen, toCopy);
+            directWriteUsed += toCopy;
+            writen += toCopy;
+            writePosition += toCopy;
+
+            if (directWriteUsed == DIRECT_IO_CHUNK)
+            {
+                if (nativeWrite(directOutputFile, directWriteBuffer, DIRECT_IO_CHUNK, directWriteStart, statsEnabled ? &stats.syscalls : nullptr) != DIRECT_IO_CHUNK)
+                {
+                    setLastError(std::string("There was an error writing to the file: ").append(nativeError()));
+                    directWriteActive = false;
+                    return writen;
+                }
+
+                directWriteStart += DIRECT_IO_CHUNK;
+                directWriteUsed = 0;
+                directOutputEnd = std::max(directOutputEnd, directWriteStart);
+            }
+        }
+
+        return writen;
+    }
+
+    // Write the buffered data. The last block is padded with the data already on disk (or zeroes), and the
+    // padding after the end of the file is removed when the file is closed.
+    bool IsoReader::flushDirectOutput()
+    {
+        if (!directWriteActive)
+        {
+            return true;
+        }
+        directWriteActive = false;
+
+        if (directWriteUsed == 0)
+        {
+            return true;
+        }
+
+        unsigned long long toWrite = alignUp(directWriteUsed);
+        unsigned long long tailUsed = directWriteUsed % DIRECT_IO_ALIGNMENT;
+
+        if (tailUsed != 0)
+        {
+            unsigned long long tailBlock = directWriteStart + toWrite - DIRECT_IO_ALIGNMENT;
+            char *tail = directWriteBuffer + toWrite - DIRECT_IO_ALIGNMENT;
+            long long blockReaded = 0;
+
+            if (tailBlock < directOutputEnd)
+            {
+                char *block = directPool->acquire();
+                if (block == nullptr)
+                {
+                    setLastError(std::string("There was an error allocating the direct I/O buffer memory."));
+                    return false;
+                }
+
+                blockReaded = nativeRead(directOutputFile, block, DIRECT_IO_ALIGNMENT, tailBlock, statsEnabled ? &stats.syscalls : nullptr);
+                if (blockReaded > (long long)tailUsed)
+                {
+                    memcpy(tail + tailUsed, block + tailUsed, blockReaded - tailUsed);
+                }
+                directPool->release(block);
+
+                if (blockReaded < 0)
+                {
+                    setLastError(std::string("There was an error reading the output file block: ").append(nativeError()));
+                    return false;
+                }
+            }
+
+            if (blockReaded < DIRECT_IO_ALIGNMENT)
+            {
+                unsigned long long validData = std::max((unsigned long long)blockReaded, tailUsed);
+                memset(tail + validData, 0, DIRECT_IO_ALIGNMENT - validData);
+            }
+        }
+
+        if (nativeWrite(directOutputFile, directWriteBuffer, toWrite, directWriteStart, statsEnabled ? &stats.syscalls : nullptr) != (long long)toWrite)
+        {
+            setLastError(std::string("There was an error writing to the file: ").append(nativeError()));
+            return false;
+        }
+
+        directOutputEnd = std::max(directOutputEnd, directWriteStart + directWriteUsed);
+        directWriteUsed = 0;
+
+        return true;
+    }
+
+    // Write the pending data, remove the padding of the last block and close the file
+    bool IsoReader::closeDirectOutput()
+    {
+        if (directOutputFile == nullptr)
+        {
+            return true;
+        }
+
+        bool flushed = flushDirectOutput();
+
+#ifdef _WIN32
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = directOutputEnd;
+        if (!SetFileInformationByHandle((HANDLE)directOutputFile, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+#else
+        if (ftruncate(fileno((FILE *)directOutputFile), directOutputEnd) != 0)
+#endif
+        {
+            setLastError(std::string("There was an error setting the output file size: ").append(nativeError()));
+            flushed = false;
+        }
+
+        closeDirectFile(directOutputFile);
+        directOutputFile = nullptr;
+        directPool->release(directWriteBuffer);
+        directWriteBuffer = nullptr;
+
+        return flushed;
+    }
+}
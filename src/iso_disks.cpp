@@ -0,0 +1,413 @@
+#include "iso.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+
+// Multi-disk images
+//
+// The reader accepts M3U playlists and numbered sets of images, like "Game (Disc 1).iso", "Game (Disc 2).iso"...
+// Every disk is opened in its own object when the image is opened, and the calls of the host are served by the
+// object of the current disk. The writer creates a file for every disk added by the host, and the playlist if the output
+// is a M3U file. A single disk output is always writen to the filename passed by the host.
+//
+namespace PopstationmdgPlugin
+{
+    // Find the number of a "(Disc N)" tag in the filename. Returns false if the filename doesn't have the tag.
+    static bool findDiscTag(const std::string &filename, size_t &numberStart, size_t &numberEnd)
+    {
+        std::string lowerName = filename;
+        std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), [](unsigned char c)
+                       { return tolower(c); });
+
+        // Only the name of the file is checked, not the folders
+        size_t nameStart = lowerName.find_last_of("\\/");
+        nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+
+        size_t tag = lowerName.rfind("(disc ");
+        if (tag == std::string::npos || tag < nameStart)
+        {
+            return false;
+        }
+
+        numberStart = tag + 6;
+        numberEnd = numberStart;
+        while (numberEnd < lowerName.size() && isdigit((unsigned char)lowerName[numberEnd]))
+        {
+            numberEnd++;
+        }
+
+        return numberEnd > numberStart && numberEnd < lowerName.size() && lowerName[numberEnd] == ')';
+    }
+
+    // Remove the "(Disc N)" tag and the space before it. The writer doesn't add the tag to the first disk of an ISO file.
+    static std::string removeDiscTag(const std::string &filename, size_t numberStart, size_t numberEnd)
+    {
+        size_t tagStart = numberStart - 6;
+        if (tagStart > 0 && filename[tagStart - 1] == ' ')
+        {
+            tagStart--;
+        }
+
+        return filename.substr(0, tagStart) + filename.substr(numberEnd + 1);
+    }
+
+    // Check if the file is a M3U playlist
+    static bool isPlaylist(const std::string &filename)
+    {
+        std::string extension = std::filesystem::path(filename).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                       { return tolower(c); });
+
+        return extension == ".m3u" || extension == ".m3u8";
+    }
+
+    // Get the filename of a disk. The number of the "(Disc N)" tag is replaced if the filename has it. Otherwise
+    // the tag is added to the name, except for the first disk of an ISO file, which keeps the original name.
+    std::string IsoReader::getDiskFilename(uint8_t diskNumber)
+    {
+        size_t numberStart, numberEnd;
+        if (findDiscTag(baseFilename, numberStart, numberEnd))
+        {
+            return baseFilename.substr(0, numberStart) + std::to_string(diskNumber) + baseFilename.substr(numberEnd);
+        }
+
+        std::filesystem::path path(baseFilename);
+        std::string tag = " (Disc " + std::to_string(diskNumber) + ")";
+
+        // The disks of a playlist use the extension of the selected output format
+        if (isPlaylist(baseFilename))
+        {
+            std::string extension = compressedOutputFormat == CFCso ? ".cso" : compressedOutputFormat == CFZso ? ".zso" : ".iso";
+            return (path.parent_path() / (path.stem().string() + tag + extension)).string();
+        }
+
+        if (diskNumber == 1)
+        {
+            return baseFilename;
+        }
+
+        return (path.parent_path() / (path.stem().string() + tag + path.extension().string())).string();
+    }
+
+    // Get the filename of a writen disk. The first disk is writen to the filename passed by the host, and the tags are
+    // only added or renumbered for the disks created by addNewDisk. If the filename already has a "(Disc N)" tag the
+    // next disks continue from that number, so they never overwrite the first one. The playlists use the disk names.
+    std::string IsoReader::getOutputDiskFilename(unsigned int diskNumber)
+    {
+        if (isPlaylist(baseFilename))
+        {
+            return getDiskFilename(diskNumber);
+        }
+
+        if (diskNumber == 1)
+        {
+            return baseFilename;
+        }
+
+        size_t numberStart, numberEnd;
+        if (findDiscTag(baseFilename, numberStart, numberEnd))
+        {
+            unsigned long long firstNumber = strtoull(baseFilename.substr(numberStart, numberEnd - numberStart).c_str(), nullptr, 10);
+            return baseFilename.substr(0, numberStart) + std::to_string(firstNumber + diskNumber - 1) + baseFilename.substr(numberEnd);
+        }
+
+        return getDiskFilename(diskNumber);
+    }
+
+    // Check if the writen image is a playlist, which is writen when the output is closed
+    bool IsoReader::isPlaylistOutput()
+    {
+        return isPlaylist(baseFilename);
+    }
+
+    // Get the disk files of the opened image and the disk which was opened by the host
+    bool IsoReader::findDiskFiles(std::vector<std::string> &files, unsigned int &current)
+    {
+        files.clear();
+        current = 1;
+
+        if (isPlaylist(baseFilename))
+        {
+            std::ifstream playlist(baseFilename);
+            if (!playlist.is_open())
+            {
+                setLastError(std::string("There was an error opening the playlist: ") + baseFilename);
+                return false;
+            }
+
+            // The paths in the playlist are relative to the playlist folder. The lines starting by # are comments.
+            std::filesystem::path folder = std::filesystem::path(baseFilename).parent_path();
+            std::string line;
+            while (std::getline(playlist, line))
+            {
+                size_t start = line.find_first_not_of(" \t\r\n");
+                size_t end = line.find_last_not_of(" \t\r\n");
+                if (start == std::string::npos || line[start] == '#')
+                {
+                    continue;
+                }
+
+                std::filesystem::path disk(line.substr(start, end - start + 1));
+                files.push_back(disk.is_absolute() ? disk.string() : (folder / disk).string());
+            }
+
+            if (files.empty())
+            {
+                setLastError(std::string("The playlist doesn't contain any disk: ") + baseFilename);
+                return false;
+            }
+
+            if (files.size() > MAX_DISKS)
+            {
+                setLastError(std::string("The playlist contains more than ") + std::to_string(MAX_DISKS) + " disks");
+                return false;
+            }
+
+            return true;
+        }
+
+        if (!multiDiskEnabled)
+        {
+            files.assign(1, baseFilename);
+            return true;
+        }
+
+        // Search the disks of a numbered set until one is missing
+        std::error_code error;
+        for (unsigned int disk = 1; disk <= MAX_DISKS; disk++)
+        {
+            std::string filename = getDiskFilename(disk);
+            if (!std::filesystem::is_regular_file(filename, error))
+            {
+                // The first disk can be the file without the tag, as it is created by the writer
+                size_t numberStart, numberEnd;
+                if (disk != 1 || !findDiscTag(baseFilename, numberStart, numberEnd))
+                {
+                    break;
+                }
+
+                filename = removeDiscTag(baseFilename, numberStart, numberEnd);
+                if (!std::filesystem::is_regular_file(filename, error))
+                {
+                    break;
+                }
+            }
+
+            if (filename == baseFilename)
+            {
+                current = disk;
+            }
+            files.push_back(filename);
+        }
+
+        // The opened file is not part of a complete set, so it is opened alone
+        if (files.empty() || files[current - 1] != baseFilename)
+        {
+            files.assign(1, baseFilename);
+            current = 1;
+        }
+
+        return true;
+    }
+
+    // Open every disk in its own object. The objects use the settings of this object, and report the errors through it.
+    bool IsoReader::openDisks(const std::vector<std::string> &files, unsigned int current, unsigned int compressionLevel, unsigned int threads)
+    {
+        std::string settings = currentSettings.dump();
+
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            IsoReader *disk = new IsoReader();
+            disk->parentReader = this;
+            disk->setSettings(settings.c_str(), settings.size());
+            disk->multiDiskEnabled = false;
+            diskReaders.push_back(disk);
+
+            SPDLOG_DEBUG("ISO: Opening the disk {}: {}", i + 1, files[i]);
+            if (!disk->open((char *)files[i].c_str(), PTReader, compressionLevel, threads))
+            {
+                setLastError(std::string("There was an error opening the disk ") + std::to_string(i + 1) + ": " + files[i]);
+                closeDisks();
+                return false;
+            }
+        }
+
+        totalDisks = (unsigned int)diskReaders.size();
+        currentDisk = current;
+        currentDiskReader = diskReaders[current - 1];
+        diskIDsDetected = false;
+
+        return true;
+    }
+
+    // Close and free the disk objects
+    void IsoReader::closeDisks()
+    {
+        for (auto disk : diskReaders)
+        {
+            disk->close();
+            delete disk;
+        }
+
+        diskReaders.clear();
+        currentDiskReader = nullptr;
+        diskIDsDetected = false;
+    }
+
+    // Object which serves the calls for the current disk. In single disk images it is the object itself.
+    IsoReader *IsoReader::getDiskReader()
+    {
+        return currentDiskReader != nullptr ? currentDiskReader : this;
+    }
+
+    // Search the ID of every disk. The disks are scanned in parallel because the disks without a standard file
+    // system must be readed completely. The IDs are stored in the disk objects, and the disks without ID are
+    // only reported when their ID is requested.
+    void IsoReader::detectDiskIDs()
+    {
+        if (diskIDsDetected)
+        {
+            return;
+        }
+
+        unsigned int threads = std::min(workerThreads, (unsigned int)diskReaders.size());
+        if (threads > 1)
+        {
+            ThreadPool pool(threads);
+            for (auto disk : diskReaders)
+            {
+                pool.submit([disk]
+                            { disk->detectID(); });
+            }
+            pool.wait();
+        }
+        else
+        {
+            for (auto disk : diskReaders)
+            {
+                disk->detectID();
+            }
+        }
+
+        diskIDsDetected = true;
+    }
+
+    // Change the disk used by the reader calls. All the disks are already opened, so only the current object changes.
+    bool IsoReader::changeCurrentDisk(unsigned int disk)
+    {
+        unsigned int disks = diskReaders.empty() ? 1 : (unsigned int)diskReaders.size();
+        if (disk < 1 || disk > disks)
+        {
+            setLastError(std::string("The disk ") + std::to_string(disk) + " doesn't exists");
+            return false;
+        }
+
+        if (!diskReaders.empty())
+        {
+            currentDisk = disk;
+            currentDiskReader = diskReaders[disk - 1];
+        }
+
+        return true;
+    }
+
+    // Close the output file of the current disk and open the file of the next disk
+    bool IsoReader::addNewDisk()
+    {
+        if (!(pluginMode & PTWriter) || baseFilename.empty())
+        {
+            setLastError(std::string("There is no output file opened"));
+            return false;
+        }
+
+        if (totalDisks >= MAX_DISKS)
+        {
+            setLastError(std::string("The image can't have more than ") + std::to_string(MAX_DISKS) + " disks");
+            return false;
+        }
+
+        if (output_file.is_open() && !closeOutputFile())
+        {
+            return false;
+        }
+
+        // The hashes are calculated for every disk
+        if (streamHasher != nullptr)
+        {
+            delete streamHasher;
+            streamHasher = new StreamHasher(workerThreads, true);
+        }
+
+        totalDisks++;
+        currentDisk = totalDisks;
+
+        return openOutputFile(getOutputDiskFilename(currentDisk).c_str());
+    }
+
+    // Close the output file of the current disk. The next disk is started by addNewDisk.
+    bool IsoReader::closeCurrentDisk()
+    {
+        if (!(pluginMode & PTWriter) || baseFilename.empty())
+        {
+            setLastError(std::string("There is no output file opened"));
+            return false;
+        }
+
+        if (!output_file.is_open())
+        {
+            return true;
+        }
+
+        return closeOutputFile();
+    }
+
+    // Write the playlist with the filenames of the writen disks, which are in the same folder
+    bool IsoReader::writePlaylist()
+    {
+        std::ofstream playlist(baseFilename, std::ios::binary | std::ios::trunc);
+        for (unsigned int disk = 1; disk <= totalDisks; disk++)
+        {
+            playlist << std::filesystem::path(getOutputDiskFilename(disk)).filename().string() << "\n";
+        }
+        playlist.close();
+
+        if (!playlist)
+        {
+            setLastError(std::string("There was an error writing the playlist: ") + baseFilename);
+            return false;
+        }
+
+        return true;
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT changeCurrentDisk(void *handler, unsigned int disk)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->changeCurrentDisk(disk);
+        }
+
+        // The disk files are created by addNewDisk, so the total is not required
+        bool SHARED_EXPORT setTotalDisks(void *handler, unsigned int totalDisks)
+        {
+            return true;
+        }
+
+        bool SHARED_EXPORT addNewDisk(void *handler)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->addNewDisk();
+        }
+
+        bool SHARED_EXPORT closeCurrentDisk(void *handler)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->closeCurrentDisk();
+        }
+    }
+}
@@ -0,0 +1,221 @@
+#include "iso_ecc.h"
+
+#include <cstring>
+
+// Offsets of the raw sector fields
+#define ECC_HEADER_OFFSET 12
+#define ECC_MODE1_EDC_OFFSET 2064
+#define ECC_MODE2_FORM1_EDC_OFFSET 2072
+#define ECC_MODE2_FORM2_EDC_OFFSET 2348
+#define ECC_P_OFFSET 2076
+#define ECC_Q_OFFSET 2248
+#define ECC_P_SIZE 172
+#define ECC_Q_SIZE 104
+
+namespace PopstationmdgPlugin
+{
+    // Sync pattern at the start of every raw sector
+    static const uint8_t eccSyncPattern[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+
+    // Tables used by the ECC (GF(2^8) multiply by 2 and its inverse) and the EDC (slicing by 8 of the
+    // 0xD8018001 reversed polynomial).
+    static uint8_t eccForwardTable[256];
+    static uint8_t eccBackwardTable[256];
+    static uint32_t edcTables[8][256];
+
+    static bool initEccTables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t j = (i << 1) ^ (i & 0x80 ? 0x11D : 0);
+            eccForwardTable[i] = (uint8_t)j;
+            eccBackwardTable[i ^ j] = (uint8_t)i;
+
+            uint32_t edc = i;
+            for (int k = 0; k < 8; k++)
+            {
+                edc = (edc >> 1) ^ (edc & 1 ? 0xD8018001 : 0);
+            }
+            edcTables[0][i] = edc;
+        }
+
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int t = 1; t < 8; t++)
+            {
+                edcTables[t][i] = (edcTables[t - 1][i] >> 8) ^ edcTables[0][edcTables[t - 1][i] & 0xFF];
+            }
+        }
+
+        return true;
+    }
+
+    static const bool eccTablesReady = initEccTables();
+
+    static inline uint32_t readLE32(const uint8_t *data)
+    {
+        return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
+
+    static inline void writeLE32(uint8_t *data, uint32_t value)
+    {
+        data[0] = (uint8_t)value;
+        data[1] = (uint8_t)(value >> 8);
+        data[2] = (uint8_t)(value >> 16);
+        data[3] = (uint8_t)(value >> 24);
+    }
+
+    static inline uint8_t toBCD(unsigned int value)
+    {
+        return (uint8_t)(((value / 10) << 4) | (value % 10));
+    }
+
+    uint32_t computeEdc(const uint8_t *data, size_t size, uint32_t edc)
+    {
+        // Eight bytes by step
+        while (size >= 8)
+        {
+            uint32_t low = readLE32(data) ^ edc;
+            uint32_t high = readLE32(data + 4);
+            edc = edcTables[7][low & 0xFF] ^ edcTables[6][(low >> 8) & 0xFF] ^
+                  edcTables[5][(low >> 16) & 0xFF] ^ edcTables[4][low >> 24] ^
+                  edcTables[3][high & 0xFF] ^ edcTables[2][(high >> 8) & 0xFF] ^
+                  edcTables[1][(high >> 16) & 0xFF] ^ edcTables[0][high >> 24];
+            data += 8;
+            size -= 8;
+        }
+
+        while (size--)
+        {
+            edc = (edc >> 8) ^ edcTables[0][(edc ^ *data++) & 0xFF];
+        }
+
+        return edc;
+    }
+
+    // Calculate a parity block. The data is seen as a matrix of majorCount columns of minorCount bytes,
+    // walked in diagonal for the Q parity.
+    static void computeEccBlock(const uint8_t *data, uint32_t majorCount, uint32_t minorCount, uint32_t majorMult, uint32_t minorInc, uint8_t *output)
+    {
+        uint32_t size = majorCount * minorCount;
+
+        for (uint32_t major = 0; major < majorCount; major++)
+        {
+            uint32_t index = (major >> 1) * majorMult + (major & 1);
+            uint8_t eccA = 0;
+            uint8_t eccB = 0;
+
+            for (uint32_t minor = 0; minor < minorCount; minor++)
+            {
+                uint8_t value = data[index];
+                index += minorInc;
+                if (index >= size)
+                {
+                    index -= size;
+                }
+                eccA ^= value;
+                eccB ^= value;
+                eccA = eccForwardTable[eccA];
+            }
+
+            eccA = eccBackwardTable[eccForwardTable[eccA] ^ eccB];
+            output[major] = eccA;
+            output[major + majorCount] = eccA ^ eccB;
+        }
+    }
+
+    void computeEcc(uint8_t *sector)
+    {
+        // The Q parity covers the P parity, so the P parity is calculated first
+        computeEccBlock(sector + ECC_HEADER_OFFSET, 86, 24, 2, 86, sector + ECC_P_OFFSET);
+        computeEccBlock(sector + ECC_HEADER_OFFSET, 52, 43, 86, 88, sector + ECC_Q_OFFSET);
+    }
+
+    // Compare the ECC of the sector with the calculated one
+    static bool checkEcc(const uint8_t *sector)
+    {
+        uint8_t parityP[ECC_P_SIZE];
+        uint8_t parityQ[ECC_Q_SIZE];
+
+        // The stored P parity is used to check the Q parity, so both parities are checked independently
+        computeEccBlock(sector + ECC_HEADER_OFFSET, 86, 24, 2, 86, parityP);
+        computeEccBlock(sector + ECC_HEADER_OFFSET, 52, 43, 86, 88, parityQ);
+
+        return memcmp(parityP, sector + ECC_P_OFFSET, ECC_P_SIZE) == 0 &&
+               memcmp(parityQ, sector + ECC_Q_OFFSET, ECC_Q_SIZE) == 0;
+    }
+
+    bool checkRawSector(const uint8_t *sector)
+    {
+        if (memcmp(sector, eccSyncPattern, sizeof(eccSyncPattern)) != 0)
+        {
+            return false;
+        }
+
+        switch (sector[15])
+        {
+        case 1:
+            return computeEdc(sector, ECC_MODE1_EDC_OFFSET) == readLE32(sector + ECC_MODE1_EDC_OFFSET) &&
+                   checkEcc(sector);
+
+        case 2:
+            // The form 2 is set in the submode byte of the subheader
+            if (sector[18] & 0x20)
+            {
+                uint32_t edc = readLE32(sector + ECC_MODE2_FORM2_EDC_OFFSET);
+                return edc == 0 || computeEdc(sector + 16, ECC_MODE2_FORM2_EDC_OFFSET - 16) == edc;
+            }
+            else
+            {
+                if (computeEdc(sector + 16, ECC_MODE2_FORM1_EDC_OFFSET - 16) != readLE32(sector + ECC_MODE2_FORM1_EDC_OFFSET))
+                {
+                    return false;
+                }
+
+                // In MODE2 the ECC is calculated with the address zeroed
+                uint8_t copy[2352];
+                memcpy(copy, sector, sizeof(copy));
+                memset(copy + ECC_HEADER_OFFSET, 0, 4);
+                return checkEcc(copy);
+            }
+
+        default:
+            return true;
+        }
+    }
+
+    void encodeRawSector(uint8_t *sector, const uint8_t *userData, unsigned long long lba, unsigned int mode)
+    {
+        // The address is stored in MSF format, with the 2 seconds of pregap of the first track
+        unsigned long long address = lba + 150;
+
+        memcpy(sector, eccSyncPattern, sizeof(eccSyncPattern));
+        sector[12] = toBCD((unsigned int)(address / 4500));
+        sector[13] = toBCD((unsigned int)((address / 75) % 60));
+        sector[14] = toBCD((unsigned int)(address % 75));
+        sector[15] = (uint8_t)mode;
+
+        if (mode == 2)
+        {
+            // Subheader of a data sector (file 0, channel 0, submode data, no coding), repeated twice
+            static const uint8_t subheader[8] = {0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00};
+            memcpy(sector + 16, subheader, sizeof(subheader));
+            memcpy(sector + 24, userData, 2048);
+            writeLE32(sector + ECC_MODE2_FORM1_EDC_OFFSET, computeEdc(sector + 16, ECC_MODE2_FORM1_EDC_OFFSET - 16));
+
+            // In MODE2 the ECC is calculated with the address zeroed
+            uint8_t header[4];
+            memcpy(header, sector + ECC_HEADER_OFFSET, 4);
+            memset(sector + ECC_HEADER_OFFSET, 0, 4);
+            computeEcc(sector);
+            memcpy(sector + ECC_HEADER_OFFSET, header, 4);
+        }
+        else
+        {
+            memcpy(sector + 16, userData, 2048);
+            writeLE32(sector + ECC_MODE1_EDC_OFFSET, computeEdc(sector, ECC_MODE1_EDC_OFFSET));
+            memset(sector + ECC_MODE1_EDC_OFFSET + 4, 0, 8);
+            computeEcc(sector);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#include "iso.h"
+
+namespace PopstationmdgPlugin
+{
+    // Sectors encoded by every batch. Every batch is splitted between the pool threads and writen at once.
+    static const unsigned long long rawEncodeBatchSectors = 512;
+
+    // Reserve the encoder buffer and the threads used to encode the sectors
+    bool IsoReader::startRawEncoder()
+    {
+        rawEncodeBuffer = new (std::nothrow) char[rawEncodeBatchSectors * RAW_SECTOR_SIZE];
+        if (rawEncodeBuffer == nullptr)
+        {
+            setLastError(std::string("There was an error allocating the raw sectors encoder memory."));
+            return false;
+        }
+
+        // With only one thread the sectors are encoded in the host thread
+        if (workerThreads > 1)
+        {
+            rawEncodePool = new ThreadPool(workerThreads);
+        }
+
+        rawPendingUsed = 0;
+        rawEncodeLba = 0;
+
+        SPDLOG_DEBUG("ISO: Generating MODE{} raw sectors using {} threads", rawEncodeMode, workerThreads);
+        return true;
+    }
+
+    // Write the pending sector padded with zeroes and free the encoder resources
+    bool IsoReader::stopRawEncoder()
+    {
+        if (rawEncodeBuffer == nullptr)
+        {
+            return true;
+        }
+
+        bool flushed = true;
+        if (rawPendingUsed > 0)
+        {
+            SPDLOG_DEBUG("ISO: The last sector is incomplete. Padding it with {} zeroes", MODE1_SECTOR_SIZE - rawPendingUsed);
+            memset(rawPendingSector + rawPendingUsed, 0, MODE1_SECTOR_SIZE - rawPendingUsed);
+
+            const char *source = rawPendingSector;
+            flushed = encodeRawBatch(&source, 1);
+            rawPendingUsed = 0;
+        }
+
+        if (rawEncodePool != nullptr)
+        {
+            delete rawEncodePool;
+            rawEncodePool = nullptr;
+        }
+
+        delete[] rawEncodeBuffer;
+        rawEncodeBuffer = nullptr;
+
+        return flushed;
+    }
+
+    // Encode the user data sectors and write them to the output
+    bool IsoReader::encodeRawBatch(const char **sources, unsigned long long count)
+    {
+        unsigned int tasks = rawEncodePool != nullptr ? (unsigned int)std::min((unsigned long long)rawEncodePool->getThreads(), count) : 1;
+
+        if (tasks > 1)
+        {
+            unsigned long long perTask = (count + tasks - 1) / tasks;
+            for (unsigned long long first = 0; first < count; first += perTask)
+            {
+                unsigned long long last = std::min(first + perTask, count);
+                rawEncodePool->submit([this, sources, first, last]
+                                      {
+                    for (unsigned long long i = first; i < last; i++)
+                    {
+                        encodeRawSector((uint8_t *)rawEncodeBuffer + i * RAW_SECTOR_SIZE, (const uint8_t *)sources[i], rawEncodeLba + i, rawEncodeMode);
+                    } });
+            }
+            rawEncodePool->wait();
+        }
+        else
+        {
+            for (unsigned long long i = 0; i < count; i++)
+            {
+                encodeRawSector((uint8_t *)rawEncodeBuffer + i * RAW_SECTOR_SIZE, (const uint8_t *)sources[i], rawEncodeLba + i, rawEncodeMode);
+            }
+        }
+
+        rawEncodeLba += count;
+
+        unsigned long long toWrite = count * RAW_SECTOR_SIZE;
+        return writeOutputData(rawEncodeBuffer, toWrite) == toWrite;
+    }
+
+    // Wrap the user data into raw sectors. The data can be received in chunks of any size, so the sectors
+    // splitted between two writes are completed in the pending sector. Returns the consumed bytes.
+    unsigned long long IsoReader::writeRawSectors(char *input, unsigned long long inputSize)
+    {
+        const char *sources[rawEncodeBatchSectors];
+        unsigned long long batchCount = 0;
+        unsigned long long consumed = 0;
+
+        // Complete the sector started in the previous write
+        if (rawPendingUsed > 0)
+        {
+            unsigned long long toCopy = std::min(inputSize, MODE1_SECTOR_SIZE - rawPendingUsed);
+            memcpy(rawPendingSector + rawPendingUsed, input, toCopy);
+            rawPendingUsed += toCopy;
+            consumed += toCopy;
+
+            if (rawPendingUsed < MODE1_SECTOR_SIZE)
+            {
+                return consumed;
+            }
+
+            sources[batchCount++] = rawPendingSector;
+        }
+
+        // The complete sectors are encoded directly from the host buffer
+        while (inputSize - consumed >= MODE1_SECTOR_SIZE)
+        {
+            sources[batchCount++] = input + consumed;
+            consumed += MODE1_SECTOR_SIZE;
+
+            if (batchCount == rawEncodeBatchSectors)
+            {
+                if (!encodeRawBatch(sources, batchCount))
+                {
+                    return 0;
+                }
+                batchCount = 0;
+            }
+        }
+
+        if (batchCount > 0 && !encodeRawBatch(sources, batchCount))
+        {
+            return 0;
+        }
+
+        // Keep the remaining data for the next write. The pending sector was already encoded at this point.
+        rawPendingUsed = inputSize - consumed;
+        memcpy(rawPendingSector, input + consumed, rawPendingUsed);
+
+        return inputSize;
+    }
+}
@@ -0,0 +1,525 @@
+#include "iso_hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "nlohmann_json/json.hpp"
+
+namespace PopstationmdgPlugin
+{
+    // Number of digests calculated by the stream hasher
+    static const unsigned int hashAlgorithms = 3;
+
+    // Tables used by the slicing by 8 CRC32. The first one is the classic byte table.
+    static uint32_t crcTables[8][256];
+
+    static bool initCrcTables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+            {
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+            crcTables[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int t = 1; t < 8; t++)
+            {
+                crcTables[t][i] = (crcTables[t - 1][i] >> 8) ^ crcTables[0][crcTables[t - 1][i] & 0xFF];
+            }
+        }
+
+        return true;
+    }
+
+    static const bool crcTablesReady = initCrcTables();
+
+    static inline uint32_t readLE32(const uint8_t *data)
+    {
+        return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
+
+    static inline uint32_t readBE32(const uint8_t *data)
+    {
+        return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+    }
+
+    static inline uint32_t rotateLeft(uint32_t value, unsigned int bits)
+    {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    static std::string toHex(const uint8_t *data, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(size * 2);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            hex.push_back(digits[data[i] >> 4]);
+            hex.push_back(digits[data[i] & 0x0F]);
+        }
+
+        return hex;
+    }
+
+    //
+    // CRC32
+    //
+    void Crc32::update(const uint8_t *data, size_t size)
+    {
+        uint32_t value = crc;
+
+        // Eight bytes by step
+        while (size >= 8)
+        {
+            uint32_t low = readLE32(data) ^ value;
+            uint32_t high = readLE32(data + 4);
+            value = crcTables[7][low & 0xFF] ^ crcTables[6][(low >> 8) & 0xFF] ^
+                    crcTables[5][(low >> 16) & 0xFF] ^ crcTables[4][low >> 24] ^
+                    crcTables[3][high & 0xFF] ^ crcTables[2][(high >> 8) & 0xFF] ^
+                    crcTables[1][(high >> 16) & 0xFF] ^ crcTables[0][high >> 24];
+            data += 8;
+            size -= 8;
+        }
+
+        while (size--)
+        {
+            value = (value >> 8) ^ crcTables[0][(value ^ *data++) & 0xFF];
+        }
+
+        crc = value;
+    }
+
+    std::string Crc32::getDigest()
+    {
+        uint32_t value = ~crc;
+        uint8_t digest[4] = {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+        return toHex(digest, 4);
+    }
+
+    //
+    // MD5 (RFC 1321)
+    //
+    Md5::Md5()
+    {
+        state[0] = 0x67452301;
+        state[1] = 0xEFCDAB89;
+        state[2] = 0x98BADCFE;
+        state[3] = 0x10325476;
+    }
+
+    void Md5::transform(const uint8_t *block)
+    {
+        static const uint32_t constants[64] = {
+            0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+            0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+            0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+            0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+            0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+            0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+            0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+            0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391};
+        static const unsigned int shifts[64] = {
+            7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+            5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+        uint32_t words[16];
+        for (int i = 0; i < 16; i++)
+        {
+            words[i] = readLE32(block + i * 4);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t f;
+            int g;
+            if (i < 16)
+            {
+                f = (b & c) | (~b & d);
+                g = i;
+            }
+            else if (i < 32)
+            {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) & 15;
+            }
+            else if (i < 48)
+            {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) & 15;
+            }
+            else
+            {
+                f = c ^ (b | ~d);
+                g = (7 * i) & 15;
+            }
+
+            uint32_t temp = d;
+            d = c;
+            c = b;
+            b = b + rotateLeft(a + f + constants[i] + words[g], shifts[i]);
+            a = temp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+
+    void Md5::update(const uint8_t *data, size_t size)
+    {
+        size_t used = length % 64;
+        length += size;
+
+        // Complete the pending block first
+        if (used > 0)
+        {
+            size_t toCopy = std::min(size, 64 - used);
+            memcpy(pending + used, data, toCopy);
+            data += toCopy;
+            size -= toCopy;
+            if (used + toCopy < 64)
+            {
+                return;
+            }
+            transform(pending);
+        }
+
+        while (size >= 64)
+        {
+            transform(data);
+            data += 64;
+            size -= 64;
+        }
+
+        memcpy(pending, data, size);
+    }
+
+    // The digest is calculated over a copy, so the stream can continue after getting it
+    std::string Md5::getDigest()
+    {
+        Md5 finished = *this;
+
+        uint8_t padding[72] = {0x80};
+        size_t paddingSize = (length % 64 < 56) ? 56 - length % 64 : 120 - length % 64;
+        uint64_t bits = length * 8;
+        for (int i = 0; i < 8; i++)
+        {
+            padding[paddingSize + i] = (uint8_t)(bits >> (8 * i));
+        }
+        finished.update(padding, paddingSize + 8);
+
+        uint8_t digest[16];
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                digest[i * 4 + j] = (uint8_t)(finished.state[i] >> (8 * j));
+            }
+        }
+
+        return toHex(digest, 16);
+    }
+
+    //
+    // SHA-1 (RFC 3174)
+    //
+    Sha1::Sha1()
+    {
+        state[0] = 0x67452301;
+        state[1] = 0xEFCDAB89;
+        state[2] = 0x98BADCFE;
+        state[3] = 0x10325476;
+        state[4] = 0xC3D2E1F0;
+    }
+
+    void Sha1::transform(const uint8_t *block)
+    {
+        uint32_t words[80];
+        for (int i = 0; i < 16; i++)
+        {
+            words[i] = readBE32(block + i * 4);
+        }
+        for (int i = 16; i < 80; i++)
+        {
+            words[i] = rotateLeft(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f;
+            uint32_t k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t temp = rotateLeft(a, 5) + f + e + k + words[i];
+            e = d;
+            d = c;
+            c = rotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+
+    void Sha1::update(const uint8_t *data, size_t size)
+    {
+        size_t used = length % 64;
+        length += size;
+
+        // Complete the pending block first
+        if (used > 0)
+        {
+            size_t toCopy = std::min(size, 64 - used);
+            memcpy(pending + used, data, toCopy);
+            data += toCopy;
+            size -= toCopy;
+            if (used + toCopy < 64)
+            {
+                return;
+            }
+            transform(pending);
+        }
+
+        while (size >= 64)
+        {
+            transform(data);
+            data += 64;
+            size -= 64;
+        }
+
+        memcpy(pending, data, size);
+    }
+
+    // The digest is calculated over a copy, so the stream can continue after getting it
+    std::string Sha1::getDigest()
+    {
+        Sha1 finished = *this;
+
+        uint8_t padding[72] = {0x80};
+        size_t paddingSize = (length % 64 < 56) ? 56 - length % 64 : 120 - length % 64;
+        uint64_t bits = length * 8;
+        for (int i = 0; i < 8; i++)
+        {
+            padding[paddingSize + i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        finished.update(padding, paddingSize + 8);
+
+        uint8_t digest[20];
+        for (int i = 0; i < 5; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                digest[i * 4 + j] = (uint8_t)(finished.state[i] >> (24 - 8 * j));
+            }
+        }
+
+        return toHex(digest, 20);
+    }
+
+    //
+    // Stream hasher
+    //
+    StreamHasher::StreamHasher(unsigned int threads, bool overwriteInvalidates) : overwriteInvalidates(overwriteInvalidates)
+    {
+        // The digests are sequential, so more workers than digests are not useful
+        workersCount = threads > 1 ? std::min(threads, hashAlgorithms) : 0;
+
+        queues.resize(workersCount);
+        for (unsigned int i = 0; i < workersCount; i++)
+        {
+            workers.emplace_back(&StreamHasher::workerLoop, this, i);
+        }
+    }
+
+    // Hash the pending data and stop the workers
+    StreamHasher::~StreamHasher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void StreamHasher::hashData(unsigned int algorithm, const uint8_t *data, size_t size)
+    {
+        switch (algorithm)
+        {
+        case 0:
+            crc32.update(data, size);
+            break;
+
+        case 1:
+            md5.update(data, size);
+            break;
+
+        case 2:
+            sha1.update(data, size);
+            break;
+        }
+    }
+
+    // Add the data readed or writen at the position to the hashes
+    void StreamHasher::update(unsigned long long position, const char *data, unsigned long long size)
+    {
+        if (!complete || size == 0)
+        {
+            return;
+        }
+
+        // There is a gap between the hashed data and the new data
+        if (position > hashedSize)
+        {
+            complete = false;
+            return;
+        }
+
+        // The data was already hashed. In the reader it is just readed again, but in the writer the file is changed.
+        if (position < hashedSize)
+        {
+            if (overwriteInvalidates)
+            {
+                complete = false;
+                return;
+            }
+
+            unsigned long long skip = hashedSize - position;
+            if (skip >= size)
+            {
+                return;
+            }
+            data += skip;
+            size -= skip;
+        }
+
+        hashedSize += size;
+
+        // Without workers the data is hashed in the caller thread
+        if (workersCount == 0)
+        {
+            for (unsigned int i = 0; i < hashAlgorithms; i++)
+            {
+                hashData(i, (const uint8_t *)data, size);
+            }
+            return;
+        }
+
+        // The caller buffer can be reused after return, so the workers use a copy of the data
+        auto chunk = std::make_shared<std::vector<char>>(data, data + size);
+        unsigned long long chunkBytes = size * workersCount;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            doneCondition.wait(lock, [this, chunkBytes]
+                               { return queuedBytes == 0 || queuedBytes + chunkBytes <= HASH_QUEUE_LIMIT; });
+
+            for (auto &queue : queues)
+            {
+                queue.push_back(chunk);
+            }
+            queuedBytes += chunkBytes;
+        }
+        queueCondition.notify_all();
+    }
+
+    // Wait for the pending data and return the hashes in JSON format
+    std::string StreamHasher::getResults()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        doneCondition.wait(lock, [this]
+                           { return queuedBytes == 0; });
+
+        nlohmann::ordered_json results;
+        results["size"] = hashedSize;
+        results["complete"] = complete;
+        results["crc32"] = crc32.getDigest();
+        results["md5"] = md5.getDigest();
+        results["sha1"] = sha1.getDigest();
+
+        return results.dump();
+    }
+
+    void StreamHasher::workerLoop(unsigned int worker)
+    {
+        auto &queue = queues[worker];
+
+        while (true)
+        {
+            std::shared_ptr<std::vector<char>> chunk;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this, &queue]
+                                    { return stopping || !queue.empty(); });
+
+                if (queue.empty())
+                {
+                    // Stop requested and nothing pending
+                    return;
+                }
+
+                chunk = queue.front();
+            }
+
+            // Every worker calculates the digests with its index modulo the workers count
+            for (unsigned int i = worker; i < hashAlgorithms; i += workersCount)
+            {
+                hashData(i, (const uint8_t *)chunk->data(), chunk->size());
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                queue.pop_front();
+                queuedBytes -= chunk->size();
+            }
+            doneCondition.notify_all();
+        }
+    }
+}
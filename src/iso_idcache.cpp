@@ -0,0 +1,510 @@
+#include "iso.h"
+
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#endif
+
+// Persistent game ID cache
+//
+// The cache is a JSON file with the data detected for every image, indexed by the image path, size,
+// modification time and a hash of the sector 16, so the images rewritten in place are detected too.
+// The images without an ID are stored too, so they are not scanned again.
+// Every process keeps a copy in memory which is reloaded only when the file changes. The new entries are
+// added to the memory copy and writen in batches, so indexing a library doesn't rewrite the file for every
+// image. The writes are serialized between processes with a lock file, and the new file is renamed over
+// the old one, so the readers never see a partial file.
+//
+namespace PopstationmdgPlugin
+{
+    // The used entries are only rewritten to update its last use time after this time (seconds)
+    static const unsigned long long lastUsedRefreshTime = 86400;
+
+    // Exclusive lock between processes, held while the object exists
+    class CacheFileLock
+    {
+    public:
+        CacheFileLock(const std::string &path)
+        {
+#ifdef _WIN32
+            lockHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                     NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (lockHandle != INVALID_HANDLE_VALUE)
+            {
+                OVERLAPPED overlapped = {};
+                locked = LockFileEx(lockHandle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+            }
+#else
+            lockFile = nativeOpenFile(path.c_str(), O_WRONLY | O_CREAT | O_APPEND);
+            if (lockFile != nullptr)
+            {
+                locked = flock(fileno(lockFile), LOCK_EX) == 0;
+            }
+#endif
+        }
+
+        ~CacheFileLock()
+        {
+#ifdef _WIN32
+            if (lockHandle != INVALID_HANDLE_VALUE)
+            {
+                if (locked)
+                {
+                    OVERLAPPED overlapped = {};
+                    UnlockFileEx(lockHandle, 0, 1, 0, &overlapped);
+                }
+                CloseHandle(lockHandle);
+            }
+#else
+            if (lockFile != nullptr)
+            {
+                if (locked)
+                {
+                    flock(fileno(lockFile), LOCK_UN);
+                }
+                fclose(lockFile);
+            }
+#endif
+        }
+
+        bool isLocked()
+        {
+            return locked;
+        }
+
+    protected:
+        bool locked = false;
+#ifdef _WIN32
+        HANDLE lockHandle = INVALID_HANDLE_VALUE;
+#else
+        FILE *lockFile = nullptr;
+#endif
+    };
+
+    // Write the entries pending when the process finishes. Nothing can be thrown from here, because the
+    // destructor runs at the process exit and an exception would abort the host.
+    GameIDCache::~GameIDCache()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    GameIDCache &GameIDCache::getInstance()
+    {
+        static GameIDCache instance;
+        return instance;
+    }
+
+    // Default cache location in the user cache folder
+    std::string GameIDCache::getDefaultPath()
+    {
+        std::filesystem::path folder;
+
+#ifdef _WIN32
+        const char *localAppData = getenv("LOCALAPPDATA");
+        if (localAppData == nullptr)
+        {
+            return std::string();
+        }
+        folder = localAppData;
+#else
+        const char *cacheHome = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if (cacheHome != nullptr && cacheHome[0] != 0)
+        {
+            folder = cacheHome;
+        }
+        else if (home != nullptr)
+        {
+            folder = std::filesystem::path(home) / ".cache";
+        }
+        else
+        {
+            return std::string();
+        }
+#endif
+
+        return (folder / "popstationmdg" / "iso_id_cache.json").string();
+    }
+
+    // Get the key which identifies the file: absolute path, size, modification time and content hash.
+    // The size and the time are taken from the status of the opened file. The paths are not always valid UTF-8
+    // (Latin-1 or Shift-JIS names), so the non ASCII bytes are escaped to store the key in the JSON file.
+    std::string GameIDCache::getFileKey(const char *filename, const FileIdentity &identity, uint64_t contentHash)
+    {
+        std::error_code error;
+        std::filesystem::path path = std::filesystem::absolute(filename, error);
+        if (error)
+        {
+            return std::string();
+        }
+
+        static const char hexDigits[] = "0123456789ABCDEF";
+        std::string key;
+        for (unsigned char c : path.string())
+        {
+            if (c < 0x20 || c >= 0x80 || c == '%')
+            {
+                key += '%';
+                key += hexDigits[c >> 4];
+                key += hexDigits[c & 0x0F];
+            }
+            else
+            {
+                key += (char)c;
+            }
+        }
+
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)contentHash);
+
+        return key + "|" + std::to_string(identity.size) + "|" + std::to_string(identity.modified) + "|" + hash;
+    }
+
+    // Search the key in the cache. The cache file is reloaded if it was modified by other process.
+    bool GameIDCache::lookup(const std::string &cachePath, const std::string &key, GameIDCacheEntry &entry)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+
+            reload(cachePath, false);
+
+            auto found = entries.find(key);
+            if (found == entries.end())
+            {
+                return false;
+            }
+            entry = found->second;
+        }
+
+        // Keep the last use time updated for the LRU eviction
+        if ((unsigned long long)time(nullptr) - entry.lastUsed > lastUsedRefreshTime)
+        {
+            store(cachePath, 0, key, entry);
+        }
+
+        return true;
+    }
+
+    // Add or update an entry in the cache. A maxEntries of 0 keeps the current cache size.
+    // The entry is available at once in this process, and it is writen to the file with the next batch.
+    bool GameIDCache::store(const std::string &cachePath, unsigned long maxEntries, const std::string &key, GameIDCacheEntry entry)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        // The batches are writen to a single file
+        if (!pendingEntries.empty() && pendingPath != cachePath)
+        {
+            flushPending();
+        }
+
+        unsigned long long now = time(nullptr);
+        if (pendingEntries.empty())
+        {
+            pendingPath = cachePath;
+            pendingSince = now;
+        }
+        if (maxEntries > 0)
+        {
+            pendingMaxEntries = maxEntries;
+        }
+
+        entry.lastUsed = now;
+        entries[key] = entry;
+        pendingEntries[key] = entry;
+
+        if (pendingEntries.size() >= ID_CACHE_FLUSH_ENTRIES || now - pendingSince >= ID_CACHE_FLUSH_TIME)
+        {
+            return flushPending();
+        }
+
+        return true;
+    }
+
+    bool GameIDCache::flush()
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        return flushPending();
+    }
+
+    // Merge the pending entries with the cache file. The caller must hold the cache mutex.
+    bool GameIDCache::flushPending()
+    {
+        if (pendingEntries.empty())
+        {
+            return true;
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(pendingPath).parent_path(), error);
+
+        // The entries are discarded if the file can't be writen, so it is not tried again in every store
+        CacheFileLock fileLock(pendingPath + ".lock");
+        if (!fileLock.isLocked())
+        {
+            spdlog::warn("ISO: The ID cache file can't be locked: {}", pendingPath);
+            pendingEntries.clear();
+            return false;
+        }
+
+        // Merge with the changes done by other processes. The pending entries are added again after the reload.
+        bool saved = false;
+        try
+        {
+            reload(pendingPath, true);
+            saved = save(pendingPath, pendingMaxEntries);
+        }
+        catch (std::exception &e)
+        {
+            spdlog::warn("ISO: The ID cache file can't be written: {}", e.what());
+        }
+        pendingEntries.clear();
+
+        return saved;
+    }
+
+    // Load the cache file if it was not loaded or it was modified
+    bool GameIDCache::reload(const std::string &cachePath, bool force)
+    {
+        // The file is not checked in every lookup
+        unsigned long long now = time(nullptr);
+        if (!force && loadedPath == cachePath && now - loadedCheck < ID_CACHE_RELOAD_TIME)
+        {
+            return true;
+        }
+        loadedCheck = now;
+
+        std::error_code error;
+        long long fileTime = std::filesystem::last_write_time(cachePath, error).time_since_epoch().count();
+        unsigned long long fileSize = error ? 0 : std::filesystem::file_size(cachePath, error);
+
+        if (error)
+        {
+            // There is no cache file yet
+            if (loadedPath != cachePath)
+            {
+                entries.clear();
+                loadedPath = cachePath;
+                loadedTime = 0;
+                loadedSize = 0;
+                restorePending();
+            }
+            return false;
+        }
+
+        if (!force && loadedPath == cachePath && loadedTime == fileTime && loadedSize == fileSize)
+        {
+            return true;
+        }
+
+        entries.clear();
+        loadedPath = cachePath;
+        loadedTime = fileTime;
+        loadedSize = fileSize;
+
+        std::ifstream cacheFile(cachePath);
+        json cache = json::parse(cacheFile, nullptr, false);
+        if (cache.is_discarded() || !cache.contains("entries") || !cache["entries"].is_object())
+        {
+            spdlog::warn("ISO: The ID cache file is not valid and will be replaced: {}", cachePath);
+            restorePending();
+            return false;
+        }
+
+        for (auto &item : cache["entries"].items())
+        {
+            GameIDCacheEntry entry;
+            auto &value = item.value();
+            entry.gameID = value.value("id", "");
+            entry.sectorSize = value.value("sector_size", 0u);
+            entry.sectorMode = value.value("sector_mode", 0u);
+            entry.diskSize = value.value("disk_size", 0ull);
+            entry.lastUsed = value.value("last_used", 0ull);
+            entries[item.key()] = entry;
+        }
+
+        restorePending();
+        return true;
+    }
+
+    // Add the entries not writen yet to the loaded ones
+    void GameIDCache::restorePending()
+    {
+        if (pendingPath != loadedPath)
+        {
+            return;
+        }
+
+        for (auto &entry : pendingEntries)
+        {
+            entries[entry.first] = entry.second;
+        }
+    }
+
+    // Write the cache to a temporary file and replace the old one. The caller must hold the file lock.
+    bool GameIDCache::save(const std::string &cachePath, unsigned long maxEntries)
+    {
+        // Remove the least recently used entries
+        if (maxEntries > 0 && entries.size() > maxEntries)
+        {
+            std::vector<std::pair<unsigned long long, std::string>> byUse;
+            for (auto &entry : entries)
+            {
+                byUse.emplace_back(entry.second.lastUsed, entry.first);
+            }
+
+            size_t toRemove = entries.size() - maxEntries;
+            std::nth_element(byUse.begin(), byUse.begin() + toRemove, byUse.end());
+            for (size_t i = 0; i < toRemove; i++)
+            {
+                entries.erase(byUse[i].second);
+            }
+        }
+
+        json cache;
+        cache["version"] = 1;
+        cache["entries"] = json::object();
+        for (auto &entry : entries)
+        {
+            cache["entries"][entry.first] = {
+                {"id", entry.second.gameID},
+                {"sector_size", entry.second.sectorSize},
+                {"sector_mode", entry.second.sectorMode},
+                {"disk_size", entry.second.diskSize},
+                {"last_used", entry.second.lastUsed}};
+        }
+
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream tempFile(tempPath, std::ios::trunc);
+            tempFile << cache.dump(-1, ' ', false, json::error_handler_t::replace);
+            if (!tempFile)
+            {
+                spdlog::warn("ISO: The ID cache file can't be written: {}", tempPath);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, cachePath, error);
+        if (error)
+        {
+            spdlog::warn("ISO: The ID cache file can't be replaced: {}", error.message());
+            return false;
+        }
+
+        loadedTime = std::filesystem::last_write_time(cachePath, error).time_since_epoch().count();
+        loadedSize = std::filesystem::file_size(cachePath, error);
+
+        return true;
+    }
+
+    // Hash of the sector 16, the Primary Volume Descriptor of the ISO9660 images, which has the volume name, dates
+    // and sizes. The layout is not known yet when the cache is checked, so the bytes where the sector 16 is in any of
+    // the layouts are hashed, which is a single read. FNV-1a over 64 bits words.
+    uint64_t IsoReader::getContentHash()
+    {
+        char data[RAW_SECTOR_SIZE * 17 - MODE1_SECTOR_SIZE * 16];
+        unsigned long long used = readAt((unsigned long long)MODE1_SECTOR_SIZE * 16, data, sizeof(data));
+
+        uint64_t hash = 14695981039346656037ull;
+        unsigned long long i = 0;
+        for (; i + sizeof(uint64_t) <= used; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        for (; i < used; i++)
+        {
+            hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    // Search the opened file in the ID cache and restore the game ID and sector layout if found. The image is identified
+    // by its path, size, modification time and the hash of the sector 16, so only that sector is readed.
+    bool IsoReader::lookupIDCache(const char *filename)
+    {
+        idCacheKey.clear();
+        idNotFound = false;
+
+        if (!idCacheEnabled)
+        {
+            return false;
+        }
+
+        if (idCachePath.empty())
+        {
+            idCachePath = GameIDCache::getDefaultPath();
+            if (idCachePath.empty())
+            {
+                return false;
+            }
+        }
+
+        idCacheKey = GameIDCache::getFileKey(filename, inputIdentity, getContentHash());
+        if (idCacheKey.empty())
+        {
+            return false;
+        }
+
+        // An empty ID means that the image has no ID
+        GameIDCacheEntry entry;
+        if (!GameIDCache::getInstance().lookup(idCachePath, idCacheKey, entry) || (entry.gameID.size() != 9 && !entry.gameID.empty()) ||
+            entry.diskSize != diskSize)
+        {
+            return false;
+        }
+
+        if (entry.gameID.empty())
+        {
+            SPDLOG_DEBUG("ISO: The image was found in the ID cache without ID");
+            idNotFound = true;
+        }
+        else
+        {
+            SPDLOG_DEBUG("ISO: The image was found in the ID cache: {}", entry.gameID);
+            gameID = new char[10];
+            memset(gameID, 0, 10);
+            memcpy(gameID, entry.gameID.c_str(), 9);
+        }
+        sectorSize = entry.sectorSize;
+        sectorMode = entry.sectorMode;
+
+        return true;
+    }
+
+    // Store the detected data of the opened file in the ID cache. The images without ID are stored with an empty ID.
+    bool IsoReader::storeIDCache()
+    {
+        if (idCacheKey.empty())
+        {
+            return false;
+        }
+
+        GameIDCacheEntry entry;
+        entry.gameID = gameID != nullptr ? gameID : "";
+        entry.sectorSize = sectorSize;
+        entry.sectorMode = sectorMode;
+        entry.diskSize = diskSize;
+
+        return GameIDCache::getInstance().store(idCachePath, idCacheSize, idCacheKey, entry);
+    }
+}
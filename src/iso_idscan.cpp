@@ -0,0 +1,239 @@
+#include "iso.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Scan the disk data searching the known game ID codes
+//
+// Used when the disk doesn't have a standard ISO9660 file system. The candidates are located using SIMD
+// comparisons with the prefixes first chars, and then the prefix is checked against a hash table.
+//
+namespace PopstationmdgPlugin
+{
+    const std::vector<std::string> defaultIDPrefixes = {
+        // USA Codes
+        "SCUS", "SLUS", "SPUS", "PUPX",
+        // EUR Codes
+        "SCES", "SLES", "SCED", "SLED", "PEPX",
+        // Japan Codes
+        "SCPS", "SCPM", "SLPS", "SLPM", "SIPS", "ESPM", "SLKA", "PAPX", "PCPX", "PCPD", "PTPX", "PBPX", "CPCS", "SCAJ", "SCZS"};
+
+    // Size of the data readed in every step of the disk scan
+    static const unsigned long long scanChunkSize = 1048576;
+
+    // The code is XXXX_XXX.XX, so 11 bytes are required to check a candidate
+    static const size_t idLength = 11;
+
+    static inline uint32_t idPrefixHash(uint32_t prefix)
+    {
+        return (prefix * 2654435761u) >> 26;
+    }
+
+    static inline unsigned int lowestBit(unsigned int mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    static inline bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Set the prefixes used to detect the game ID. Only the 4 chars prefixes are used.
+    void IsoReader::setIDPrefixes(const std::vector<std::string> &prefixes)
+    {
+        memset(idPrefixTable, 0, sizeof(idPrefixTable));
+        memset(idPrefixFirstCharsTable, 0, sizeof(idPrefixFirstCharsTable));
+        idPrefixFirstChars.clear();
+
+        unsigned int added = 0;
+        for (auto &prefix : prefixes)
+        {
+            if (prefix.size() != 4)
+            {
+                spdlog::warn("ISO: Ignoring the invalid game ID prefix \"{}\"", prefix);
+                continue;
+            }
+
+            // Keep the table half empty to have short probe sequences
+            if (added == sizeof(idPrefixTable) / sizeof(idPrefixTable[0]) / 2)
+            {
+                spdlog::warn("ISO: Too many game ID prefixes. Ignoring \"{}\" and the rest", prefix);
+                break;
+            }
+
+            uint32_t value;
+            memcpy(&value, prefix.c_str(), 4);
+
+            uint32_t slot = idPrefixHash(value);
+            while (idPrefixTable[slot] != 0 && idPrefixTable[slot] != value)
+            {
+                slot = (slot + 1) & 63;
+            }
+            if (idPrefixTable[slot] == value)
+            {
+                continue;
+            }
+            idPrefixTable[slot] = value;
+            added++;
+
+            unsigned char first = prefix[0];
+            if (!idPrefixFirstCharsTable[first])
+            {
+                idPrefixFirstCharsTable[first] = true;
+                idPrefixFirstChars.push_back(prefix[0]);
+            }
+        }
+    }
+
+    // Check if there is a valid game ID at the provided position and store it in the gameID member.
+    // The data must have at least 11 bytes available.
+    bool IsoReader::checkGameID(const char *data)
+    {
+        uint32_t value;
+        memcpy(&value, data, 4);
+
+        uint32_t slot = idPrefixHash(value);
+        while (idPrefixTable[slot] != value)
+        {
+            if (idPrefixTable[slot] == 0)
+            {
+                return false;
+            }
+            slot = (slot + 1) & 63;
+        }
+
+        // The code numbers must be digits. This avoids false positives with other strings using the same prefixes.
+        if (!isDigit(data[5]) || !isDigit(data[6]) || !isDigit(data[7]) || !isDigit(data[9]) || !isDigit(data[10]))
+        {
+            return false;
+        }
+
+        // Looks like we found it
+        gameID = new char[10];
+        std::memset(gameID, 0, 10);
+
+        // Set the gameID. Normally in disk is XXXX_XXX.XX, so we will get only the code
+        memcpy(gameID, data, 4);
+        memcpy(gameID + 4, data + 5, 3);
+        memcpy(gameID + 7, data + 9, 2);
+
+        return true;
+    }
+
+    // Search the game ID in the provided data. The gameID member is set if found.
+    bool IsoReader::scanGameID(const char *data, size_t size)
+    {
+        if (size < idLength || idPrefixFirstChars.empty())
+        {
+            return false;
+        }
+
+        // Last position where a full code can start
+        size_t end = size - idLength + 1;
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        for (; i + 32 <= end; i += 32)
+        {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+            unsigned int mask = 0;
+            for (char first : idPrefixFirstChars)
+            {
+                mask |= (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(first)));
+            }
+
+            while (mask != 0)
+            {
+                if (checkGameID(data + i + lowestBit(mask)))
+                {
+                    return true;
+                }
+                mask &= mask - 1;
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        for (; i + 16 <= end; i += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+            unsigned int mask = 0;
+            for (char first : idPrefixFirstChars)
+            {
+                mask |= (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(first)));
+            }
+
+            while (mask != 0)
+            {
+                if (checkGameID(data + i + lowestBit(mask)))
+                {
+                    return true;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+
+        for (; i < end; i++)
+        {
+            if (idPrefixFirstCharsTable[(unsigned char)data[i]] && checkGameID(data + i))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Scan the whole disk searching the game ID. Returns false only if there was a read error.
+    bool IsoReader::scanDiskGameID()
+    {
+        // The mapped file can be scanned directly without any copy
+        if (mappedData != nullptr)
+        {
+            scanGameID(mappedData, diskSize);
+            return true;
+        }
+
+        std::vector<char> chunk(scanChunkSize);
+        unsigned long long position = 0;
+
+        while (position < diskRealSize)
+        {
+            // The positional read keeps the current file position
+            // Nothing readed before the end of the disk is a read error. The handle error state is not checked,
+            // because it can be set by an unrelated previous operation.
+            unsigned long long readed = readAt(position, chunk.data(), scanChunkSize);
+            if (readed == 0)
+            {
+                return false;
+            }
+
+            if (scanGameID(chunk.data(), readed))
+            {
+                return true;
+            }
+
+            // The last bytes are readed again with the next chunk, to not lose a code in the chunks boundary
+            if (readed < scanChunkSize)
+            {
+                break;
+            }
+            position += readed - (idLength - 1);
+        }
+
+        return true;
+    }
+}
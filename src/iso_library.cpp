@@ -0,0 +1,171 @@
+#include "iso.h"
+
+#include <cctype>
+#include <filesystem>
+
+// Library scan
+//
+// Index all the images of a folder tree in one call. Every image is opened in its own object by the pool
+// threads, and the results are writen to the output file as JSON lines as soon as every image is finished,
+// so the host can process them while the scan continues. Every thread reads only one image at once, so the
+// number of threads is also the number of images readed at the same time.
+//
+namespace PopstationmdgPlugin
+{
+    // Images which are included in the scan. The playlists are not included because their disks are scanned.
+    // The ZSO images are only included when the LZ4 support is built.
+    static bool isScannedImage(const std::filesystem::path &path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                       { return tolower(c); });
+
+#ifdef USE_LZ4
+        if (extension == ".zso")
+        {
+            return true;
+        }
+#endif
+
+        return extension == ".iso" || extension == ".cso";
+    }
+
+    // Open the image in the provided object and get its data
+    ordered_json IsoReader::scanLibraryImage(IsoReader &scanner, const std::string &path, unsigned long long size)
+    {
+        ordered_json result;
+        result["path"] = path;
+        result["size"] = size;
+
+        // The images are scanned one by one, so the disks of the sets are not opened together
+        scanner.multiDiskEnabled = false;
+        if (!scanner.open((char *)path.c_str(), PTReader, 9, 1))
+        {
+            result["error"] = scanner.last_error != nullptr ? scanner.last_error : "There was an error opening the file";
+            return result;
+        }
+
+        result["real_size"] = (unsigned long long)scanner.diskRealSize;
+        result["format"] = scanner.compressedImage != nullptr ? scanner.compressedImage->getFormatName() : "ISO";
+
+        char id[10];
+        if (scanner.getID(id, sizeof(id)))
+        {
+            result["id"] = std::string(id, strnlen(id, sizeof(id)));
+        }
+        else
+        {
+            result["id"] = nullptr;
+        }
+
+        unsigned int layoutSize = 0;
+        unsigned int layoutMode = 0;
+        scanner.getSectorLayout(layoutSize, layoutMode);
+        result["sector_size"] = layoutSize;
+        result["sector_mode"] = layoutMode;
+
+        scanner.close();
+        return result;
+    }
+
+    // Scan all the images inside the root folder and write a JSON line with the data of every image to the output file.
+    // The scanner objects use the settings of this object, so the ID cache is used and updated if enabled.
+    bool IsoReader::scanLibrary(const char *rootPath, unsigned int threads, const char *outputPath)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_directory(rootPath, error))
+        {
+            setLastError(std::string("The library folder doesn't exists: ") + rootPath);
+            return false;
+        }
+
+        std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+        if (!output.is_open())
+        {
+            setLastError(std::string("The scan output file can't be created: ") + outputPath);
+            return false;
+        }
+
+        std::string settings = currentSettings.dump();
+        std::mutex outputMutex;
+        unsigned long long scanned = 0;
+
+        // The images are added to the pool while the tree is walked, so the scan starts with the first image found.
+        // The size is taken from the folder entry, which already has the file status.
+        {
+            ThreadPool pool(std::clamp(threads, 1u, (unsigned int)SETTINGS_MAX_SCAN_THREADS));
+
+            auto iterator = std::filesystem::recursive_directory_iterator(rootPath, std::filesystem::directory_options::skip_permission_denied, error);
+            for (; !error && iterator != std::filesystem::recursive_directory_iterator(); iterator.increment(error))
+            {
+                const std::filesystem::directory_entry &entry = *iterator;
+                std::error_code entryError;
+                if (!entry.is_regular_file(entryError) || !isScannedImage(entry.path()))
+                {
+                    continue;
+                }
+
+                std::string path = entry.path().string();
+                unsigned long long size = entry.file_size(entryError);
+                scanned++;
+
+                pool.submit([path, size, &settings, &output, &outputMutex]
+                            {
+                    // The paths are not always valid UTF-8 (Latin-1 or Shift-JIS names), so the invalid bytes are replaced
+                    // in the JSON line. An exception in one image is reported in its line and the scan continues.
+                    std::string line;
+                    try
+                    {
+                        IsoReader scanner;
+                        scanner.setSettings(settings.c_str(), settings.size());
+                        line = scanLibraryImage(scanner, path, size).dump(-1, ' ', false, ordered_json::error_handler_t::replace);
+                    }
+                    catch (std::exception &e)
+                    {
+                        ordered_json result;
+                        result["path"] = path;
+                        result["size"] = size;
+                        result["error"] = std::string("There was an error scanning the file: ") + e.what();
+                        line = result.dump(-1, ' ', false, ordered_json::error_handler_t::replace);
+                    }
+
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    output << line << "\n";
+                    output.flush(); });
+            }
+
+            pool.wait();
+        }
+
+        // Write the IDs found by the scan to the cache file now, instead of waiting to the end of the process
+        if (idCacheEnabled)
+        {
+            GameIDCache::getInstance().flush();
+        }
+
+        if (error)
+        {
+            setLastError(std::string("There was an error reading the library folder: ") + error.message());
+            return false;
+        }
+
+        if (!output)
+        {
+            setLastError(std::string("There was an error writing the scan output file: ") + outputPath);
+            return false;
+        }
+
+        SPDLOG_DEBUG("ISO: {} images scanned in {}", scanned, rootPath);
+        return true;
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT scanLibrary(void *handler, const char *rootPath, unsigned int threads, const char *outputPath)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->scanLibrary(rootPath, threads, outputPath);
+        }
+    }
+}
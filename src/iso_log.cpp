@@ -0,0 +1,130 @@
+#include "iso.h"
+
+#include "spdlog/async.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+namespace PopstationmdgPlugin
+{
+    // The logger is shared by all the plugin objects, so it is configured only once per process
+    static std::once_flag defaultLoggingFlag;
+    static std::mutex loggingMutex;
+
+    // Queue size and threads of the asynchronous logger
+    static const size_t asyncLogQueueSize = 8192;
+    static const size_t asyncLogThreads = 1;
+
+    static const char *defaultLogPattern = "[%Y-%m-%d %H:%M:%S] [%l] [thread %t] %v";
+
+    // Apply the default configuration if the host didn't call initLogging before create the first object
+    void initDefaultLogging()
+    {
+        std::call_once(defaultLoggingFlag, []
+                       {
+            std::lock_guard<std::mutex> lock(loggingMutex);
+
+            spdlog::set_pattern(defaultLogPattern);
+            spdlog::flush_every(std::chrono::seconds(1));
+
+#ifdef DEBUG
+            spdlog::set_level(spdlog::level::debug);
+#endif
+
+            spdlog::info("Starting the ISO plugin"); });
+    }
+
+    extern "C"
+    {
+        //
+        // Configure the plugin log. The settings are a JSON object with the optional fields:
+        //   - level: trace, debug, info, warn, error, critical or off
+        //   - file: log file path. The log is printed to the console if not set.
+        //   - async: write the log from a background thread
+        //   - pattern: spdlog pattern of the messages
+        // The messages below the SPDLOG_ACTIVE_LEVEL are removed at compile time and can't be enabled here.
+        //
+        bool SHARED_EXPORT initLogging(const char *settingsData, unsigned long settingsSize)
+        {
+            // The default configuration is not applied after this
+            std::call_once(defaultLoggingFlag, [] {});
+
+            json settings;
+            try
+            {
+                settings = json::parse(settingsData, settingsData + settingsSize);
+            }
+            catch (json::parse_error &e)
+            {
+                spdlog::error("ISO: The log settings are not valid: {}", e.what());
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(loggingMutex);
+
+            try
+            {
+                bool async = settings.value("async", false);
+                std::string file = settings.value("file", std::string());
+                std::shared_ptr<spdlog::logger> logger;
+
+                // The old logger is dropped first because the registry doesn't allow duplicated names
+                spdlog::drop("iso");
+
+                if (async)
+                {
+                    if (spdlog::thread_pool() == nullptr)
+                    {
+                        spdlog::init_thread_pool(asyncLogQueueSize, asyncLogThreads);
+                    }
+
+                    if (file.empty())
+                    {
+                        logger = spdlog::stdout_color_mt<spdlog::async_factory>("iso");
+                    }
+                    else
+                    {
+                        logger = spdlog::basic_logger_mt<spdlog::async_factory>("iso", file);
+                    }
+                }
+                else if (file.empty())
+                {
+                    logger = spdlog::stdout_color_mt("iso");
+                }
+                else
+                {
+                    logger = spdlog::basic_logger_mt("iso", file);
+                }
+
+                logger->set_pattern(settings.value("pattern", std::string(defaultLogPattern)));
+                logger->set_level(spdlog::level::from_str(settings.value("level", std::string("info"))));
+                logger->flush_on(spdlog::level::err);
+
+                spdlog::set_default_logger(logger);
+                spdlog::flush_every(std::chrono::seconds(1));
+            }
+            catch (std::exception &e)
+            {
+                spdlog::error("ISO: There was an error configuring the log: {}", e.what());
+                return false;
+            }
+
+            spdlog::info("Starting the ISO plugin");
+            return true;
+        }
+
+        //
+        // Flush the pending messages and stop the log threads. Must be called before unload the library
+        // if the asynchronous log was enabled. The messages logged after this are printed to the console.
+        //
+        void SHARED_EXPORT shutdownLogging()
+        {
+            std::lock_guard<std::mutex> lock(loggingMutex);
+
+            spdlog::shutdown();
+
+            // The shutdown removes the default logger too
+            auto logger = std::make_shared<spdlog::logger>("", std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+            logger->set_pattern(defaultLogPattern);
+            spdlog::set_default_logger(logger);
+        }
+    }
+}
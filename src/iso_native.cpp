@@ -0,0 +1,79 @@
+#include "iso.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace PopstationmdgPlugin
+{
+    int nativeOpenFd(const char *filename, int flags)
+    {
+        int fd;
+        do
+        {
+            fd = openat(AT_FDCWD, filename, flags | O_CLOEXEC, 0644);
+        } while (fd == -1 && errno == EINTR);
+
+        return fd;
+    }
+
+    // Don't replace this with ::close. The plugin exports a close(void *) function, which is the close symbol
+    // resolved inside the library, so ::close would call the plugin function with the fd as the handler.
+    // Linux closes the fd with the syscall. The other systems wrap it in a FILE object, because fclose closes
+    // the fd internally without the close symbol.
+    void nativeCloseFd(int fd)
+    {
+        if (fd == -1)
+        {
+            return;
+        }
+
+#ifdef __linux__
+        syscall(SYS_close, fd);
+#else
+        int flags = fcntl(fd, F_GETFL);
+        const char *mode = (flags & O_ACCMODE) == O_RDONLY ? "rb" : (flags & O_ACCMODE) == O_WRONLY ? "wb" : "r+b";
+        FILE *file = fdopen(fd, mode);
+        if (file != nullptr)
+        {
+            fclose(file);
+        }
+#endif
+    }
+
+    FILE *nativeOpenFile(const char *filename, int flags)
+    {
+        int fd = nativeOpenFd(filename, flags);
+        if (fd == -1)
+        {
+            return nullptr;
+        }
+
+        const char *mode;
+        switch (flags & O_ACCMODE)
+        {
+        case O_RDWR:
+            mode = (flags & O_APPEND) ? "a+b" : "r+b";
+            break;
+        case O_WRONLY:
+            mode = (flags & O_APPEND) ? "ab" : "wb";
+            break;
+        default:
+            mode = "rb";
+            break;
+        }
+
+        FILE *file = fdopen(fd, mode);
+        if (file == nullptr)
+        {
+            int error = errno;
+            nativeCloseFd(fd);
+            errno = error;
+        }
+
+        return file;
+    }
+}
+#endif
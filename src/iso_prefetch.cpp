@@ -0,0 +1,168 @@
+#include "iso.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Prefetch
+//
+// The reads of the host are classified as sequential when they start where the previous one ended. Every
+// sequential read doubles the read-ahead window, and the random reads halve it, so a host which streams
+// the whole disk gets the data requested to the system in advance, and a host which jumps around doesn't
+// waste disk bandwidth. The host can also announce the regions that it will read next through hintRanges.
+// On Windows only the memory mapped images can be requested in advance.
+//
+namespace PopstationmdgPlugin
+{
+#ifdef _WIN32
+    // PrefetchVirtualMemory is only available since Windows 8, so it is loaded at runtime.
+    // The range has the layout of WIN32_MEMORY_RANGE_ENTRY.
+    struct PrefetchMemoryRange
+    {
+        PVOID address;
+        SIZE_T size;
+    };
+    typedef BOOL(WINAPI *PrefetchVirtualMemoryFunc)(HANDLE process, ULONG_PTR count, PrefetchMemoryRange *ranges, ULONG flags);
+
+    static PrefetchVirtualMemoryFunc getPrefetchVirtualMemory()
+    {
+        static PrefetchVirtualMemoryFunc function = (PrefetchVirtualMemoryFunc)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+        return function;
+    }
+#endif
+
+    // Update the read-ahead window with a read done by the host, and request the next data if required.
+    // The data is requested again only when less than half of the window is pending, to not do a system call every read.
+    void IsoReader::updatePrefetch(unsigned long long position, unsigned long long size)
+    {
+        bool sequential = position == lastReadEnd;
+        lastReadEnd = position + size;
+
+        if (!sequential)
+        {
+            prefetchWindow /= 2;
+            if (prefetchWindow < PREFETCH_MIN_WINDOW)
+            {
+                prefetchWindow = 0;
+            }
+            prefetchedUntil = 0;
+            return;
+        }
+
+        prefetchWindow = prefetchWindow == 0 ? PREFETCH_MIN_WINDOW : std::min(prefetchWindow * 2, (unsigned long long)PREFETCH_MAX_WINDOW);
+
+        unsigned long long windowEnd = std::min(lastReadEnd + prefetchWindow, (unsigned long long)diskRealSize);
+        unsigned long long start = std::max(prefetchedUntil, lastReadEnd);
+        if (prefetchedUntil >= lastReadEnd + prefetchWindow / 2 || start >= windowEnd)
+        {
+            return;
+        }
+
+        adviseWillNeed(start, windowEnd - start);
+        prefetchedUntil = windowEnd;
+    }
+
+    // Tell the system that the region will be readed soon, so it is readed in the background.
+    // Returns false if the current mode doesn't support it.
+    bool IsoReader::adviseWillNeed(unsigned long long position, unsigned long long size)
+    {
+        // The compressed images decompress the next blocks by themselves, and the direct I/O doesn't use the system cache
+        if (compressedImage != nullptr || directInput || size == 0)
+        {
+            return false;
+        }
+
+#ifdef _WIN32
+        // Windows has no read-ahead hint for the files readed through the handle. Without random_access they are opened
+        // with FILE_FLAG_SEQUENTIAL_SCAN, so the system reads ahead the sequential reads, but the hinted regions are not
+        // requested. The mapped files are requested with PrefetchVirtualMemory when available.
+        PrefetchVirtualMemoryFunc prefetchVirtualMemory = getPrefetchVirtualMemory();
+        if (mappedData == nullptr || prefetchVirtualMemory == nullptr)
+        {
+            return false;
+        }
+
+        if (statsEnabled)
+        {
+            stats.prefetchHints.fetch_add(1, std::memory_order_relaxed);
+            stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        PrefetchMemoryRange range = {mappedData + position, (SIZE_T)size};
+        return prefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0) != 0;
+#else
+        if (statsEnabled)
+        {
+            stats.prefetchHints.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (mappedData != nullptr)
+        {
+            // The address must be aligned to the page size
+            unsigned long long pageSize = (unsigned long long)sysconf(_SC_PAGESIZE);
+            unsigned long long offset = position % pageSize;
+            if (statsEnabled)
+            {
+                stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+            }
+            return madvise(mappedData + position - offset, size + offset, MADV_WILLNEED) == 0;
+        }
+
+        if (nativeInputFile == nullptr)
+        {
+            return false;
+        }
+
+        if (statsEnabled)
+        {
+            stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+        }
+#ifdef __APPLE__
+        struct radvisory advisory;
+        advisory.ra_offset = (off_t)position;
+        advisory.ra_count = (int)std::min(size, (unsigned long long)0x7FFFFFFF);
+        return fcntl(fileno((FILE *)nativeInputFile), F_RDADVISE, &advisory) != -1;
+#else
+        return posix_fadvise(fileno((FILE *)nativeInputFile), (off_t)position, (off_t)size, POSIX_FADV_WILLNEED) == 0;
+#endif
+#endif
+    }
+
+    // Request in advance the regions that the host will read next. On Windows the hints are only applied to the mapped images.
+    bool IsoReader::hintRanges(const ReadRange *ranges, unsigned int count)
+    {
+        if (nativeInputFile == nullptr)
+        {
+            // There is no opened file
+            setLastError(std::string("There is no input file opened"));
+            return false;
+        }
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (ranges[i].position < diskRealSize)
+            {
+                adviseWillNeed(ranges[i].position, std::min(ranges[i].size, (unsigned long long)(diskRealSize - ranges[i].position)));
+            }
+        }
+
+        return true;
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT hintRanges(void *handler, const ReadRange *ranges, unsigned int count)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->hintRanges(ranges, count);
+        }
+    }
+}
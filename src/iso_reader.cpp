@@ -1,19 +1,53 @@
 #include "iso.h"
 
+#include <cctype>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 // Get the disk ID
 //
-// MUST BE IMPROVED TO DETECT ALL THE CODES
+// The ID is taken from the SYSTEM.CNF boot line. Disks without a standard ISO9660 file system
+// are scanned searching the known codes.
 //
 namespace PopstationmdgPlugin
 {
+    // Little endian 32 bits value from the ISO9660 both-endian fields
+    static unsigned long readLE32(const char *data)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned long)bytes[3] << 24);
+    }
+
     bool IsoReader::getID(char *id, unsigned long long buffersize)
     {
+        LatencyTimer timer(statsEnabled ? &stats.getIDLatency : nullptr);
+        if (statsEnabled)
+        {
+            stats.getIDCalls.fetch_add(1, std::memory_order_relaxed);
+        }
+
         if (buffersize < 10)
         {
             setLastError(std::string("The output buffer size is too small"));
             return false;
         }
 
+        // The game ID of a multi-disk image is the ID of its first disk. Only that disk is scanned.
+        if (!diskReaders.empty())
+        {
+            return diskReaders[0]->getID(id, buffersize);
+        }
+
         if (gameID == nullptr)
         {
             // No input file
@@ -23,155 +57,172 @@ namespace PopstationmdgPlugin
                 return false;
             }
 
-            // Get current position
-            unsigned long long current_pos = tell();
-            // There was an error
-            if (!isOK())
+            if (!detectID())
             {
-                setLastError(std::string("There was an error getting the current file position."));
                 return false;
             }
 
-            // Go to the start of the file
-            if (!seek(0, PluginSeekMode_Begin))
+            // If nothing was found then return false
+            if (gameID == nullptr)
             {
-                setLastError(std::string("There was an error seeking to the start of the file."));
+                setLastError(std::string("No ID found."));
                 return false;
             }
+        }
+
+        strncpy_s(id, 10, gameID, 10);
+        return true;
+    }
 
-            // Reserve 200k of RAM to store the disk data
-            char *disk_data = (char *)std::malloc(204800);
+    // Search the ID of the disk if it was not searched yet. The disks without ID are not reported as an error,
+    // so the disks of a multi-disk image can be scanned in parallel. Returns false only if there was a read error.
+    bool IsoReader::detectID()
+    {
+        // The disk was already scanned, or it is stored in the ID cache without ID
+        if (gameID != nullptr || idNotFound)
+        {
+            return true;
+        }
 
-            if (disk_data == nullptr)
-            {
-                setLastError(std::string("There was an error allocating the required memory."));
-                return false;
-            }
+        // Try first with the file system, which only requires a few sector reads
+        if (findSystemCnfID())
+        {
+            SPDLOG_DEBUG("ISO: Game ID found in the SYSTEM.CNF file: {}", gameID);
+        }
+        // Scan the whole disk searching the known codes
+        else if (!scanDiskGameID())
+        {
+            return false;
+        }
+
+        // Remember it for the next time, also if nothing was found
+        idNotFound = gameID == nullptr;
+        storeIDCache();
+
+        return true;
+    }
+
+    // Locate the SYSTEM.CNF file using the ISO9660 file system and extract the ID from the boot line.
+    // Returns false if the disk doesn't have a standard file system or a valid boot line.
+    bool IsoReader::findSystemCnfID()
+    {
+        char sector[MODE1_SECTOR_SIZE];
+
+        // Primary Volume Descriptor
+        if (!readUserSector(16, sector) || sector[0] != 0x01 || memcmp(sector + 1, "CD001", 5) != 0)
+        {
+            return false;
+        }
 
-            // Read the first 200k of data into the new buffer
-            size_t readed = readData(disk_data, 204800);
-            if (!isOK())
+        // Root directory record
+        unsigned long rootLBA = readLE32(sector + 156 + 2);
+        unsigned long rootSize = readLE32(sector + 156 + 10);
+        unsigned long rootSectors = (rootSize + MODE1_SECTOR_SIZE - 1) / MODE1_SECTOR_SIZE;
+
+        unsigned long cnfLBA = 0;
+        unsigned long cnfSize = 0;
+        for (unsigned long i = 0; i < rootSectors && cnfSize == 0; i++)
+        {
+            if (!readUserSector(rootLBA + i, sector))
             {
-                std::free((void *)disk_data);
                 return false;
             }
 
-            // return to the last position
-            if (!seek(current_pos, PluginSeekMode_Begin))
+            // Directory records doesn't cross the sector boundaries. A zero length means the end of the sector records.
+            unsigned int position = 0;
+            while (position + 33 < MODE1_SECTOR_SIZE && sector[position] != 0)
             {
-                setLastError(std::string("There was an error seeking to the original file position."));
-                std::free((void *)disk_data);
-                return false;
-            }
+                unsigned int recordLength = (unsigned char)sector[position];
+                unsigned int nameLength = (unsigned char)sector[position + 32];
+                const char *name = sector + position + 33;
 
-            // Try to extract the game ID from those 200k
-            bool detected = false;
-            for (size_t i = 0; i < readed; i++)
-            {
-                // USA Codes
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'U' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'L' && disk_data[i + 2] == 'U' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'P' && disk_data[i + 2] == 'U' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'U' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'X'))
-                    detected = true;
-
-                // EUR Codes
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'E' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'L' && disk_data[i + 2] == 'E' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'E' && disk_data[i + 3] == 'D'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'L' && disk_data[i + 2] == 'E' && disk_data[i + 3] == 'D'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'E' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'X'))
-                    detected = true;
-
-                // Japan Codes
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'M'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'L' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'L' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'M'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'I' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'E' && disk_data[i + 1] == 'S' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'M'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'L' && disk_data[i + 2] == 'K' && disk_data[i + 3] == 'A'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'A' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'X'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'X'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'D'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'T' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'X'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'P' && disk_data[i + 1] == 'B' && disk_data[i + 2] == 'P' && disk_data[i + 3] == 'X'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'C' && disk_data[i + 1] == 'P' && disk_data[i + 2] == 'C' && disk_data[i + 3] == 'S'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'A' && disk_data[i + 3] == 'J'))
-                    detected = true;
-                if (!detected && (disk_data[i] == 'S' && disk_data[i + 1] == 'C' && disk_data[i + 2] == 'Z' && disk_data[i + 3] == 'S'))
-                    detected = true;
-
-                if (detected)
+                if (position + 33 + nameLength > MODE1_SECTOR_SIZE)
                 {
-                    // Looks like we found it
-                    gameID = new char[10];
-                    std::memset(gameID, 0, 10);
-
-                    // Set the gameID. Normally in disk is XXXX_XX.XXX, so we will get only the code
-                    memcpy(gameID, disk_data + (i), 1);
-                    memcpy(gameID + 1, disk_data + (i + 1), 1);
-                    memcpy(gameID + 2, disk_data + (i + 2), 1);
-                    memcpy(gameID + 3, disk_data + (i + 3), 1);
-                    memcpy(gameID + 4, disk_data + (i + 5), 1);
-                    memcpy(gameID + 5, disk_data + (i + 6), 1);
-                    memcpy(gameID + 6, disk_data + (i + 7), 1);
-                    memcpy(gameID + 7, disk_data + (i + 9), 1);
-                    memcpy(gameID + 8, disk_data + (i + 10), 1);
-                    // Stop searching
                     break;
                 }
+
+                // Files only. The version suffix (;1) is optional.
+                if (!(sector[position + 25] & 0x02) && nameLength >= 10 &&
+                    memcmp(name, "SYSTEM.CNF", 10) == 0 && (nameLength == 10 || name[10] == ';'))
+                {
+                    cnfLBA = readLE32(sector + position + 2);
+                    cnfSize = readLE32(sector + position + 10);
+                    break;
+                }
+
+                position += recordLength;
             }
+        }
 
-            // Free the buffer
-            std::free((void *)disk_data);
-            // If nothing was found then return false
-            if (gameID == nullptr)
+        // The SYSTEM.CNF is a small text file, so just the first sector is read
+        if (cnfSize == 0 || !readUserSector(cnfLBA, sector))
+        {
+            return false;
+        }
+        std::string cnf(sector, std::min(cnfSize, (unsigned long)MODE1_SECTOR_SIZE));
+
+        // Search the boot line (BOOT on PSX and BOOT2 on PS2). Ex: BOOT = cdrom:\SCES_038.84;1
+        size_t bootPosition = cnf.find("BOOT");
+        if (bootPosition == std::string::npos)
+        {
+            return false;
+        }
+        size_t lineEnd = cnf.find_first_of("\r\n", bootPosition);
+        std::string bootLine = cnf.substr(bootPosition, lineEnd == std::string::npos ? std::string::npos : lineEnd - bootPosition);
+
+        // The executable name starts after the last path separator
+        size_t nameStart = bootLine.find_last_of("\\/:");
+        if (nameStart == std::string::npos)
+        {
+            return false;
+        }
+
+        // Get the code without the separators. Normally is XXXX_XXX.XX, so we will get only the 9 code chars.
+        char code[10] = {0};
+        unsigned int codeLength = 0;
+        for (size_t i = nameStart + 1; i < bootLine.size() && codeLength < 9; i++)
+        {
+            char c = bootLine[i];
+            if (c == '_' || c == '.')
             {
-                setLastError(std::string("No ID found."));
-                return false;
+                continue;
             }
+            if (!isalnum((unsigned char)c))
+            {
+                break;
+            }
+            code[codeLength++] = toupper((unsigned char)c);
         }
 
-        strncpy_s(id, 10, gameID, 10);
+        if (codeLength != 9)
+        {
+            return false;
+        }
+
+        gameID = new char[10];
+        memcpy(gameID, code, 10);
+
         return true;
     }
 
-    // In ISO files the ID and DiskID are the same (is just a disk)
+    // In single disk images the ID and DiskID are the same. In the multi-disk images the IDs of all the disks are
+    // detected the first time, so the next disk changes don't have to wait for the scan.
     bool IsoReader::getDiskID(char *id, unsigned long long buffersize)
     {
-        return getID(id, buffersize);
-    }
+        if (currentDiskReader != nullptr)
+        {
+            detectDiskIDs();
+            return currentDiskReader->getID(id, buffersize);
+        }
 
-    // ChangeCurrentDisk is not available for this format.
-    bool IsoReader::changeCurrentDisk(unsigned int disk)
-    {
-        return true;
+        return getID(id, buffersize);
     }
 
     // Read the input file data into the provided buffer. Return the readed bytes.
     unsigned long long IsoReader::readData(char *output, unsigned long long outputSize)
     {
+        LatencyTimer timer(statsEnabled ? &stats.readLatency : nullptr);
+
         if (!input_file.is_open())
         {
             // There is no opened file
@@ -179,6 +230,74 @@ namespace PopstationmdgPlugin
             return 0;
         }
 
+        unsigned long long readed = 0;
+
+        // After the end of the file the stream position is not available, but there is nothing to hash either
+        if ((streamHasher == nullptr && !sectorCheckEnabled) || !input_file.good())
+        {
+            readed = readDataFromFile(output, outputSize);
+        }
+        else
+        {
+            // Add the readed data to the hashes and check the readed sectors
+            unsigned long long position = tell();
+            readed = readDataFromFile(output, outputSize);
+            if (streamHasher != nullptr)
+            {
+                streamHasher->update(position, output, readed);
+            }
+            if (sectorCheckEnabled)
+            {
+                checkReadSectors(position, output, readed);
+            }
+        }
+
+        if (prefetchEnabled)
+        {
+            updatePrefetch(accessPosition, readed);
+        }
+        accessPosition += readed;
+
+        if (statsEnabled)
+        {
+            stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+            stats.bytesRead.fetch_add(readed, std::memory_order_relaxed);
+        }
+
+        return readed;
+    }
+
+    // Read the data from the mapped file, the read buffer or the file, depending on the settings
+    unsigned long long IsoReader::readDataFromFile(char *output, unsigned long long outputSize)
+    {
+        // Copy the data directly from the mapped file
+        if (mappedData != nullptr)
+        {
+            if (readPosition >= diskSize)
+            {
+                return 0;
+            }
+
+            unsigned long long toCopy = std::min(outputSize, (unsigned long long)(diskSize - readPosition));
+            memcpy(output, mappedData + readPosition, toCopy);
+            readPosition += toCopy;
+            return toCopy;
+        }
+
+        // Use the read buffer if enabled
+        if (readBuffer != nullptr)
+        {
+            return readDataBuffered(output, outputSize);
+        }
+
+        // The direct I/O file, the compressed images and the shared cache are readed using positional reads
+        if (directInput || compressedImage != nullptr || sharedCacheReady)
+        {
+            unsigned long long readed = readAt(readPosition, output, outputSize);
+            readPosition += readed;
+            return readed;
+        }
+
         // Try to read from file
         try
         {
@@ -197,6 +316,363 @@ namespace PopstationmdgPlugin
         }
     }
 
+    // Read the data using the read buffer. Small reads are served from memory and the buffer
+    // is refilled from disk (aligned to the sector size) only when the position is outside it.
+    unsigned long long IsoReader::readDataBuffered(char *output, unsigned long long outputSize)
+    {
+        unsigned long long readed = 0;
+        bool missed = false;
+
+        while (readed < outputSize && readPosition < diskRealSize)
+        {
+            unsigned long long pending = outputSize - readed;
+
+            // The current position is inside the buffer, so copy the data from memory
+            if (readPosition >= readBufferStart && readPosition < readBufferStart + readBufferLength)
+            {
+                unsigned long long offset = readPosition - readBufferStart;
+                unsigned long long toCopy = std::min(pending, readBufferLength - offset);
+
+                memcpy(output + readed, readBuffer + offset, toCopy);
+                readed += toCopy;
+                readPosition += toCopy;
+                continue;
+            }
+
+            missed = true;
+
+            // Big reads are done directly into the output buffer to avoid a double copy
+            if (pending >= bufferSize)
+            {
+                unsigned long long directReaded = readAt(readPosition, output + readed, pending);
+                readed += directReaded;
+                readPosition += directReaded;
+                break;
+            }
+
+            // Refill the buffer starting at the sector which contains the current position
+            if (!fillReadBuffer(readPosition - (readPosition % RAW_SECTOR_SIZE)))
+            {
+                return readed;
+            }
+
+            // Nothing was readed, so there is no more data
+            if (readBufferLength == 0)
+            {
+                break;
+            }
+        }
+
+        if (missed)
+        {
+            readCacheMisses++;
+        }
+        else
+        {
+            readCacheHits++;
+        }
+
+        return readed;
+    }
+
+    // Fill the read buffer with the data starting at the provided position
+    bool IsoReader::fillReadBuffer(unsigned long long position)
+    {
+        // The buffer is still used by some views, so it is handed to them and a new one is reserved
+        if (readBufferView != nullptr)
+        {
+            char *newBuffer = new (std::nothrow) char[bufferSize];
+            if (newBuffer == nullptr)
+            {
+                setLastError(std::string("There was an error allocating the read buffer memory."));
+                readBufferLength = 0;
+                return false;
+            }
+
+            if (detachViewBlock(readBufferView))
+            {
+                readBuffer = newBuffer;
+            }
+            else
+            {
+                delete[] newBuffer;
+            }
+        }
+
+        readBufferStart = position;
+        readBufferLength = readAt(position, readBuffer, bufferSize);
+
+        // A short read before the end of the disk means that there was an error
+        return readBufferLength == std::min((unsigned long long)bufferSize, (unsigned long long)(diskRealSize - position));
+    }
+
+    // Map the whole input file into memory. Returns false if the file can't be mapped, so the stream can be used instead.
+    bool IsoReader::mapInputFile()
+    {
+        if (diskSize == 0 || nativeInputFile == nullptr)
+        {
+            return false;
+        }
+
+#ifdef _WIN32
+        HANDLE mapping = CreateFileMappingA((HANDLE)nativeInputFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            SPDLOG_DEBUG("ISO: The file mapping can't be created. Using the file stream");
+            return false;
+        }
+
+        mappedData = (char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (mappedData == nullptr)
+        {
+            SPDLOG_DEBUG("ISO: The file view can't be mapped. Using the file stream");
+            CloseHandle(mapping);
+            return false;
+        }
+
+        mappedMapHandle = (void *)mapping;
+#else
+        void *data = mmap(nullptr, diskSize, PROT_READ, MAP_SHARED, fileno((FILE *)nativeInputFile), 0);
+        if (data == MAP_FAILED)
+        {
+            SPDLOG_DEBUG("ISO: The file can't be mapped. Using the file stream");
+            return false;
+        }
+
+        madvise(data, diskSize, randomAccess ? MADV_RANDOM : MADV_SEQUENTIAL);
+        mappedData = (char *)data;
+#endif
+
+        SPDLOG_DEBUG("ISO: The file was mapped into memory");
+        return true;
+    }
+
+    // Unmap the input file if it was mapped
+    void IsoReader::unmapInputFile()
+    {
+        if (mappedData == nullptr)
+        {
+            return;
+        }
+
+        // The mapping will be released with the last view
+        if (detachViewBlock(mappedView))
+        {
+            mappedData = nullptr;
+            mappedMapHandle = nullptr;
+            return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile(mappedData);
+        CloseHandle((HANDLE)mappedMapHandle);
+        mappedMapHandle = nullptr;
+#else
+        munmap(mappedData, diskSize);
+#endif
+
+        mappedData = nullptr;
+    }
+
+    // Detect the compressed images and load their index. The uncompressed images are not changed.
+    bool IsoReader::openCompressedImage()
+    {
+        char header[COMPRESSED_HEADER_SIZE];
+        if (readFileAt(0, header, COMPRESSED_HEADER_SIZE) != COMPRESSED_HEADER_SIZE ||
+            CompressedImage::detectFormat(header, COMPRESSED_HEADER_SIZE) == CFNone)
+        {
+            return true;
+        }
+
+        compressedImage = new CompressedImage([this](unsigned long long position, char *output, unsigned long long size)
+                                              { return readFileAt(position, output, size); },
+                                              workerThreads);
+
+        std::string error;
+        if (!compressedImage->open(diskSize, error))
+        {
+            setLastError(error);
+            delete compressedImage;
+            compressedImage = nullptr;
+            return false;
+        }
+
+        diskRealSize = compressedImage->getSize();
+        SPDLOG_DEBUG("ISO: {} image detected. Uncompressed size: {} bytes", compressedImage->getFormatName(), diskRealSize);
+
+        return true;
+    }
+
+    // Open the native file used by the positional reads and the memory map
+    bool IsoReader::openNativeInput(const char *filename)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  randomAccess ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        nativeInputFile = (void *)file;
+#else
+        nativeInputFile = (void *)nativeOpenFile(filename, O_RDONLY);
+        if (nativeInputFile == nullptr)
+        {
+            return false;
+        }
+#endif
+
+        return true;
+    }
+
+    // Close the native input file
+    void IsoReader::closeNativeInput()
+    {
+        if (nativeInputFile == nullptr)
+        {
+            return;
+        }
+
+#ifdef _WIN32
+        CloseHandle((HANDLE)nativeInputFile);
+#else
+        fclose((FILE *)nativeInputFile);
+#endif
+
+        nativeInputFile = nullptr;
+        directInput = false;
+    }
+
+    // Read data from the provided position without changing the current file position.
+    // It doesn't use any shared state, so it can be called from several threads at once.
+    unsigned long long IsoReader::readAt(unsigned long long position, char *output, unsigned long long outputSize)
+    {
+        if (nativeInputFile == nullptr)
+        {
+            // There is no opened file
+            setLastError(std::string("There is no input file opened"));
+            return 0;
+        }
+
+        if (position >= diskRealSize)
+        {
+            return 0;
+        }
+        outputSize = std::min(outputSize, (unsigned long long)(diskRealSize - position));
+
+        // The mapped files are already shared through the system cache
+        if (sharedCacheReady && mappedData == nullptr)
+        {
+            return readAtShared(position, output, outputSize);
+        }
+
+        return readImageAt(position, output, outputSize);
+    }
+
+    // Read the image data, which is decompressed in the compressed images
+    unsigned long long IsoReader::readImageAt(unsigned long long position, char *output, unsigned long long outputSize)
+    {
+        if (compressedImage != nullptr)
+        {
+            return compressedImage->read(position, output, outputSize);
+        }
+
+        return readFileAt(position, output, outputSize);
+    }
+
+    // Read the data stored in the file, which is compressed in the compressed images
+    unsigned long long IsoReader::readFileAt(unsigned long long position, char *output, unsigned long long outputSize)
+    {
+        // Copy the data directly from the mapped file
+        if (mappedData != nullptr)
+        {
+            memcpy(output, mappedData + position, outputSize);
+            return outputSize;
+        }
+
+        // Direct I/O requires aligned transfers
+        if (directInput)
+        {
+            return readAtDirect(position, output, outputSize);
+        }
+
+        unsigned long long readed = 0;
+        while (readed < outputSize)
+        {
+            long long chunkReaded = nativeRead(nativeInputFile, output + readed, outputSize - readed, position + readed, statsEnabled ? &stats.syscalls : nullptr);
+            if (chunkReaded < 0)
+            {
+                setLastError(std::string("There was an error reading from the file: ").append(nativeError()));
+                return readed;
+            }
+
+            // EOF
+            if (chunkReaded == 0)
+            {
+                break;
+            }
+            readed += chunkReaded;
+        }
+
+        return readed;
+    }
+
+    // Single positional read using the native file. Returns the readed bytes, 0 on EOF and -1 on error.
+    // The system calls are added to the syscalls counter if provided.
+    long long IsoReader::nativeRead(void *file, char *buffer, unsigned long long size, unsigned long long position, std::atomic<uint64_t> *syscalls)
+    {
+#ifdef _WIN32
+        if (syscalls != nullptr)
+        {
+            syscalls->fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // ReadFile with an offset is a positional read on handles opened without FILE_FLAG_OVERLAPPED
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)(position & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)(position >> 32);
+
+        DWORD readed = 0;
+        if (!ReadFile((HANDLE)file, buffer, (DWORD)std::min(size, (unsigned long long)0x40000000), &readed, &overlapped))
+        {
+            return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+        }
+
+        return readed;
+#else
+        ssize_t readed;
+        do
+        {
+            if (syscalls != nullptr)
+            {
+                syscalls->fetch_add(1, std::memory_order_relaxed);
+            }
+            readed = pread(fileno((FILE *)file), buffer, std::min(size, (unsigned long long)0x7FFFF000), position);
+        } while (readed < 0 && errno == EINTR);
+
+        return readed;
+#endif
+    }
+
+    // Description of the last native I/O error
+    std::string IsoReader::nativeError()
+    {
+#ifdef _WIN32
+        return std::string("error code ") + std::to_string(GetLastError());
+#else
+        return std::string(std::strerror(errno));
+#endif
+    }
+
+    // Return the read buffer hits and misses since the file was opened
+    bool IsoReader::getReadCacheStats(unsigned long long &hits, unsigned long long &misses)
+    {
+        hits = readCacheHits;
+        misses = readCacheMisses;
+        return readBuffer != nullptr;
+    }
+
     void IsoReader::freeReaderResources()
     {
         if (gameID != nullptr)
@@ -210,7 +686,7 @@ namespace PopstationmdgPlugin
     {
         unsigned long long SHARED_EXPORT readData(void *handler, char *output, unsigned long long toRead)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
             return object->readData(output, toRead);
         }
@@ -240,11 +716,18 @@ namespace PopstationmdgPlugin
             return true;
         }
 
-        bool SHARED_EXPORT changeCurrentDisk(void *handler, unsigned int disk)
+        unsigned long long SHARED_EXPORT readAt(void *handler, unsigned long long position, char *output, unsigned long long toRead)
         {
-            IsoReader *object = (IsoReader *)handler;
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->readAt(position, output, toRead);
+        }
+
+        bool SHARED_EXPORT getReadCacheStats(void *handler, unsigned long long &hits, unsigned long long &misses)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
 
-            return object->changeCurrentDisk(disk);
+            return object->getReadCacheStats(hits, misses);
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "iso.h"
+
+namespace PopstationmdgPlugin
+{
+    // Sync pattern at the start of every raw sector
+    static const unsigned char syncPattern[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+
+    // ISO9660 Primary Volume Descriptor signature, located at the sector 16
+    static const char pvdSignature[6] = {0x01, 'C', 'D', '0', '0', '1'};
+
+    // Sectors checked by every verify task
+    static const unsigned long long verifyBlockSectors = 1024;
+
+    // Detect the image sector layout by sampling the sync pattern, the mode byte and the PVD position
+    bool IsoReader::detectSectorLayout()
+    {
+        char sample[32];
+        sectorSize = 0;
+        sectorMode = 0;
+
+        // Raw images starts every sector with the sync pattern and the header. The mode is at the byte 15.
+        // The sector 16 is checked too when available to avoid false positives with cooked images.
+        if (readAt(0, sample, 16) == 16 && memcmp(sample, syncPattern, sizeof(syncPattern)) == 0)
+        {
+            if (diskRealSize < (unsigned long long)RAW_SECTOR_SIZE * 17 ||
+                (readAt((unsigned long long)RAW_SECTOR_SIZE * 16, sample, 16) == 16 && memcmp(sample, syncPattern, sizeof(syncPattern)) == 0))
+            {
+                sectorSize = RAW_SECTOR_SIZE;
+                sectorMode = (unsigned char)sample[15];
+            }
+        }
+
+        // MODE1 images contains just the user data, so the PVD is at the sector 16
+        if (sectorSize == 0 &&
+            readAt((unsigned long long)MODE1_SECTOR_SIZE * 16, sample, sizeof(pvdSignature)) == sizeof(pvdSignature) &&
+            memcmp(sample, pvdSignature, sizeof(pvdSignature)) == 0)
+        {
+            sectorSize = MODE1_SECTOR_SIZE;
+            sectorMode = 1;
+        }
+
+        // MODE2 images keeps the 8 bytes subheader before the user data
+        if (sectorSize == 0 &&
+            readAt((unsigned long long)MODE2_SECTOR_SIZE * 16 + 8, sample, sizeof(pvdSignature)) == sizeof(pvdSignature) &&
+            memcmp(sample, pvdSignature, sizeof(pvdSignature)) == 0)
+        {
+            sectorSize = MODE2_SECTOR_SIZE;
+            sectorMode = 2;
+        }
+
+        if (sectorSize == 0)
+        {
+            SPDLOG_DEBUG("ISO: The sector layout can't be detected");
+            return false;
+        }
+
+        SPDLOG_DEBUG("ISO: Detected sector layout: {} bytes, mode {}", sectorSize, sectorMode);
+        return true;
+    }
+
+    // Read whole sectors into the output buffer, which must have space for count * sector size bytes.
+    // The reads are positional, so the current file position is not modified. Returns the readed sectors.
+    unsigned long long IsoReader::readSectors(unsigned long long lba, unsigned long long count, char *output)
+    {
+        if (sectorSize == 0)
+        {
+            setLastError(std::string("The image sector layout is unknown"));
+            return 0;
+        }
+
+        unsigned long long readed = readAt(lba * sectorSize, output, count * sectorSize);
+
+        return readed / sectorSize;
+    }
+
+    // Read the 2048 bytes of user data of a sector, skipping the sync, header and subheader of the layout
+    bool IsoReader::readUserSector(unsigned long long lba, char *output)
+    {
+        unsigned long long headerSize = 0;
+
+        if (sectorSize == RAW_SECTOR_SIZE)
+        {
+            // Sync + Header (+ Subheader on MODE2)
+            headerSize = sectorMode == 2 ? 24 : 16;
+        }
+        else if (sectorSize == MODE2_SECTOR_SIZE)
+        {
+            // Subheader
+            headerSize = 8;
+        }
+        else if (sectorSize != MODE1_SECTOR_SIZE)
+        {
+            return false;
+        }
+
+        return readAt(lba * sectorSize + headerSize, output, MODE1_SECTOR_SIZE) == MODE1_SECTOR_SIZE;
+    }
+
+    // Get the detected sector size and mode. Returns false if the layout is unknown.
+    bool IsoReader::getSectorLayout(unsigned int &size, unsigned int &mode)
+    {
+        size = sectorSize;
+        mode = sectorMode;
+
+        return sectorSize != 0;
+    }
+
+    // Check the EDC and ECC of all the image sectors and copy the damaged sectors list to the output in JSON format.
+    // The image is splitted in blocks which are readed and checked in parallel, so the file position is not modified.
+    bool IsoReader::verify(char *output, unsigned long long buffersize)
+    {
+        if (!input_file.is_open())
+        {
+            setLastError(std::string("There is no input file opened"));
+            return false;
+        }
+
+        if (sectorSize != RAW_SECTOR_SIZE)
+        {
+            setLastError(std::string("Only the raw images have EDC/ECC data to verify"));
+            return false;
+        }
+
+        unsigned long long totalSectors = diskRealSize / RAW_SECTOR_SIZE;
+        std::vector<unsigned long long> damaged;
+        std::mutex damagedMutex;
+        bool readError = false;
+
+        SPDLOG_DEBUG("ISO: Verifying {} sectors using {} threads", totalSectors, workerThreads);
+
+        {
+            ThreadPool pool(workerThreads);
+
+            for (unsigned long long first = 0; first < totalSectors; first += verifyBlockSectors)
+            {
+                pool.submit([this, first, totalSectors, &damaged, &damagedMutex, &readError]
+                            {
+                    unsigned long long count = std::min(verifyBlockSectors, totalSectors - first);
+                    unsigned long long size = count * RAW_SECTOR_SIZE;
+                    std::vector<unsigned long long> blockDamaged;
+
+                    // The mapped data is checked in place
+                    const char *data = nullptr;
+                    std::vector<char> buffer;
+                    if (mappedData != nullptr)
+                    {
+                        data = mappedData + first * RAW_SECTOR_SIZE;
+                    }
+                    else
+                    {
+                        buffer.resize(size);
+                        if (readAt(first * RAW_SECTOR_SIZE, buffer.data(), size) != size)
+                        {
+                            std::lock_guard<std::mutex> lock(damagedMutex);
+                            readError = true;
+                            return;
+                        }
+                        data = buffer.data();
+                    }
+
+                    for (unsigned long long i = 0; i < count; i++)
+                    {
+                        if (!checkRawSector((const uint8_t *)data + i * RAW_SECTOR_SIZE))
+                        {
+                            blockDamaged.push_back(first + i);
+                        }
+                    }
+
+                    if (!blockDamaged.empty())
+                    {
+                        std::lock_guard<std::mutex> lock(damagedMutex);
+                        damaged.insert(damaged.end(), blockDamaged.begin(), blockDamaged.end());
+                    } });
+            }
+
+            pool.wait();
+        }
+
+        if (readError)
+        {
+            setLastError(std::string("There was an error reading the image sectors to verify them"));
+            return false;
+        }
+
+        std::sort(damaged.begin(), damaged.end());
+        SPDLOG_DEBUG("ISO: {} damaged sectors were found", damaged.size());
+
+        ordered_json results;
+        results["sectors"] = totalSectors;
+        results["bad_sectors"] = damaged;
+
+        return copyJsonOutput(results.dump(), output, buffersize);
+    }
+
+    // Check the complete raw sectors of the readed data. The last sector partially readed is kept to be
+    // completed by the next read, so only the sectors splitted in non sequential reads are not checked.
+    void IsoReader::checkReadSectors(unsigned long long position, const char *data, unsigned long long size)
+    {
+        if (sectorSize != RAW_SECTOR_SIZE || size == 0)
+        {
+            return;
+        }
+
+        // Complete the sector started in the previous read
+        if (sectorCheckUsed > 0 && position == sectorCheckPosition + sectorCheckUsed)
+        {
+            unsigned long long toCopy = std::min(size, RAW_SECTOR_SIZE - sectorCheckUsed);
+            memcpy(sectorCheckBuffer + sectorCheckUsed, data, toCopy);
+            sectorCheckUsed += toCopy;
+            position += toCopy;
+            data += toCopy;
+            size -= toCopy;
+
+            if (sectorCheckUsed < RAW_SECTOR_SIZE)
+            {
+                return;
+            }
+
+            if (!checkRawSector((const uint8_t *)sectorCheckBuffer))
+            {
+                spdlog::warn("ISO: The sector {} is damaged", sectorCheckPosition / RAW_SECTOR_SIZE);
+                badSectors.insert(sectorCheckPosition / RAW_SECTOR_SIZE);
+            }
+        }
+        sectorCheckUsed = 0;
+
+        unsigned long long lba = (position + RAW_SECTOR_SIZE - 1) / RAW_SECTOR_SIZE;
+        while ((lba + 1) * RAW_SECTOR_SIZE <= position + size)
+        {
+            if (!checkRawSector((const uint8_t *)data + lba * RAW_SECTOR_SIZE - position))
+            {
+                spdlog::warn("ISO: The sector {} is damaged", lba);
+                badSectors.insert(lba);
+            }
+            lba++;
+        }
+
+        // Keep the start of the last sector
+        unsigned long long end = position + size;
+        unsigned long long lastStart = end - end % RAW_SECTOR_SIZE;
+        if (end % RAW_SECTOR_SIZE != 0 && lastStart >= position)
+        {
+            sectorCheckPosition = lastStart;
+            sectorCheckUsed = end - lastStart;
+            memcpy(sectorCheckBuffer, data + lastStart - position, sectorCheckUsed);
+        }
+    }
+
+    // Copy the damaged sectors found while reading in JSON format
+    bool IsoReader::getBadSectors(char *output, unsigned long long buffersize)
+    {
+        ordered_json results;
+        results["bad_sectors"] = badSectors;
+
+        return copyJsonOutput(results.dump(), output, buffersize);
+    }
+
+    extern "C"
+    {
+        unsigned long long SHARED_EXPORT readSectors(void *handler, unsigned long long lba, unsigned long long count, char *output)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->readSectors(lba, count, output);
+        }
+
+        bool SHARED_EXPORT getSectorLayout(void *handler, unsigned int &size, unsigned int &mode)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->getSectorLayout(size, mode);
+        }
+
+        bool SHARED_EXPORT verify(void *handler, char *output, unsigned long long buffersize)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->verify(output, buffersize);
+        }
+
+        bool SHARED_EXPORT getBadSectors(void *handler, char *output, unsigned long long buffersize)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->getBadSectors(output, buffersize);
+        }
+    }
+}
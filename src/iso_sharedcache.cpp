@@ -0,0 +1,319 @@
+#include "iso.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Shared sector cache
+//
+// Every plugin object is a different handle for the host, so the images opened several times in the same
+// process (a front-end, a verifier and a converter, for example) were readed from the disk every time.
+// The blocks readed by any object are stored in a cache of the process, indexed by the file identity
+// and the block number, and the positional reads of all the objects check it before reading the file.
+//
+namespace PopstationmdgPlugin
+{
+    SharedSectorCache &SharedSectorCache::getInstance()
+    {
+        static SharedSectorCache instance;
+        return instance;
+    }
+
+    // Get the identity of the opened native file (FILE * on POSIX, HANDLE on Windows)
+    bool SharedSectorCache::getFileIdentity(void *nativeFile, FileIdentity &identity)
+    {
+        if (nativeFile == nullptr)
+        {
+            return false;
+        }
+
+#ifdef _WIN32
+        BY_HANDLE_FILE_INFORMATION info;
+        if (!GetFileInformationByHandle((HANDLE)nativeFile, &info))
+        {
+            return false;
+        }
+
+        identity.device = info.dwVolumeSerialNumber;
+        identity.inode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        identity.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        identity.modified = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime);
+#else
+        struct stat fileStat;
+        if (fstat(fileno((FILE *)nativeFile), &fileStat) != 0)
+        {
+            return false;
+        }
+
+        identity.device = fileStat.st_dev;
+        identity.inode = fileStat.st_ino;
+        identity.size = fileStat.st_size;
+#ifdef __APPLE__
+        identity.modified = (int64_t)fileStat.st_mtimespec.tv_sec * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+#else
+        identity.modified = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+#endif
+
+        return true;
+    }
+
+    size_t SharedSectorCache::BlockKeyHash::operator()(const BlockKey &key) const
+    {
+        uint64_t hash = key.file.device * 0x9E3779B97F4A7C15ull;
+        hash = (hash ^ key.file.inode) * 0x9E3779B97F4A7C15ull;
+        hash = (hash ^ (uint64_t)key.file.modified) * 0x9E3779B97F4A7C15ull;
+        hash = (hash ^ key.block) * 0x9E3779B97F4A7C15ull;
+        return (size_t)(hash ^ (hash >> 32));
+    }
+
+    // The consecutive blocks of a file are stored in consecutive shards, so the sequential reads are spread between them
+    SharedSectorCache::Shard &SharedSectorCache::getShard(const BlockKey &key)
+    {
+        uint64_t fileHash = (key.file.device * 0x9E3779B97F4A7C15ull) ^ key.file.inode;
+        return shards[(fileHash + key.block) % SHARED_CACHE_SHARDS];
+    }
+
+    void SharedSectorCache::setCapacity(unsigned long long bytes)
+    {
+        if (capacityBytes.exchange(bytes) == bytes)
+        {
+            return;
+        }
+
+        // At least one block by shard if the cache is enabled
+        size_t slots = (size_t)(bytes / SHARED_CACHE_SHARDS / SHARED_CACHE_BLOCK_SIZE);
+        if (bytes > 0)
+        {
+            slots = std::max(slots, (size_t)1);
+        }
+
+        for (auto &shard : shards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+            shard.capacity = slots;
+            while (shard.slots.size() > slots)
+            {
+                shard.blocks.erase(shard.slots.back()->key);
+                shard.slots.pop_back();
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (shard.hand >= shard.slots.size())
+            {
+                shard.hand = 0;
+            }
+        }
+    }
+
+    bool SharedSectorCache::read(const FileIdentity &file, unsigned long long block, unsigned long long offset, char *output, unsigned long long size)
+    {
+        BlockKey key{file, block};
+        Shard &shard = getShard(key);
+
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+            auto found = shard.blocks.find(key);
+            if (found != shard.blocks.end())
+            {
+                Slot &slot = *shard.slots[found->second];
+                if (offset + size <= slot.data.size())
+                {
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                    memcpy(output, slot.data.data() + offset, size);
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    bool SharedSectorCache::contains(const FileIdentity &file, unsigned long long block)
+    {
+        BlockKey key{file, block};
+        Shard &shard = getShard(key);
+
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            if (shard.blocks.count(key) > 0)
+            {
+                return true;
+            }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Add a block to the cache. When the shard is full, the first block not referenced since the last
+    // pass of the clock hand is replaced.
+    void SharedSectorCache::store(const FileIdentity &file, unsigned long long block, const char *data, unsigned long long size)
+    {
+        BlockKey key{file, block};
+        Shard &shard = getShard(key);
+
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+        if (shard.capacity == 0 || shard.blocks.count(key) > 0)
+        {
+            return;
+        }
+
+        size_t index;
+        if (shard.slots.size() < shard.capacity)
+        {
+            index = shard.slots.size();
+            shard.slots.push_back(std::make_unique<Slot>());
+        }
+        else
+        {
+            while (shard.slots[shard.hand]->referenced.exchange(false, std::memory_order_relaxed))
+            {
+                shard.hand = (shard.hand + 1) % shard.slots.size();
+            }
+
+            index = shard.hand;
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+            shard.blocks.erase(shard.slots[index]->key);
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Slot &slot = *shard.slots[index];
+        slot.key = key;
+        slot.data.assign(data, data + size);
+        slot.referenced.store(false, std::memory_order_relaxed);
+        shard.blocks[key] = index;
+    }
+
+    nlohmann::ordered_json SharedSectorCache::toJson()
+    {
+        nlohmann::ordered_json results;
+        uint64_t cacheHits = hits.load(std::memory_order_relaxed);
+        uint64_t cacheMisses = misses.load(std::memory_order_relaxed);
+
+        size_t blocks = 0;
+        for (auto &shard : shards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            blocks += shard.blocks.size();
+        }
+
+        results["capacity"] = capacityBytes.load(std::memory_order_relaxed);
+        results["used"] = (unsigned long long)blocks * SHARED_CACHE_BLOCK_SIZE;
+        results["blocks"] = blocks;
+        results["hits"] = cacheHits;
+        results["misses"] = cacheMisses;
+        results["hit_ratio"] = cacheHits + cacheMisses > 0 ? (double)cacheHits / (cacheHits + cacheMisses) : 0.0;
+        results["evictions"] = evictions.load(std::memory_order_relaxed);
+
+        return results;
+    }
+
+    // Prepare the shared cache for the opened file. The cache size is the same for the whole process,
+    // so the last opened file sets it.
+    bool IsoReader::openSharedCache()
+    {
+        sharedCacheReady = false;
+
+        if (!sharedCacheEnabled)
+        {
+            return false;
+        }
+
+        SharedSectorCache::getInstance().setCapacity((unsigned long long)sharedCacheSize * 1048576);
+        sharedCacheFile = inputIdentity;
+        sharedCacheReady = true;
+
+        return true;
+    }
+
+    // Positional read through the shared cache. The missing blocks are readed complete and stored in the cache.
+    // The complete blocks of the request are readed directly into the output, together with the next missing blocks.
+    unsigned long long IsoReader::readAtShared(unsigned long long position, char *output, unsigned long long outputSize)
+    {
+        SharedSectorCache &cache = SharedSectorCache::getInstance();
+        unsigned long long readed = 0;
+
+        while (readed < outputSize)
+        {
+            unsigned long long current = position + readed;
+            unsigned long long block = current / SHARED_CACHE_BLOCK_SIZE;
+            unsigned long long offset = current % SHARED_CACHE_BLOCK_SIZE;
+            unsigned long long blockStart = current - offset;
+            unsigned long long blockSize = std::min((unsigned long long)SHARED_CACHE_BLOCK_SIZE, (unsigned long long)(diskRealSize - blockStart));
+            unsigned long long toCopy = std::min(blockSize - offset, outputSize - readed);
+
+            if (cache.read(sharedCacheFile, block, offset, output + readed, toCopy))
+            {
+                stats.sharedCacheHits.fetch_add(1, std::memory_order_relaxed);
+                readed += toCopy;
+                continue;
+            }
+            stats.sharedCacheMisses.fetch_add(1, std::memory_order_relaxed);
+
+            if (offset == 0 && toCopy == blockSize)
+            {
+                unsigned long long runSize = blockSize;
+                while (readed + runSize < outputSize)
+                {
+                    unsigned long long nextStart = blockStart + runSize;
+                    unsigned long long nextSize = std::min((unsigned long long)SHARED_CACHE_BLOCK_SIZE, (unsigned long long)(diskRealSize - nextStart));
+                    if (readed + runSize + nextSize > outputSize || cache.contains(sharedCacheFile, nextStart / SHARED_CACHE_BLOCK_SIZE))
+                    {
+                        break;
+                    }
+                    runSize += nextSize;
+                    stats.sharedCacheMisses.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                unsigned long long runReaded = readImageAt(current, output + readed, runSize);
+                for (unsigned long long stored = 0; stored < runReaded;)
+                {
+                    unsigned long long storeSize = std::min((unsigned long long)SHARED_CACHE_BLOCK_SIZE, (unsigned long long)(diskRealSize - current - stored));
+                    if (stored + storeSize > runReaded)
+                    {
+                        break;
+                    }
+                    cache.store(sharedCacheFile, (current + stored) / SHARED_CACHE_BLOCK_SIZE, output + readed + stored, storeSize);
+                    stored += storeSize;
+                }
+
+                readed += runReaded;
+                if (runReaded < runSize)
+                {
+                    return readed;
+                }
+                continue;
+            }
+
+            // The block is only partially requested, so it is readed into a temporary buffer
+            static thread_local std::vector<char> blockBuffer;
+            blockBuffer.resize(SHARED_CACHE_BLOCK_SIZE);
+
+            unsigned long long blockReaded = readImageAt(blockStart, blockBuffer.data(), blockSize);
+            if (blockReaded < blockSize)
+            {
+                // Copy what was readed before the error
+                unsigned long long available = blockReaded > offset ? std::min(blockReaded - offset, toCopy) : 0;
+                memcpy(output + readed, blockBuffer.data() + offset, available);
+                return readed + available;
+            }
+
+            cache.store(sharedCacheFile, block, blockBuffer.data(), blockSize);
+            memcpy(output + readed, blockBuffer.data() + offset, toCopy);
+            readed += toCopy;
+        }
+
+        return readed;
+    }
+}
@@ -0,0 +1,181 @@
+#include "iso.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace PopstationmdgPlugin
+{
+    // Number of bits required to store the value, which is the histogram bucket
+    static inline unsigned int getBitWidth(uint64_t value)
+    {
+        if (value == 0)
+        {
+            return 0;
+        }
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return index + 1;
+#else
+        return 64 - __builtin_clzll(value);
+#endif
+    }
+
+    void LatencyHistogram::add(uint64_t nanoseconds)
+    {
+        unsigned int bucket = std::min(getBitWidth(nanoseconds), (unsigned int)STATS_HISTOGRAM_BUCKETS - 1);
+
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalTime.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        uint64_t currentMax = maxTime.load(std::memory_order_relaxed);
+        while (nanoseconds > currentMax && !maxTime.compare_exchange_weak(currentMax, nanoseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void LatencyHistogram::reset()
+    {
+        for (auto &bucket : buckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        totalTime.store(0, std::memory_order_relaxed);
+        maxTime.store(0, std::memory_order_relaxed);
+    }
+
+    // Upper limit of the bucket which contains the percentile. It is limited to the maximum latency, because
+    // the latencies of the last bucket can be up to a half of its limit.
+    uint64_t LatencyHistogram::getPercentile(uint64_t total, double percentile)
+    {
+        uint64_t target = (uint64_t)(total * percentile);
+        uint64_t accumulated = 0;
+
+        for (unsigned int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        {
+            accumulated += buckets[i].load(std::memory_order_relaxed);
+            if (accumulated > target)
+            {
+                return i == 0 ? 0 : std::min(1ull << i, (unsigned long long)maxTime.load(std::memory_order_relaxed));
+            }
+        }
+
+        return maxTime.load(std::memory_order_relaxed);
+    }
+
+    // The empty buckets are not included. Every bucket has the upper limit of its latencies in nanoseconds.
+    nlohmann::ordered_json LatencyHistogram::toJson()
+    {
+        nlohmann::ordered_json histogram;
+        uint64_t total = count.load(std::memory_order_relaxed);
+
+        histogram["count"] = total;
+        histogram["total_ns"] = totalTime.load(std::memory_order_relaxed);
+        histogram["max_ns"] = maxTime.load(std::memory_order_relaxed);
+        histogram["p50_ns"] = total > 0 ? getPercentile(total, 0.5) : 0;
+        histogram["p99_ns"] = total > 0 ? getPercentile(total, 0.99) : 0;
+        histogram["buckets"] = nlohmann::ordered_json::array();
+
+        for (unsigned int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        {
+            uint64_t bucketCount = buckets[i].load(std::memory_order_relaxed);
+            if (bucketCount > 0)
+            {
+                nlohmann::ordered_json bucket;
+                bucket["le_ns"] = i == 0 ? 0 : 1ull << i;
+                bucket["count"] = bucketCount;
+                histogram["buckets"].push_back(bucket);
+            }
+        }
+
+        return histogram;
+    }
+
+    void IoStats::reset()
+    {
+        bytesRead.store(0, std::memory_order_relaxed);
+        bytesWritten.store(0, std::memory_order_relaxed);
+        readCalls.store(0, std::memory_order_relaxed);
+        writeCalls.store(0, std::memory_order_relaxed);
+        seekCalls.store(0, std::memory_order_relaxed);
+        getIDCalls.store(0, std::memory_order_relaxed);
+        syscalls.store(0, std::memory_order_relaxed);
+        errors.store(0, std::memory_order_relaxed);
+        sharedCacheHits.store(0, std::memory_order_relaxed);
+        sharedCacheMisses.store(0, std::memory_order_relaxed);
+        prefetchHints.store(0, std::memory_order_relaxed);
+
+        readLatency.reset();
+        writeLatency.reset();
+        seekLatency.reset();
+        getIDLatency.reset();
+    }
+
+    nlohmann::ordered_json IoStats::toJson()
+    {
+        nlohmann::ordered_json results;
+
+        results["bytes_read"] = bytesRead.load(std::memory_order_relaxed);
+        results["bytes_written"] = bytesWritten.load(std::memory_order_relaxed);
+        results["read_calls"] = readCalls.load(std::memory_order_relaxed);
+        results["write_calls"] = writeCalls.load(std::memory_order_relaxed);
+        results["seek_calls"] = seekCalls.load(std::memory_order_relaxed);
+        results["getid_calls"] = getIDCalls.load(std::memory_order_relaxed);
+        results["syscalls"] = syscalls.load(std::memory_order_relaxed);
+        results["errors"] = errors.load(std::memory_order_relaxed);
+        results["shared_cache_hits"] = sharedCacheHits.load(std::memory_order_relaxed);
+        results["shared_cache_misses"] = sharedCacheMisses.load(std::memory_order_relaxed);
+        results["prefetch_hints"] = prefetchHints.load(std::memory_order_relaxed);
+        results["latency"]["readData"] = readLatency.toJson();
+        results["latency"]["writeData"] = writeLatency.toJson();
+        results["latency"]["seek"] = seekLatency.toJson();
+        results["latency"]["getID"] = getIDLatency.toJson();
+
+        return results;
+    }
+
+    // Copy the statistics of the object in JSON format
+    bool IsoReader::getStats(char *output, unsigned long long buffersize)
+    {
+        ordered_json results = stats.toJson();
+        results["enabled"] = statsEnabled;
+        results["read_cache_hits"] = readCacheHits;
+        results["read_cache_misses"] = readCacheMisses;
+        results["prefetch_window"] = prefetchWindow;
+
+        // The shared cache counters are the ones of the whole process
+        if (sharedCacheEnabled)
+        {
+            results["shared_cache"] = SharedSectorCache::getInstance().toJson();
+        }
+
+        return copyJsonOutput(results.dump(), output, buffersize);
+    }
+
+    void IsoReader::resetStats()
+    {
+        stats.reset();
+        readCacheHits = 0;
+        readCacheMisses = 0;
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT getStats(void *handler, char *output, unsigned long long buffersize)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->getStats(output, buffersize);
+        }
+
+        void SHARED_EXPORT resetStats(void *handler)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            object->resetStats();
+        }
+    }
+}
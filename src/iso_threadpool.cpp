@@ -0,0 +1,87 @@
+#include "iso_threadpool.h"
+
+namespace PopstationmdgPlugin
+{
+    // Start the workers. At least one worker is always started.
+    ThreadPool::ThreadPool(unsigned int threads)
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+
+        for (unsigned int i = 0; i < threads; i++)
+        {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    // Run the pending tasks and stop the workers
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            stopping = true;
+        }
+        tasksCondition.notify_all();
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    // Add a task to the queue
+    void ThreadPool::submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.push_back(std::move(task));
+        }
+        tasksCondition.notify_one();
+    }
+
+    // Wait until all the submitted tasks have finished
+    void ThreadPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(tasksMutex);
+        doneCondition.wait(lock, [this]
+                           { return tasks.empty() && activeTasks == 0; });
+    }
+
+    unsigned int ThreadPool::getThreads()
+    {
+        return workers.size();
+    }
+
+    void ThreadPool::workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(tasksMutex);
+                tasksCondition.wait(lock, [this]
+                                    { return stopping || !tasks.empty(); });
+
+                if (tasks.empty())
+                {
+                    // Stop requested and nothing pending
+                    return;
+                }
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                activeTasks++;
+            }
+
+            task();
+
+            {
+                std::lock_guard<std::mutex> lock(tasksMutex);
+                activeTasks--;
+            }
+            doneCondition.notify_all();
+        }
+    }
+}
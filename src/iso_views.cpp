@@ -0,0 +1,256 @@
+#include "iso.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace PopstationmdgPlugin
+{
+    // Return a read-only pointer to the data at the provided offset without copying it. The view can be
+    // shorter than the requested size if the data is not contiguous in memory, so the host must check the
+    // length. The views don't change the file position and the data is not hashed or verified.
+    bool IsoReader::acquireView(unsigned long long offset, unsigned long long size, const char *&data, unsigned long long &length)
+    {
+        data = nullptr;
+        length = 0;
+
+        if (!input_file.is_open())
+        {
+            // There is no opened file
+            setLastError(std::string("There is no input file opened"));
+            return false;
+        }
+
+        if (offset >= diskRealSize || size == 0)
+        {
+            setLastError(std::string("The requested view is outside of the disk"));
+            return false;
+        }
+
+        size = std::min(size, (unsigned long long)(diskRealSize - offset));
+
+        // The read buffer is refilled before lock the views because the refill detaches the old buffer
+        if (mappedData == nullptr && readBuffer != nullptr &&
+            (offset < readBufferStart || offset >= readBufferStart + readBufferLength))
+        {
+            fillReadBuffer(offset - (offset % RAW_SECTOR_SIZE));
+            if (offset < readBufferStart || offset >= readBufferStart + readBufferLength)
+            {
+                setLastError(std::string("There was an error reading the view data"));
+                return false;
+            }
+        }
+
+        ViewBlock *block = nullptr;
+        std::lock_guard<std::mutex> lock(viewsMutex);
+
+        if (mappedData != nullptr)
+        {
+            // The whole file is in memory, so the view can have any size
+            if (mappedView == nullptr)
+            {
+                mappedView = new ViewBlock();
+                mappedView->type = VMMapped;
+                mappedView->data = mappedData;
+                mappedView->size = diskSize;
+                mappedView->mapHandle = mappedMapHandle;
+            }
+
+            block = mappedView;
+            data = mappedData + offset;
+            length = size;
+        }
+        else if (readBuffer != nullptr)
+        {
+            // The view ends at the end of the buffer
+            if (readBufferView == nullptr)
+            {
+                readBufferView = new ViewBlock();
+                readBufferView->type = VMReadBuffer;
+                readBufferView->data = readBuffer;
+                readBufferView->size = bufferSize;
+            }
+
+            block = readBufferView;
+            data = readBuffer + (offset - readBufferStart);
+            length = std::min(size, readBufferStart + readBufferLength - offset);
+        }
+        else
+        {
+            // Without memory map or read buffer the data is readed into a buffer owned by the view
+            size = std::min(size, (unsigned long long)VIEW_MAX_PRIVATE_SIZE);
+
+            block = new ViewBlock();
+            block->type = VMPrivate;
+            block->detached = true;
+            block->data = new (std::nothrow) char[size];
+            if (block->data == nullptr)
+            {
+                delete block;
+                setLastError(std::string("There was an error allocating the view memory."));
+                return false;
+            }
+
+            block->size = readAt(offset, block->data, size);
+            if (block->size == 0)
+            {
+                freeViewBlock(block);
+                return false;
+            }
+
+            data = block->data;
+            length = block->size;
+        }
+
+        block->references++;
+        auto &entry = views[data];
+        entry.first = block;
+        entry.second++;
+
+        if (statsEnabled)
+        {
+            stats.bytesRead.fetch_add(length, std::memory_order_relaxed);
+        }
+
+        return true;
+    }
+
+    // Release a view returned by acquireView. The memory is freed if it was detached and this was the last view.
+    bool IsoReader::releaseView(const char *data)
+    {
+        // The view can belong to any disk of a multi-disk image
+        for (auto disk : diskReaders)
+        {
+            if (disk->hasView(data))
+            {
+                return disk->releaseView(data);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(viewsMutex);
+
+        auto view = views.find(data);
+        if (view == views.end())
+        {
+            setLastError(std::string("The released view doesn't exists"));
+            return false;
+        }
+
+        ViewBlock *block = view->second.first;
+        if (--view->second.second == 0)
+        {
+            views.erase(view);
+        }
+
+        if (--block->references == 0)
+        {
+            if (block == mappedView)
+            {
+                mappedView = nullptr;
+            }
+            else if (block == readBufferView)
+            {
+                readBufferView = nullptr;
+            }
+
+            freeViewBlock(block);
+        }
+
+        return true;
+    }
+
+    // Check if the view was acquired from this object
+    bool IsoReader::hasView(const char *data)
+    {
+        std::lock_guard<std::mutex> lock(viewsMutex);
+
+        return views.find(data) != views.end();
+    }
+
+    // Hand the block memory to its views, so it will be freed with the last of them. Returns false
+    // if the block has no views and the memory must be freed by the caller.
+    bool IsoReader::detachViewBlock(ViewBlock *&block)
+    {
+        std::lock_guard<std::mutex> lock(viewsMutex);
+
+        if (block == nullptr)
+        {
+            return false;
+        }
+
+        block->detached = true;
+        block = nullptr;
+        return true;
+    }
+
+    // Free the block and its memory if it was detached
+    void IsoReader::freeViewBlock(ViewBlock *block)
+    {
+        if (block->detached && block->data != nullptr)
+        {
+            if (block->type == VMMapped)
+            {
+#ifdef _WIN32
+                UnmapViewOfFile(block->data);
+                CloseHandle((HANDLE)block->mapHandle);
+#else
+                munmap(block->data, block->size);
+#endif
+            }
+            else
+            {
+                delete[] block->data;
+            }
+        }
+
+        delete block;
+    }
+
+    // Free the views which were not released by the host. Their pointers are not valid after this.
+    void IsoReader::freeViews()
+    {
+        std::lock_guard<std::mutex> lock(viewsMutex);
+
+        std::set<ViewBlock *> blocks;
+        for (auto &view : views)
+        {
+            blocks.insert(view.second.first);
+        }
+        views.clear();
+
+        if (!blocks.empty())
+        {
+            SPDLOG_DEBUG("ISO: Freeing {} memory blocks of not released views", blocks.size());
+        }
+
+        for (auto block : blocks)
+        {
+            freeViewBlock(block);
+        }
+
+        mappedView = nullptr;
+        readBufferView = nullptr;
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT acquireView(void *handler, unsigned long long offset, unsigned long long size, const char *&data, unsigned long long &length)
+        {
+            IsoReader *object = ((IsoReader *)handler)->getDiskReader();
+
+            return object->acquireView(offset, size, data, length);
+        }
+
+        bool SHARED_EXPORT releaseView(void *handler, const char *data)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->releaseView(data);
+        }
+    }
+}
@@ -1,10 +1,47 @@
 #include "iso.h"
 
+#include <cctype>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace PopstationmdgPlugin
 {
-    // Read the input file data into the provided buffer. Return the readed bytes.
+    // Get the compressed format of the output by its extension
+    static CompressedFormat getCompressedFormat(const char *filename)
+    {
+        std::string extension = std::filesystem::path(filename).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                       { return tolower(c); });
+
+        if (extension == ".cso")
+        {
+            return CFCso;
+        }
+
+        if (extension == ".zso")
+        {
+            return CFZso;
+        }
+
+        return CFNone;
+    }
+
+    // Write the provided buffer data into the output file. Return the writen bytes.
     unsigned long long IsoReader::writeData(char *input, unsigned long long inputSize)
     {
+        LatencyTimer timer(statsEnabled ? &stats.writeLatency : nullptr);
+
         if (!output_file.is_open())
         {
             // There is no opened file
@@ -12,12 +49,68 @@ namespace PopstationmdgPlugin
             return 0;
         }
 
+        // Wrap the user data into raw sectors
+        unsigned long long writen = rawEncodeBuffer != nullptr ? writeRawSectors(input, inputSize) : writeOutputData(input, inputSize);
+
+        if (statsEnabled)
+        {
+            stats.writeCalls.fetch_add(1, std::memory_order_relaxed);
+            stats.bytesWritten.fetch_add(writen, std::memory_order_relaxed);
+        }
+
+        return writen;
+    }
+
+    // Write the data to the output, adding it to the hashes if enabled
+    unsigned long long IsoReader::writeOutputData(char *input, unsigned long long inputSize)
+    {
+        if (streamHasher == nullptr)
+        {
+            return writeDataToFile(input, inputSize);
+        }
+
+        // Add the writen data to the hashes
+        unsigned long long position = tell();
+        unsigned long long writen = writeDataToFile(input, inputSize);
+        streamHasher->update(position, input, writen);
+
+        return writen;
+    }
+
+    // Write the data using the compressor, the write behind buffer, the direct I/O file or the stream, depending on the settings
+    unsigned long long IsoReader::writeDataToFile(char *input, unsigned long long inputSize)
+    {
+        // The compressed output tracks the position of the uncompressed data
+        if (compressedWriter != nullptr)
+        {
+            std::string error;
+            unsigned long long writen = compressedWriter->write(input, inputSize, error);
+            if (!error.empty())
+            {
+                setLastError(error);
+            }
+            writePosition += writen;
+            return writen;
+        }
+
+        // Use the write behind buffer if enabled
+        if (writeBuffer[0] != nullptr)
+        {
+            return writeDataBuffered(input, inputSize);
+        }
+
+        // Direct I/O mode
+        if (directOutputFile != nullptr)
+        {
+            return writeDataDirect(input, inputSize);
+        }
+
         // Try to write to file
         try
         {
-            spdlog::trace("Writing {} bytes to output", inputSize);
+            SPDLOG_TRACE("Writing {} bytes to output", inputSize);
             output_file.write(input, inputSize);
-            spdlog::trace("Data was writen correctly. Returning the writen size");
+            SPDLOG_TRACE("Data was writen correctly. Returning the writen size");
             return inputSize; // If nothing has failed, then all the data was writen.
         }
         catch (std::ios_base::failure &e)
@@ -27,42 +120,632 @@ namespace PopstationmdgPlugin
         }
     }
 
-    void IsoReader::freeWriterResources()
+    // Single positional write using the native file. Returns the writen bytes or -1 on error.
+    // The system calls are added to the syscalls counter if provided.
+    long long IsoReader::nativeWrite(void *file, const char *buffer, unsigned long long size, unsigned long long position, std::atomic<uint64_t> *syscalls)
     {
+        unsigned long long writen = 0;
+
+        while (writen < size)
+        {
+            if (syscalls != nullptr)
+            {
+                syscalls->fetch_add(1, std::memory_order_relaxed);
+            }
+
+#ifdef _WIN32
+            // WriteFile with an offset is a positional write on handles opened without FILE_FLAG_OVERLAPPED
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = (DWORD)((position + writen) & 0xFFFFFFFF);
+            overlapped.OffsetHigh = (DWORD)((position + writen) >> 32);
+
+            DWORD chunkWriten = 0;
+            if (!WriteFile((HANDLE)file, buffer + writen, (DWORD)std::min(size - writen, (unsigned long long)0x40000000), &chunkWriten, &overlapped))
+            {
+                return -1;
+            }
+#else
+            ssize_t chunkWriten = pwrite(fileno((FILE *)file), buffer + writen, std::min(size - writen, (unsigned long long)0x7FFFF000), position + writen);
+            if (chunkWriten < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+#endif
+            writen += chunkWriten;
+        }
+
+        return writen;
     }
 
-    extern "C"
+    // Copy the data into the current write buffer. When the buffer is full it is passed to the writer
+    // thread and the host waits only if the other buffer is still being written to disk.
+    unsigned long long IsoReader::writeDataBuffered(char *input, unsigned long long inputSize)
     {
-        bool SHARED_EXPORT setTotalDisks(void *handler, unsigned int totalDisks)
+        unsigned long long writen = 0;
+
+        while (writen < inputSize)
+        {
+            // Check if the writer thread has failed
+            {
+                std::lock_guard<std::mutex> lock(writerMutex);
+                if (!writerError.empty())
+                {
+                    setLastError(writerError);
+                    return writen;
+                }
+            }
+
+            unsigned long long toCopy = std::min(inputSize - writen, bufferSize - writeBufferUsed[writeBufferCurrent]);
+            memcpy(writeBuffer[writeBufferCurrent] + writeBufferUsed[writeBufferCurrent], input + writen, toCopy);
+            writeBufferUsed[writeBufferCurrent] += toCopy;
+            writen += toCopy;
+            writePosition += toCopy;
+
+            if (writeBufferUsed[writeBufferCurrent] == bufferSize)
+            {
+                submitWriteBuffer();
+            }
+        }
+
+        return writen;
+    }
+
+    // Pass the current buffer to the writer thread and wait until the next one is free
+    void IsoReader::submitWriteBuffer()
+    {
+        std::unique_lock<std::mutex> lock(writerMutex);
+        writeBufferFull[writeBufferCurrent] = true;
+        writerCondition.notify_all();
+
+        writeBufferCurrent ^= 1;
+        writerCondition.wait(lock, [this]
+                             { return !writeBufferFull[writeBufferCurrent]; });
+    }
+
+    // Write all the buffered data to disk and wait until the writer thread has finished
+    bool IsoReader::flushWriteBuffers()
+    {
+        if (writeBufferUsed[writeBufferCurrent] > 0)
+        {
+            submitWriteBuffer();
+        }
+
+        std::unique_lock<std::mutex> lock(writerMutex);
+        writerCondition.wait(lock, [this]
+                             { return !writeBufferFull[0] && !writeBufferFull[1]; });
+
+        if (!writerError.empty())
+        {
+            std::string error = writerError;
+            writerError.clear();
+            lock.unlock();
+            setLastError(error);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Writer thread main loop. The buffers are always flushed alternately, in the same order they were filled.
+    void IsoReader::writerThreadLoop()
+    {
+        unsigned int index = 0;
+
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(writerMutex);
+            writerCondition.wait(lock, [this, index]
+                                 { return writeBufferFull[index] || writerStop; });
+
+            if (!writeBufferFull[index])
+            {
+                // Stop requested and nothing pending
+                break;
+            }
+
+            bool failed = !writerError.empty();
+            lock.unlock();
+
+            // After an error the remaining data is discarded, but the buffers are released to not block the host
+            if (!failed)
+            {
+                try
+                {
+                    output_file.write(writeBuffer[index], writeBufferUsed[index]);
+                }
+                catch (std::ios_base::failure &e)
+                {
+                    lock.lock();
+                    writerError = std::string("There was an error writing to the file: ").append(e.what());
+                    lock.unlock();
+                }
+            }
+
+            lock.lock();
+            writeBufferUsed[index] = 0;
+            writeBufferFull[index] = false;
+            lock.unlock();
+            writerCondition.notify_all();
+
+            index ^= 1;
+        }
+    }
+
+    // Reserve the write buffers and start the writer thread
+    bool IsoReader::startWriterThread()
+    {
+        SPDLOG_DEBUG("ISO: Reserving 2 write buffers of {} bytes", bufferSize);
+        for (int i = 0; i < 2; i++)
+        {
+            writeBuffer[i] = new (std::nothrow) char[bufferSize];
+            writeBufferUsed[i] = 0;
+            writeBufferFull[i] = false;
+
+            if (writeBuffer[i] == nullptr)
+            {
+                setLastError(std::string("There was an error allocating the write buffer memory."));
+                stopWriterThread();
+                return false;
+            }
+        }
+
+        writeBufferCurrent = 0;
+        writerStop = false;
+        writerError.clear();
+        writerThread = std::thread(&IsoReader::writerThreadLoop, this);
+
+        return true;
+    }
+
+    // Flush the pending data, stop the writer thread and free the buffers. Returns false if the data was not writen.
+    bool IsoReader::stopWriterThread()
+    {
+        bool flushed = true;
+
+        if (writerThread.joinable())
+        {
+            flushed = flushWriteBuffers();
+
+            {
+                std::lock_guard<std::mutex> lock(writerMutex);
+                writerStop = true;
+            }
+            writerCondition.notify_all();
+            writerThread.join();
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (writeBuffer[i] != nullptr)
+            {
+                delete[] writeBuffer[i];
+                writeBuffer[i] = nullptr;
+            }
+            writeBufferUsed[i] = 0;
+            writeBufferFull[i] = false;
+        }
+
+        return flushed;
+    }
+
+    // Set the expected output size. If the file is already opened the space is reserved now.
+    // The size only applies to the current or next output file, and it is forgotten when the file is closed.
+    // The compressed outputs are not preallocated, because the size is the uncompressed one.
+    bool IsoReader::setExpectedSize(unsigned long long size)
+    {
+        expectedSize = size;
+
+        if (output_file.is_open() && compressedWriter == nullptr)
+        {
+            return preallocateOutput();
+        }
+
+        return true;
+    }
+
+    // Reserve the expected size in the disk without changing the file size. Returns false only if there is not
+    // enough space. If the system doesn't support the preallocation, the file just grows with every write.
+    bool IsoReader::preallocateOutput()
+    {
+        if (preallocFile == nullptr)
+        {
+#ifdef _WIN32
+            HANDLE file = CreateFileA(outputFilename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            preallocFile = file == INVALID_HANDLE_VALUE ? nullptr : (void *)file;
+#else
+            preallocFile = (void *)nativeOpenFile(outputFilename.c_str(), O_RDWR);
+#endif
+            if (preallocFile == nullptr)
+            {
+                SPDLOG_DEBUG("ISO: The output file can't be opened to preallocate it");
+                return true;
+            }
+        }
+
+#ifdef _WIN32
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize.QuadPart = expectedSize;
+        if (!SetFileInformationByHandle((HANDLE)preallocFile, FileAllocationInfo, &allocation, sizeof(allocation)))
+        {
+            if (GetLastError() == ERROR_DISK_FULL)
+            {
+                setLastError(std::string("There is not enough space to write the output file: ") + std::to_string(expectedSize) + " bytes are required");
+                return false;
+            }
+            SPDLOG_DEBUG("ISO: The output file can't be preallocated: {}", nativeError());
+            return true;
+        }
+#elif defined(__linux__)
+        if (fallocate(fileno((FILE *)preallocFile), FALLOC_FL_KEEP_SIZE, 0, expectedSize) != 0)
+        {
+            if (errno == ENOSPC || errno == EFBIG)
+            {
+                setLastError(std::string("There is not enough space to write the output file: ") + std::to_string(expectedSize) + " bytes are required");
+                return false;
+            }
+            SPDLOG_DEBUG("ISO: The output file can't be preallocated: {}", nativeError());
+            return true;
+        }
+#elif defined(__APPLE__)
+        // The contiguous allocation is tried first. The reserved space doesn't change the file size.
+        int fd = fileno((FILE *)preallocFile);
+        fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)expectedSize, 0};
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1)
+        {
+            store.fst_flags = F_ALLOCATEALL;
+            if (fcntl(fd, F_PREALLOCATE, &store) == -1)
+            {
+                if (errno == ENOSPC || errno == EFBIG)
+                {
+                    setLastError(std::string("There is not enough space to write the output file: ") + std::to_string(expectedSize) + " bytes are required");
+                    return false;
+                }
+                SPDLOG_DEBUG("ISO: The output file can't be preallocated: {}", nativeError());
+                return true;
+            }
+        }
+#else
+        // posix_fallocate changes the file size, so the file is truncated again to its current size. Some file
+        // systems free the reserved blocks with it, but the lack of space is detected now anyway. It is not done
+        // while the write behind thread is running, because it could write at the same time.
+        if (writerThread.joinable())
         {
             return true;
         }
 
-        unsigned long long SHARED_EXPORT writeData(void *handler, char *input, unsigned long long inputSize)
+        int fd = fileno((FILE *)preallocFile);
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0)
         {
-            IsoReader *object = (IsoReader *)handler;
+            SPDLOG_DEBUG("ISO: The output file can't be preallocated: {}", nativeError());
+            return true;
+        }
 
-            return object->writeData(input, inputSize);
+        int result = posix_fallocate(fd, 0, expectedSize);
+        if (ftruncate(fd, fileStat.st_size) != 0)
+        {
+            setLastError(std::string("There was an error releasing the reserved output space: ").append(nativeError()));
+            return false;
         }
 
-        bool SHARED_EXPORT setGameID(void *handler, char *gameID)
+        if (result != 0)
         {
+            if (result == ENOSPC || result == EFBIG)
+            {
+                setLastError(std::string("There is not enough space to write the output file: ") + std::to_string(expectedSize) + " bytes are required");
+                return false;
+            }
+            SPDLOG_DEBUG("ISO: The output file can't be preallocated: {}", std::strerror(result));
             return true;
         }
+#endif
 
-        bool SHARED_EXPORT setDiskID(void *handler, char *gameID)
+        SPDLOG_DEBUG("ISO: Reserved {} bytes for the output file", expectedSize);
+        return true;
+    }
+
+    // Release the reserved space after the end of the file. Must be called after the output file is closed.
+    bool IsoReader::releasePreallocation()
+    {
+        if (preallocFile == nullptr)
         {
             return true;
         }
 
-        // Reserved for MultiDisk formats
-        bool SHARED_EXPORT addNewDisk(void *handler)
+        bool released = true;
+#ifdef _WIN32
+        // The allocation after the end of the file is released when the handle is closed
+        CloseHandle((HANDLE)preallocFile);
+#else
+        // Truncating to the current size frees the blocks reserved after the end of the file
+        struct stat fileStat;
+        if (fstat(fileno((FILE *)preallocFile), &fileStat) != 0 || ftruncate(fileno((FILE *)preallocFile), fileStat.st_size) != 0)
+        {
+            setLastError(std::string("There was an error releasing the reserved output space: ").append(nativeError()));
+            released = false;
+        }
+        fclose((FILE *)preallocFile);
+#endif
+
+        preallocFile = nullptr;
+        return released;
+    }
+
+    // Open the output file of the current disk and prepare the writer resources
+    bool IsoReader::openOutputFile(const char *filename)
+    {
+        // New file, new life. Reset all past errors.
+        output_file.clear();
+
+        // Open the destination file
+        try
         {
+            SPDLOG_DEBUG("ISO: Openning the output file: {}", filename);
+            output_file.open(filename, std::ifstream::binary);
+            SPDLOG_DEBUG("ISO: File opened correctly");
+
+            // Reserve the expected size to avoid the fragmentation and detect the lack of space now. The expected size
+            // of the compressed outputs is the uncompressed size, so they are not preallocated.
+            outputFilename = filename;
+            bool compressedOutput = compressedOutputFormat != CFNone || getCompressedFormat(filename) != CFNone;
+            if (expectedSize > 0 && !compressedOutput && !preallocateOutput())
+            {
+                output_file.close();
+                releasePreallocation();
+                return false;
+            }
+
+            // Prepare the raw sectors encoder if enabled
+            if (rawEncodeEnabled && !startRawEncoder())
+            {
+                output_file.close();
+                releasePreallocation();
+                return false;
+            }
+
+            // Compress the output if enabled. The compressed blocks are writen to the stream in the host thread.
+            writePosition = 0;
+            if (compressedOutput)
+            {
+                if (!startCompressedOutput(filename))
+                {
+                    stopRawEncoder();
+                    output_file.close();
+                    releasePreallocation();
+                    return false;
+                }
+                return true;
+            }
+
+            // Open the file again bypassing the system cache if enabled. The data is written in big
+            // aligned blocks, so the write behind thread is not used in this mode.
+            if (directIOEnabled && openDirectOutput(filename))
+            {
+                return true;
+            }
+
+            // Start the write behind thread if the buffer is enabled
+            if (bufferEnabled && !startWriterThread())
+            {
+                stopRawEncoder();
+                output_file.close();
+                releasePreallocation();
+                return false;
+            }
+
             return true;
         }
+        catch (std::ios_base::failure &e)
+        {
+            setLastError(std::string("There was an error opening the file: ") + std::string(e.what()));
+            return false;
+        }
+    }
 
-        // Reserved for MultiDisk formats
-        bool SHARED_EXPORT closeCurrentDisk(void *handler)
+    // Write the last raw sector and all the pending data, and close the output file of the current disk
+    bool IsoReader::closeOutputFile()
+    {
+        bool flushed = stopRawEncoder();
+        if (!finishCompressedOutput())
+        {
+            flushed = false;
+        }
+        if (!stopWriterThread())
+        {
+            flushed = false;
+        }
+        if (!closeDirectOutput())
+        {
+            flushed = false;
+        }
+
+        if (output_file.is_open())
+        {
+            try
+            {
+
+                SPDLOG_DEBUG("Closing the output file");
+                output_file.close();
+                output_file.clear();
+            }
+            catch (std::ios_base::failure &e)
+            {
+                setLastError(std::string("There was an error closing the output file: ") + std::string(e.what()));
+            }
+        }
+
+        // Write the index of the compressed output
+        if (!writeCompressedIndex())
+        {
+            flushed = false;
+        }
+
+        // Free the reserved space which was not used
+        if (!releasePreallocation())
+        {
+            flushed = false;
+        }
+
+        // The expected size is a hint for a single file, so it is not applied to the next one
+        expectedSize = 0;
+
+        return flushed;
+    }
+
+    // Start the compressor of the output. The space of the index is reserved for the expected size, or for a CD image if it is unknown.
+    bool IsoReader::startCompressedOutput(const char *filename)
+    {
+        CompressedFormat format = compressedOutputFormat != CFNone ? (CompressedFormat)compressedOutputFormat : getCompressedFormat(filename);
+
+#ifndef USE_LZ4
+        if (format == CFZso)
+        {
+            setLastError(std::string("The ZSO images are not supported by this build"));
+            return false;
+        }
+#endif
+
+        // The blocks are writen in the host thread, so the stream is not shared
+        auto rawWriter = [this](const char *data, unsigned long long size)
+        {
+            try
+            {
+                output_file.write(data, size);
+                return true;
+            }
+            catch (std::ios_base::failure &e)
+            {
+                return false;
+            }
+        };
+        compressedWriter = new CompressedWriter(rawWriter, format, outputCompressionLevel, workerThreads);
+
+        std::string error;
+        if (!compressedWriter->start(expectedSize, error))
+        {
+            setLastError(error);
+            delete compressedWriter;
+            compressedWriter = nullptr;
+            return false;
+        }
+
+        SPDLOG_DEBUG("ISO: Writing a {} image with level {} using {} threads", format == CFZso ? "ZSO" : "CSO", outputCompressionLevel, workerThreads);
+        return true;
+    }
+
+    // Write the pending compressed blocks. The compressor is freed if it fails, so the index is not writen.
+    bool IsoReader::finishCompressedOutput()
+    {
+        if (compressedWriter == nullptr)
+        {
+            return true;
+        }
+
+        std::string error;
+        if (!compressedWriter->finish(error))
+        {
+            setLastError(error);
+            delete compressedWriter;
+            compressedWriter = nullptr;
+            return false;
+        }
+
+        return true;
+    }
+
+    // Write the header and the index of the compressed output. Must be called after the output file is closed.
+    // If the space reserved for the index was not enough, the data is moved to make space for it.
+    bool IsoReader::writeCompressedIndex()
+    {
+        if (compressedWriter == nullptr)
+        {
+            return true;
+        }
+
+        unsigned long long relocation = compressedWriter->getRelocation();
+        std::vector<char> header;
+        std::string error;
+        std::fstream file(outputFilename, std::ios::in | std::ios::out | std::ios::binary);
+        bool writen = file.is_open() && compressedWriter->buildHeader(relocation, header, error);
+
+        if (writen && relocation > 0)
+        {
+            SPDLOG_DEBUG("ISO: The index doesn't fit in the reserved space. Moving the compressed data {} bytes", relocation);
+
+            // The data is moved from the end, so the chunks are not overwriten before they are readed
+            std::vector<char> chunk(bufferSize);
+            unsigned long long start = compressedWriter->getDataStart();
+            unsigned long long end = compressedWriter->getDataEnd();
+            while (end > start && writen)
+            {
+                unsigned long long size = std::min((unsigned long long)chunk.size(), end - start);
+                end -= size;
+
+                file.seekg(end);
+                file.read(chunk.data(), size);
+                file.seekp(end + relocation);
+                file.write(chunk.data(), size);
+                writen = !file.fail();
+            }
+        }
+
+        if (writen)
+        {
+            file.seekp(0);
+            file.write(header.data(), header.size());
+            file.flush();
+            writen = !file.fail();
+        }
+
+        if (!writen)
+        {
+            setLastError(error.empty() ? std::string("There was an error writing the compressed image index") : error);
+        }
+
+        delete compressedWriter;
+        compressedWriter = nullptr;
+
+        return writen;
+    }
+
+    void IsoReader::freeWriterResources()
+    {
+        stopWriterThread();
+
+        if (compressedWriter != nullptr)
+        {
+            delete compressedWriter;
+            compressedWriter = nullptr;
+        }
+    }
+
+    extern "C"
+    {
+        bool SHARED_EXPORT setExpectedSize(void *handler, unsigned long long size)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->setExpectedSize(size);
+        }
+
+        unsigned long long SHARED_EXPORT writeData(void *handler, char *input, unsigned long long inputSize)
+        {
+            IsoReader *object = (IsoReader *)handler;
+
+            return object->writeData(input, inputSize);
+        }
+
+        bool SHARED_EXPORT setGameID(void *handler, char *gameID)
+        {
+            return true;
+        }
+
+        bool SHARED_EXPORT setDiskID(void *handler, char *gameID)
         {
             return true;
         }
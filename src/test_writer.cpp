@@ -5,16 +5,796 @@
  */
 
 #include <vector>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
 #include "plugins/plugin_handler.h"
+#include "nlohmann_json/json.hpp"
 
 #ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
 #define EXT ".dll"
 #else
+#include <dlfcn.h>
+#include <unistd.h>
 #define EXT ".so"
 #endif
 
+// Plugin exports used by the round trip checks
+typedef void *(*loadFunc)();
+typedef void (*unloadFunc)(void *handler);
+typedef bool (*openFunc)(void *handler, char *filename, unsigned int mode, unsigned int compression, unsigned int threads);
+typedef bool (*closeFunc)(void *handler);
+typedef bool (*getErrorFunc)(void *handler, char *error, unsigned long long buffersize);
+typedef bool (*setSettingsFunc)(void *handler, const char *settingsData, unsigned long settingsSize);
+typedef bool (*seekFunc)(void *handler, unsigned long long position, unsigned int mode);
+typedef unsigned long long (*readDataFunc)(void *handler, char *output, unsigned long long toRead);
+typedef unsigned long long (*writeDataFunc)(void *handler, char *input, unsigned long long inputSize);
+typedef bool (*verifyFunc)(void *handler, char *output, unsigned long long buffersize);
+typedef bool (*getGameIDFunc)(void *handler, char *id, unsigned long long buffersize);
+typedef bool (*getStatsFunc)(void *handler, char *output, unsigned long long buffersize);
+
+// Same layout as the ReadRange of the plugin
+struct ReadRange
+{
+    unsigned long long position;
+    unsigned long long size;
+};
+
+typedef bool (*getSectorLayoutFunc)(void *handler, unsigned int &size, unsigned int &mode);
+typedef bool (*getBadSectorsFunc)(void *handler, char *output, unsigned long long buffersize);
+typedef bool (*getHashesFunc)(void *handler, char *hashes, unsigned long long buffersize);
+typedef unsigned long long (*readAtFunc)(void *handler, unsigned long long position, char *output, unsigned long long toRead);
+typedef unsigned long long (*readBatchFunc)(void *handler, const ReadRange *ranges, unsigned int count, char **outputs, unsigned long long *readed);
+
+struct PluginExports
+{
+    loadFunc load = nullptr;
+    unloadFunc unload = nullptr;
+    openFunc open = nullptr;
+    closeFunc close = nullptr;
+    getErrorFunc getError = nullptr;
+    setSettingsFunc setSettings = nullptr;
+    seekFunc seek = nullptr;
+    readDataFunc readData = nullptr;
+    writeDataFunc writeData = nullptr;
+    verifyFunc verify = nullptr;
+    getGameIDFunc getGameID = nullptr;
+    getStatsFunc getStats = nullptr;
+    getSectorLayoutFunc getSectorLayout = nullptr;
+    getBadSectorsFunc getBadSectors = nullptr;
+    getHashesFunc getHashes = nullptr;
+    readAtFunc readAt = nullptr;
+    readBatchFunc readBatch = nullptr;
+};
+
+static void *loadSymbol(void *library, const char *name)
+{
+#ifdef _WIN32
+    return (void *)GetProcAddress((HMODULE)library, name);
+#else
+    return dlsym(library, name);
+#endif
+}
+
+static bool loadExports(const char *path, PluginExports &plugin)
+{
+#ifdef _WIN32
+    void *library = (void *)LoadLibraryA(path);
+#else
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (library == nullptr)
+    {
+        fprintf(stderr, "The plugin %s can't be loaded\n", path);
+        return false;
+    }
+
+    plugin.load = (loadFunc)loadSymbol(library, "load");
+    plugin.unload = (unloadFunc)loadSymbol(library, "unload");
+    plugin.open = (openFunc)loadSymbol(library, "open");
+    plugin.close = (closeFunc)loadSymbol(library, "close");
+    plugin.getError = (getErrorFunc)loadSymbol(library, "getError");
+    plugin.setSettings = (setSettingsFunc)loadSymbol(library, "setSettings");
+    plugin.seek = (seekFunc)loadSymbol(library, "seek");
+    plugin.readData = (readDataFunc)loadSymbol(library, "readData");
+    plugin.writeData = (writeDataFunc)loadSymbol(library, "writeData");
+    plugin.verify = (verifyFunc)loadSymbol(library, "verify");
+    plugin.getGameID = (getGameIDFunc)loadSymbol(library, "getGameID");
+    plugin.getStats = (getStatsFunc)loadSymbol(library, "getStats");
+    plugin.getSectorLayout = (getSectorLayoutFunc)loadSymbol(library, "getSectorLayout");
+    plugin.getBadSectors = (getBadSectorsFunc)loadSymbol(library, "getBadSectors");
+    plugin.getHashes = (getHashesFunc)loadSymbol(library, "getHashes");
+    plugin.readAt = (readAtFunc)loadSymbol(library, "readAt");
+    plugin.readBatch = (readBatchFunc)loadSymbol(library, "readBatch");
+
+    return plugin.load && plugin.unload && plugin.open && plugin.close && plugin.getError && plugin.setSettings &&
+           plugin.seek && plugin.readData && plugin.writeData && plugin.verify && plugin.getGameID && plugin.getStats &&
+           plugin.getSectorLayout && plugin.getBadSectors && plugin.getHashes && plugin.readAt && plugin.readBatch;
+}
+
+static void printPluginError(PluginExports &plugin, void *handler)
+{
+    char error[1024] = {0};
+    plugin.getError(handler, error, sizeof(error));
+    fprintf(stderr, "Error: %s\n", error);
+}
+
+// Write a CSO image through the compression_format setting and read it back sequentially and at random
+// offsets, comparing the data with the writen one
+static bool checkCompressedRoundTrip(PluginExports &plugin)
+{
+    char filename[] = "test_write.cso";
+    const char settings[] = "{\"compression_format\": 1}";
+
+    // Half of the sectors are random to have blocks stored without compression too
+    std::vector<char> data(2048 * 1500 + 333);
+    std::mt19937 random(1);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (i / 2048) % 2 == 0 ? (char)random() : (char)(i % 31);
+    }
+
+    void *writer = plugin.load();
+    plugin.setSettings(writer, settings, sizeof(settings) - 1);
+    if (!plugin.open(writer, filename, PTWriter, 9, 4))
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        return false;
+    }
+
+    // Write with uneven sizes to split the blocks between calls
+    bool writed = true;
+    for (size_t position = 0; position < data.size() && writed;)
+    {
+        unsigned long long size = std::min<size_t>(data.size() - position, 1 + random() % 70000);
+        writed = plugin.writeData(writer, data.data() + position, size) == size;
+        position += size;
+    }
+    if (!plugin.close(writer) || !writed)
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        return false;
+    }
+    plugin.unload(writer);
+
+    void *reader = plugin.load();
+    if (!plugin.open(reader, filename, PTReader, 9, 4))
+    {
+        printPluginError(plugin, reader);
+        plugin.unload(reader);
+        return false;
+    }
+
+    std::vector<char> readed(data.size() + 1);
+    unsigned long long total = 0;
+    unsigned long long size = 0;
+    while ((size = plugin.readData(reader, readed.data() + total, std::min<size_t>(12345, readed.size() - total))) > 0)
+    {
+        total += size;
+    }
+    bool equal = total == data.size() && memcmp(readed.data(), data.data(), data.size()) == 0;
+    if (!equal)
+    {
+        fprintf(stderr, "The sequential read of the compressed image doesn't match the writen data\n");
+    }
+
+    for (unsigned int i = 0; i < 200 && equal; i++)
+    {
+        size_t position = random() % data.size();
+        size_t length = std::min<size_t>(1 + random() % 9000, data.size() - position);
+        if (!plugin.seek(reader, position, 0) || plugin.readData(reader, readed.data(), length) != length ||
+            memcmp(readed.data(), data.data() + position, length) != 0)
+        {
+            fprintf(stderr, "The compressed image data at %zu doesn't match the writen data\n", position);
+            equal = false;
+        }
+    }
+
+    plugin.close(reader);
+    plugin.unload(reader);
+    remove(filename);
+
+    return equal;
+}
+
+// Change a byte of a raw image sector, and check that it is reported as damaged by the verify and by the sectors
+// check of the reads
+static bool checkCorruptedSector(PluginExports &plugin, char *filename, unsigned long long lba)
+{
+    const char settings[] = "{\"verify_sectors\": true}";
+
+    FILE *file = fopen(filename, "r+b");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "The raw image can't be modified\n");
+        return false;
+    }
+    fseek(file, (long)(lba * 2352 + 1000), SEEK_SET);
+    int value = fgetc(file);
+    fseek(file, (long)(lba * 2352 + 1000), SEEK_SET);
+    fputc(value ^ 0x01, file);
+    fclose(file);
+
+    void *reader = plugin.load();
+    plugin.setSettings(reader, settings, sizeof(settings) - 1);
+    if (!plugin.open(reader, filename, PTReader, 9, 4))
+    {
+        printPluginError(plugin, reader);
+        plugin.unload(reader);
+        return false;
+    }
+
+    char verifyResults[4096] = {0};
+    char readResults[4096] = {0};
+    bool checked = plugin.verify(reader, verifyResults, sizeof(verifyResults));
+    if (checked)
+    {
+        std::vector<char> buffer(100000);
+        while (plugin.readData(reader, buffer.data(), buffer.size()) > 0)
+        {
+        }
+        checked = plugin.getBadSectors(reader, readResults, sizeof(readResults));
+    }
+    if (!checked)
+    {
+        printPluginError(plugin, reader);
+    }
+    plugin.close(reader);
+    plugin.unload(reader);
+
+    auto verified = nlohmann::json::parse(verifyResults, nullptr, false);
+    auto readed = nlohmann::json::parse(readResults, nullptr, false);
+    nlohmann::json expected = {lba};
+    if (checked && (verified.is_discarded() || verified["bad_sectors"] != expected))
+    {
+        fprintf(stderr, "The verify doesn't report the damaged sector %llu: %s\n", lba, verifyResults);
+        checked = false;
+    }
+    if (checked && (readed.is_discarded() || readed["bad_sectors"] != expected))
+    {
+        fprintf(stderr, "The reads don't report the damaged sector %llu: %s\n", lba, readResults);
+        checked = false;
+    }
+
+    return checked;
+}
+
+// Write a MODE2 raw image from 2048 bytes user data through the raw_sectors setting, and check that the reopened
+// image is detected as a raw MODE2 image, that the EDC/ECC of all the generated sectors is valid, and that a
+// changed byte is detected
+static bool checkRawSectors(PluginExports &plugin)
+{
+    char filename[] = "test_write_raw.iso";
+    const char settings[] = "{\"raw_sectors\": true, \"raw_sectors_mode\": 2}";
+    const unsigned long long sectors = 600;
+
+    std::vector<char> data(2048 * sectors);
+    std::mt19937 random(2);
+    for (auto &value : data)
+    {
+        value = (char)random();
+    }
+
+    void *writer = plugin.load();
+    plugin.setSettings(writer, settings, sizeof(settings) - 1);
+    if (!plugin.open(writer, filename, PTWriter, 9, 4))
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        return false;
+    }
+
+    bool writed = plugin.writeData(writer, data.data(), data.size()) == data.size();
+    if (!plugin.close(writer) || !writed)
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        return false;
+    }
+    plugin.unload(writer);
+
+    void *reader = plugin.load();
+    if (!plugin.open(reader, filename, PTReader, 9, 4))
+    {
+        printPluginError(plugin, reader);
+        plugin.unload(reader);
+        remove(filename);
+        return false;
+    }
+
+    unsigned int sectorSize = 0;
+    unsigned int sectorMode = 0;
+    if (!plugin.getSectorLayout(reader, sectorSize, sectorMode) || sectorSize != 2352 || sectorMode != 2)
+    {
+        fprintf(stderr, "The raw image layout is detected as %u bytes sectors, mode %u\n", sectorSize, sectorMode);
+        plugin.close(reader);
+        plugin.unload(reader);
+        remove(filename);
+        return false;
+    }
+
+    char results[4096] = {0};
+    if (!plugin.verify(reader, results, sizeof(results)))
+    {
+        printPluginError(plugin, reader);
+        plugin.close(reader);
+        plugin.unload(reader);
+        remove(filename);
+        return false;
+    }
+    plugin.close(reader);
+    plugin.unload(reader);
+
+    auto verified = nlohmann::json::parse(results, nullptr, false);
+    if (verified.is_discarded() || verified.value("sectors", 0ull) != sectors || !verified["bad_sectors"].empty())
+    {
+        fprintf(stderr, "The generated raw sectors are not valid: %s\n", results);
+        remove(filename);
+        return false;
+    }
+
+    bool checked = checkCorruptedSector(plugin, filename, 123);
+    remove(filename);
+
+    return checked;
+}
+
+// Read a whole file to compare it with the writen data
+static bool readFile(const char *filename, std::vector<char> &data)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    data.clear();
+    char buffer[65536];
+    size_t readed = 0;
+    while ((readed = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + readed);
+    }
+    fclose(file);
+
+    return true;
+}
+
+// Write a single disk output with a "(Disc 2)" tag in the name, and check that the data is writen to that file
+// and that the disk 1 of the set is not touched
+static bool checkDiscTagOutput(PluginExports &plugin)
+{
+    char filename[] = "test_write (Disc 2).iso";
+    const char firstDisk[] = "test_write (Disc 1).iso";
+    const char firstDiskData[] = "First disk data";
+
+    FILE *file = fopen(firstDisk, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "The disk 1 file can't be created\n");
+        return false;
+    }
+    fwrite(firstDiskData, 1, sizeof(firstDiskData), file);
+    fclose(file);
+
+    std::vector<char> data(5 * 1024 * 1024);
+    std::mt19937 random(3);
+    for (auto &value : data)
+    {
+        value = (char)random();
+    }
+
+    void *writer = plugin.load();
+    if (!plugin.open(writer, filename, PTWriter, 9, 4))
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        remove(firstDisk);
+        return false;
+    }
+
+    bool writed = plugin.writeData(writer, data.data(), data.size()) == data.size();
+    if (!plugin.close(writer) || !writed)
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        remove(firstDisk);
+        remove(filename);
+        return false;
+    }
+    plugin.unload(writer);
+
+    std::vector<char> writen;
+    std::vector<char> first;
+    bool equal = readFile(filename, writen) && writen == data;
+    if (!equal)
+    {
+        fprintf(stderr, "The output file doesn't contain the writen data\n");
+    }
+    if (!readFile(firstDisk, first) || first != std::vector<char>(firstDiskData, firstDiskData + sizeof(firstDiskData)))
+    {
+        fprintf(stderr, "The disk 1 file was modified by the writer\n");
+        equal = false;
+    }
+
+    remove(firstDisk);
+    remove(filename);
+
+    return equal;
+}
+
+// ID cache file of the ID cache check. The plugin writes the pending entries when the process finishes, so the
+// file is removed at exit by a handler registered before the plugin is loaded, which runs after it.
+static const char idCacheFilename[] = "test_idcache.json";
+
+static void removeIDCacheFiles()
+{
+    remove(idCacheFilename);
+    remove((std::string(idCacheFilename) + ".lock").c_str());
+}
+
+// Open an image without ID twice with the ID cache enabled. The first open scans the whole disk searching the ID,
+// and the second one takes the result from the cache, so it only reads the header checked for the compressed
+// formats and the sector hashed in the cache key.
+static bool checkIDCache(PluginExports &plugin)
+{
+    char filename[] = "test_idcache.iso";
+    std::string settings = std::string("{\"id_cache\": true, \"id_cache_path\": \"") + idCacheFilename + "\", \"stats\": true}";
+
+    // The bytes have the high bit set, so the data can't contain an ID
+    std::vector<char> data(2048 * 2000);
+    std::mt19937 random(4);
+    for (auto &value : data)
+    {
+        value = (char)(random() | 0x80);
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "The ID cache image can't be created\n");
+        return false;
+    }
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+
+    unsigned long long syscalls[2] = {0, 0};
+    bool checked = true;
+    for (unsigned int i = 0; i < 2 && checked; i++)
+    {
+        void *reader = plugin.load();
+        plugin.setSettings(reader, settings.c_str(), settings.size());
+        if (!plugin.open(reader, filename, PTReader, 9, 1))
+        {
+            printPluginError(plugin, reader);
+            plugin.unload(reader);
+            checked = false;
+            break;
+        }
+
+        char id[10] = {0};
+        char stats[16384] = {0};
+        if (plugin.getGameID(reader, id, sizeof(id)))
+        {
+            fprintf(stderr, "An ID was found in the ID cache image: %s\n", id);
+            checked = false;
+        }
+        if (!plugin.getStats(reader, stats, sizeof(stats)))
+        {
+            printPluginError(plugin, reader);
+            checked = false;
+        }
+        plugin.close(reader);
+        plugin.unload(reader);
+
+        auto results = nlohmann::json::parse(stats, nullptr, false);
+        syscalls[i] = results.is_discarded() ? 0 : results.value("syscalls", 0ull);
+    }
+    remove(filename);
+
+    if (checked && (syscalls[0] <= syscalls[1] || syscalls[1] > 2))
+    {
+        fprintf(stderr, "The image was readed again with the ID cache: %llu system calls, %llu cached\n", syscalls[0], syscalls[1]);
+        checked = false;
+    }
+
+    return checked;
+}
+
+// Read the ranges with a single batch and one by one with readAt, and check that both return the same data and
+// the same readed bytes for every range
+static bool compareReadBatch(PluginExports &plugin, void *reader, const std::vector<ReadRange> &ranges)
+{
+    std::vector<std::vector<char>> buffers(ranges.size());
+    std::vector<char *> outputs(ranges.size());
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        // The bytes after the readed ones must not be modified
+        buffers[i].assign(ranges[i].size + 1, (char)0xA5);
+        outputs[i] = buffers[i].data();
+    }
+
+    std::vector<unsigned long long> readed(ranges.size(), ~0ull);
+    unsigned long long total = plugin.readBatch(reader, ranges.data(), (unsigned int)ranges.size(), outputs.data(), readed.data());
+
+    unsigned long long expectedTotal = 0;
+    std::vector<char> expected;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        expected.assign(ranges[i].size + 1, (char)0xA5);
+        unsigned long long expectedReaded = plugin.readAt(reader, ranges[i].position, expected.data(), ranges[i].size);
+        expectedTotal += expectedReaded;
+        if (readed[i] != expectedReaded || buffers[i] != expected)
+        {
+            fprintf(stderr, "The batch range %zu at %llu (%llu bytes) readed %llu bytes instead of %llu\n", i,
+                    ranges[i].position, ranges[i].size, readed[i], expectedReaded);
+            return false;
+        }
+    }
+    if (total != expectedTotal)
+    {
+        fprintf(stderr, "The batch read returned %llu bytes instead of %llu\n", total, expectedTotal);
+        return false;
+    }
+
+    return true;
+}
+
+// Read unsorted, adjacent, overlapping, empty and past EOF ranges with readBatch and compare them with readAt.
+// The adjacent ranges are joined in scatter reads, and there are more of them than the buffers of a single read.
+// The file is shortened after the open, so a scatter read stops in the middle of a group, and the bytes of
+// the group are split between its ranges.
+static bool checkReadBatch(PluginExports &plugin)
+{
+    char filename[] = "test_batch.iso";
+    const unsigned long long size = 2048 * 300 + 100;
+
+    std::vector<char> data(size);
+    std::mt19937 random(5);
+    for (auto &value : data)
+    {
+        value = (char)random();
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "The batch read image can't be created\n");
+        return false;
+    }
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+
+    void *reader = plugin.load();
+    if (!plugin.open(reader, filename, PTReader, 9, 1))
+    {
+        printPluginError(plugin, reader);
+        plugin.unload(reader);
+        remove(filename);
+        return false;
+    }
+
+    std::vector<ReadRange> ranges = {
+        {5000, 3000},
+        {0, 100},
+        {100, 200},
+        {300, 0},
+        {2000, 4000},
+        {size - 50, 200},
+        {size + 10, 100},
+        {size, 10},
+        {8000, 1},
+    };
+
+    // Adjacent ranges in random order
+    std::vector<ReadRange> adjacent;
+    for (unsigned long long i = 0; i < 1500; i++)
+    {
+        adjacent.push_back({100000 + i * 64, 64});
+    }
+    std::shuffle(adjacent.begin(), adjacent.end(), random);
+    ranges.insert(ranges.end(), adjacent.begin(), adjacent.end());
+
+    bool equal = compareReadBatch(plugin, reader, ranges);
+
+#ifndef _WIN32
+    // The image size is taken at the open, so the last group ends after the real end of the file
+    const unsigned long long shortened = 2048 * 100 + 10;
+    if (equal && truncate(filename, shortened) != 0)
+    {
+        fprintf(stderr, "The batch read image can't be shortened\n");
+        equal = false;
+    }
+    if (equal)
+    {
+        std::vector<ReadRange> group = {
+            {shortened - 300, 800},
+            {shortened + 500, 100},
+            {shortened - 1000, 700},
+            {shortened, 500},
+        };
+        equal = compareReadBatch(plugin, reader, group);
+    }
+#endif
+
+    plugin.close(reader);
+    plugin.unload(reader);
+    remove(filename);
+
+    return equal;
+}
+
+// Bitwise CRC32 to check the digest calculated by the plugin
+static std::string crc32Digest(const std::vector<char> &data)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (char value : data)
+    {
+        crc ^= (uint8_t)value;
+        for (unsigned int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    char digest[9];
+    snprintf(digest, sizeof(digest), "%08x", ~crc);
+    return digest;
+}
+
+// Get the hashes of a closed file in JSON format
+static nlohmann::json getPluginHashes(PluginExports &plugin, void *handler)
+{
+    char hashes[1024] = {0};
+    if (!plugin.getHashes(handler, hashes, sizeof(hashes)))
+    {
+        printPluginError(plugin, handler);
+        return nlohmann::json();
+    }
+
+    return nlohmann::json::parse(hashes, nullptr, false);
+}
+
+// Read the ranges of the image in order with the hashes enabled. The reader seeks to the start of every range.
+static nlohmann::json readHashes(PluginExports &plugin, char *filename, unsigned int threads, const std::vector<ReadRange> &ranges)
+{
+    const char settings[] = "{\"hashes\": true}";
+
+    void *reader = plugin.load();
+    plugin.setSettings(reader, settings, sizeof(settings) - 1);
+    if (!plugin.open(reader, filename, PTReader, 9, threads))
+    {
+        printPluginError(plugin, reader);
+        plugin.unload(reader);
+        return nlohmann::json();
+    }
+
+    std::vector<char> buffer(1024 * 1024);
+    for (auto &range : ranges)
+    {
+        plugin.seek(reader, range.position, 0);
+
+        unsigned long long toRead = range.size;
+        unsigned long long readed = 0;
+        while (toRead > 0 && (readed = plugin.readData(reader, buffer.data(), std::min<unsigned long long>(buffer.size(), toRead))) > 0)
+        {
+            toRead -= readed;
+        }
+    }
+    plugin.close(reader);
+
+    auto hashes = getPluginHashes(plugin, reader);
+    plugin.unload(reader);
+
+    return hashes;
+}
+
+// Write an image with the hashes enabled and read it back, checking that the reader and the writer digests match
+// and that the CRC32 is right. The writer uses several workers and chunks bigger than the hash queue limit, so the
+// writes wait for the workers, and the readers hash the data in the caller thread and in the workers. A read
+// which seeks back keeps the hashes, and a gap in the read or an overwrite in the writer marks them as incomplete.
+static bool checkHashes(PluginExports &plugin)
+{
+    char filename[] = "test_hashes.iso";
+    const char settings[] = "{\"hashes\": true}";
+
+    std::vector<char> data(24 * 1024 * 1024 + 777);
+    std::mt19937 random(6);
+    for (auto &value : data)
+    {
+        value = (char)random();
+    }
+
+    void *writer = plugin.load();
+    plugin.setSettings(writer, settings, sizeof(settings) - 1);
+    if (!plugin.open(writer, filename, PTWriter, 9, 4))
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        return false;
+    }
+
+    bool writed = true;
+    for (size_t position = 0; position < data.size() && writed;)
+    {
+        unsigned long long size = std::min<size_t>(data.size() - position, 8 * 1024 * 1024);
+        writed = plugin.writeData(writer, data.data() + position, size) == size;
+        position += size;
+    }
+    if (!plugin.close(writer) || !writed)
+    {
+        printPluginError(plugin, writer);
+        plugin.unload(writer);
+        remove(filename);
+        return false;
+    }
+    auto writen = getPluginHashes(plugin, writer);
+    plugin.unload(writer);
+
+    bool checked = true;
+    if (!writen.is_object() || writen["size"] != data.size() || writen["complete"] != true || writen["crc32"] != crc32Digest(data))
+    {
+        fprintf(stderr, "The hashes of the writen image are not valid: %s\n", writen.dump().c_str());
+        checked = false;
+    }
+
+    auto sequential = readHashes(plugin, filename, 1, {{0, ~0ull}});
+    if (checked && sequential != writen)
+    {
+        fprintf(stderr, "The hashes of the sequential read don't match: %s\n", sequential.dump().c_str());
+        checked = false;
+    }
+
+    auto seekBack = readHashes(plugin, filename, 4, {{0, 3 * 1024 * 1024}, {1024 * 1024 + 5, ~0ull}});
+    if (checked && seekBack != writen)
+    {
+        fprintf(stderr, "The hashes of the read with a seek back don't match: %s\n", seekBack.dump().c_str());
+        checked = false;
+    }
+
+    auto gap = readHashes(plugin, filename, 2, {{0, 1024 * 1024}, {2 * 1024 * 1024, ~0ull}});
+    if (checked && (!gap.is_object() || gap["complete"] != false))
+    {
+        fprintf(stderr, "The hashes of the read with a gap are not marked as incomplete: %s\n", gap.dump().c_str());
+        checked = false;
+    }
+    remove(filename);
+
+    // The writer hashes don't match the file after an area is overwriten
+    writer = plugin.load();
+    plugin.setSettings(writer, settings, sizeof(settings) - 1);
+    if (checked && plugin.open(writer, filename, PTWriter, 9, 4))
+    {
+        plugin.writeData(writer, data.data(), 4096);
+        plugin.seek(writer, 1024, 0);
+        plugin.writeData(writer, data.data(), 1024);
+        plugin.close(writer);
+
+        auto overwriten = getPluginHashes(plugin, writer);
+        if (!overwriten.is_object() || overwriten["complete"] != false)
+        {
+            fprintf(stderr, "The hashes of the overwriten image are not marked as incomplete: %s\n", overwriten.dump().c_str());
+            checked = false;
+        }
+    }
+    plugin.unload(writer);
+    remove(filename);
+
+    return checked;
+}
+
 int main()
 {
+    atexit(removeIDCacheFiles);
+
     auto plugins = load_plugins("./", EXT, PTWriter);
     for (auto ph : plugins)
     {
@@ -69,5 +849,55 @@ int main()
         }
     }
 
+    // Check the compressed output of the ISO plugin
+    PluginExports isoPlugin;
+    if (!loadExports("./iso" EXT, isoPlugin))
+    {
+        fprintf(stderr, "The ISO plugin exports can't be loaded\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Checking the compressed output\n");
+    if (!checkCompressedRoundTrip(isoPlugin))
+    {
+        return 1;
+    }
+    fprintf(stderr, "The compressed image was readed correctly\n");
+
+    fprintf(stderr, "Checking the raw sectors output\n");
+    if (!checkRawSectors(isoPlugin))
+    {
+        return 1;
+    }
+    fprintf(stderr, "The raw sectors were generated correctly\n");
+
+    fprintf(stderr, "Checking a disk tagged output\n");
+    if (!checkDiscTagOutput(isoPlugin))
+    {
+        return 1;
+    }
+    fprintf(stderr, "The disk tagged output was writen correctly\n");
+
+    fprintf(stderr, "Checking the ID cache\n");
+    if (!checkIDCache(isoPlugin))
+    {
+        return 1;
+    }
+    fprintf(stderr, "The ID was taken from the ID cache\n");
+
+    fprintf(stderr, "Checking the batch reads\n");
+    if (!checkReadBatch(isoPlugin))
+    {
+        return 1;
+    }
+    fprintf(stderr, "The batch reads match the single reads\n");
+
+    fprintf(stderr, "Checking the hashes\n");
+    if (!checkHashes(isoPlugin))
+    {
+        return 1;
+    }
+    fprintf(stderr, "The hashes of the writer and the readers match\n");
+
     return 0;
 }
\ No newline at end of file